@@ -54,6 +54,12 @@
 #define SNDRV_CTL_TLVD_DB_SCALE_MUTE    0x10000
 
 #endif
+// batch provisioning has no request to fail, errors are only logged
+#define addCtlFail(request, status, ...) do { \
+    if (request) afb_req_fail_f(request, status, __VA_ARGS__); \
+    else AFB_ERROR(__VA_ARGS__); \
+} while (0)
+
 static const unsigned int *allocate_bool_fake_tlv(void) {
     static const SNDRV_CTL_TLVD_DECLARE_DB_MINMAX(range, -10000, 0);
     unsigned int *tlv = malloc(sizeof (range));
@@ -83,7 +89,9 @@ static const unsigned int *allocate_int_linear_tlv(int max, int min) {
     return tlv;
 }
 
-STATIC json_object * addOneSndCtl(afb_req_t request, snd_ctl_t *ctlDev, json_object *ctlJ, queryModeE queryMode) {
+// When compact is set, existing matching controls are left untouched (*skipped=1) and only numid is returned
+
+STATIC json_object * addOneSndCtl(afb_req_t request, snd_ctl_t *ctlDev, json_object *ctlJ, queryModeE queryMode, int compact, int *skipped) {
     int err, done, ctlNumid, ctlValue=0, shouldCreate;
     json_object *tmpJ;
     const char *ctlName;
@@ -94,6 +102,8 @@ STATIC json_object * addOneSndCtl(afb_req_t request, snd_ctl_t *ctlDev, json_obj
     snd_ctl_elem_id_t *elemId;
     snd_ctl_elem_value_t *elemValue;
     const unsigned int *elemTlv = NULL;
+    long long ctlMin64 = 0, ctlMax64 = 0, ctlStep64 = 1;
+    json_object *valJ = NULL;
 
     // parse json ctl object
     json_object_object_get_ex(ctlJ, "name", &tmpJ);
@@ -103,7 +113,7 @@ STATIC json_object * addOneSndCtl(afb_req_t request, snd_ctl_t *ctlDev, json_obj
     ctlNumid = json_object_get_int(tmpJ);
 
     if (!ctlNumid && !ctlName) {
-        afb_req_fail_f(request, "ctl-invalid", "crl=%s name or numid missing", json_object_get_string(ctlJ));
+        addCtlFail(request, "ctl-invalid", "crl=%s name or numid missing", json_object_get_string(ctlJ));
         goto OnErrorExit;
     }
 
@@ -114,8 +124,8 @@ STATIC json_object * addOneSndCtl(afb_req_t request, snd_ctl_t *ctlDev, json_obj
         if (done) ctlType = json_object_get_int(tmpJ);
         else ctlType = SND_CTL_ELEM_TYPE_INTEGER;
 
-        json_object_object_get_ex(ctlJ, "val", &tmpJ);
-        ctlValue = json_object_get_int(tmpJ);
+        json_object_object_get_ex(ctlJ, "val", &valJ);
+        ctlValue = json_object_get_int(valJ);
 
         // default for json_object_get_int is zero
         json_object_object_get_ex(ctlJ, "min", &tmpJ);
@@ -136,6 +146,18 @@ STATIC json_object * addOneSndCtl(afb_req_t request, snd_ctl_t *ctlDev, json_obj
         if (!done) ctlCount = 1;
         else ctlCount = json_object_get_int(tmpJ);
 
+        // 64bit range is parsed separately, bytes control have no range
+        if (ctlType == SND_CTL_ELEM_TYPE_INTEGER64) {
+            json_object_object_get_ex(ctlJ, "min", &tmpJ);
+            ctlMin64 = json_object_get_int64(tmpJ);
+            ctlMax64 = json_object_object_get_ex(ctlJ, "max", &tmpJ) ? json_object_get_int64(tmpJ) : ctlMax;
+            ctlStep64 = json_object_object_get_ex(ctlJ, "step", &tmpJ) ? json_object_get_int64(tmpJ) : 1;
+        }
+        if (ctlType == SND_CTL_ELEM_TYPE_BYTES) {
+            ctlMin = 0;
+            ctlMax = 0;
+        }
+
         json_object_object_get_ex(ctlJ, "snddev", &tmpJ);
         ctlSndDev = json_object_get_int(tmpJ);
 
@@ -154,7 +176,7 @@ STATIC json_object * addOneSndCtl(afb_req_t request, snd_ctl_t *ctlDev, json_obj
     if (err) {
         shouldCreate = 1;
     } else {
-        int count, min, max, sndDev, subDev;
+        int count, min, max, sndDev, subDev, sameRange;
         snd_ctl_elem_type_t type;
 
         // ctl exit let's get associated elemID
@@ -163,8 +185,8 @@ STATIC json_object * addOneSndCtl(afb_req_t request, snd_ctl_t *ctlDev, json_obj
 
         // If this is a hardware ctl only update value
         if (ctlNumid != CTL_AUTO) {
-            json_object_object_get_ex(ctlJ, "val", &tmpJ);
-            ctlValue = json_object_get_int(tmpJ);
+            json_object_object_get_ex(ctlJ, "val", &valJ);
+            ctlValue = json_object_get_int(valJ);
             goto UpdateDefaultVal;
         }
 
@@ -175,9 +197,17 @@ STATIC json_object * addOneSndCtl(afb_req_t request, snd_ctl_t *ctlDev, json_obj
         sndDev = (int) snd_ctl_elem_info_get_device(elemInfo);
         subDev = (int) snd_ctl_elem_info_get_subdevice(elemInfo);
 
-        if (count == ctlCount && min == ctlMin && max == ctlMax && type == ctlType && sndDev == ctlSndDev && subDev == ctlSubDev) {
-            // Adjust value to best fit request
+        if (type == SND_CTL_ELEM_TYPE_INTEGER64) sameRange = snd_ctl_elem_info_get_min64(elemInfo) == ctlMin64 && snd_ctl_elem_info_get_max64(elemInfo) == ctlMax64;
+        else if (type == SND_CTL_ELEM_TYPE_BYTES) sameRange = 1;
+        else sameRange = (min == ctlMin && max == ctlMax);
+
+        if (count == ctlCount && sameRange && type == ctlType && sndDev == ctlSndDev && subDev == ctlSubDev) {
+            // batch provisioning keeps existing value, otherwise adjust value to best fit request
             shouldCreate = 0;
+            if (compact) {
+                *skipped = 1;
+                return json_object_new_int(snd_ctl_elem_info_get_numid(elemInfo));
+            }
         } else {
             err = snd_ctl_elem_remove(ctlDev, elemId);
             shouldCreate = 1;
@@ -204,7 +234,7 @@ STATIC json_object * addOneSndCtl(afb_req_t request, snd_ctl_t *ctlDev, json_obj
                 err = snd_ctl_add_boolean_elem_set(ctlDev, elemInfo, 1, ctlCount);
                 if (err) {
                     AFB_ERROR("AddOntSndCtl Boolean: devid='%s' name='%s' count=%d", snd_ctl_name(ctlDev), ctlName, ctlCount);
-                    afb_req_fail_f(request, "ctl-invalid-bool", "devid='%s' name='%s' count=%d", snd_ctl_name(ctlDev), ctlName, ctlCount);
+                    addCtlFail(request, "ctl-invalid-bool", "devid='%s' name='%s' count=%d", snd_ctl_name(ctlDev), ctlName, ctlCount);
                     goto OnErrorExit;
                 }
             }
@@ -219,7 +249,7 @@ STATIC json_object * addOneSndCtl(afb_req_t request, snd_ctl_t *ctlDev, json_obj
                 err = snd_ctl_add_integer_elem_set(ctlDev, elemInfo, 1, ctlCount, ctlMin, ctlMax, ctlStep);
                 if (err) {
                     AFB_ERROR("AddOntSndCtl Integer: devid='%s' name='%s' count=%d min=%d max=%d step=%d", snd_ctl_name(ctlDev), ctlName, ctlCount, ctlMin, ctlMax, ctlStep);
-                    afb_req_fail_f(request, "ctl-invalid-bool", "devid='%s' name='%s' count=%d min=%d max=%d step=%d", snd_ctl_name(ctlDev), ctlName, ctlCount, ctlMin, ctlMax, ctlStep);
+                    addCtlFail(request, "ctl-invalid-bool", "devid='%s' name='%s' count=%d min=%d max=%d step=%d", snd_ctl_name(ctlDev), ctlName, ctlCount, ctlMin, ctlMax, ctlStep);
                     goto OnErrorExit;
                 }
             }
@@ -230,13 +260,13 @@ STATIC json_object * addOneSndCtl(afb_req_t request, snd_ctl_t *ctlDev, json_obj
                 int min, max;
 
                 if (json_object_get_type(dbscaleJ) != json_type_object) {
-                    afb_req_fail_f(request, "ctl-invalid-dbscale", "devid=%s crl=%s invalid json in integer control", snd_ctl_name(ctlDev), json_object_get_string(ctlJ));
+                    addCtlFail(request, "ctl-invalid-dbscale", "devid=%s crl=%s invalid json in integer control", snd_ctl_name(ctlDev), json_object_get_string(ctlJ));
                     goto OnErrorExit;
 
                     json_object_object_get_ex(ctlJ, "min", &tmpJ);
                     min = json_object_get_int(tmpJ);
                     if (min >= 0) {
-                        afb_req_fail_f(request, "ctl-invalid-dbscale", "devid=%s crl=%s min should be a negative number", snd_ctl_name(ctlDev), json_object_get_string(ctlJ));
+                        addCtlFail(request, "ctl-invalid-dbscale", "devid=%s crl=%s min should be a negative number", snd_ctl_name(ctlDev), json_object_get_string(ctlJ));
                         goto OnErrorExit;
                     }
 
@@ -264,7 +294,7 @@ STATIC json_object * addOneSndCtl(afb_req_t request, snd_ctl_t *ctlDev, json_obj
                 json_object *enumsJ;
                 json_object_object_get_ex(ctlJ, "enums", &enumsJ);
                 if (json_object_get_type(enumsJ) != json_type_array) {
-                    afb_req_fail_f(request, "ctl-missing-enums", "devid=%s crl=%s mandatory enum=xxx missing in enumerated control", snd_ctl_name(ctlDev), json_object_get_string(ctlJ));
+                    addCtlFail(request, "ctl-missing-enums", "devid=%s crl=%s mandatory enum=xxx missing in enumerated control", snd_ctl_name(ctlDev), json_object_get_string(ctlJ));
                     goto OnErrorExit;
                 }
 
@@ -278,7 +308,7 @@ STATIC json_object * addOneSndCtl(afb_req_t request, snd_ctl_t *ctlDev, json_obj
 
                 err = snd_ctl_add_enumerated_elem_set(ctlDev, elemInfo, 1, ctlCount, (int) length, enumlabels);
                 if (err) {
-                    afb_req_fail_f(request, "ctl-invalid-bool", "devid=%s crl=%s invalid enumerated control", snd_ctl_name(ctlDev), json_object_get_string(ctlJ));
+                    addCtlFail(request, "ctl-invalid-bool", "devid=%s crl=%s invalid enumerated control", snd_ctl_name(ctlDev), json_object_get_string(ctlJ));
                     goto OnErrorExit;
                 }
 
@@ -287,11 +317,28 @@ STATIC json_object * addOneSndCtl(afb_req_t request, snd_ctl_t *ctlDev, json_obj
             }
             break;
 
-            // Long Term Waiting ToDoList
         case SND_CTL_ELEM_TYPE_INTEGER64:
+            if (shouldCreate) {
+                err = snd_ctl_add_integer64_elem_set(ctlDev, elemInfo, 1, ctlCount, ctlMin64, ctlMax64, ctlStep64);
+                if (err) {
+                    addCtlFail(request, "ctl-invalid-int64", "devid='%s' name='%s' count=%d min=%lld max=%lld step=%lld", snd_ctl_name(ctlDev), ctlName, ctlCount, ctlMin64, ctlMax64, ctlStep64);
+                    goto OnErrorExit;
+                }
+            }
+            break;
+
         case SND_CTL_ELEM_TYPE_BYTES:
+            if (shouldCreate) {
+                err = snd_ctl_add_bytes_elem_set(ctlDev, elemInfo, 1, ctlCount);
+                if (err) {
+                    addCtlFail(request, "ctl-invalid-bytes", "devid='%s' name='%s' count=%d", snd_ctl_name(ctlDev), ctlName, ctlCount);
+                    goto OnErrorExit;
+                }
+            }
+            break;
+
         default:
-            afb_req_fail_f(request, "ctl-invalid-type", "crl=%s unsupported type type=%d numid=%d", json_object_get_string(ctlJ), ctlType, ctlNumid);
+            addCtlFail(request, "ctl-invalid-type", "crl=%s unsupported type type=%d numid=%d", json_object_get_string(ctlJ), ctlType, ctlNumid);
             goto OnErrorExit;
     }
 
@@ -299,8 +346,34 @@ UpdateDefaultVal:
 
     // Set Value to default
     snd_ctl_elem_value_alloca(&elemValue);
+
+    // bytes default value is a base64 payload (zero filled when shorter or missing), never an integer
+    if (snd_ctl_elem_info_get_type(elemInfo) == SND_CTL_ELEM_TYPE_BYTES) {
+        int count = (int) snd_ctl_elem_info_get_count(elemInfo);
+        unsigned char *bytes = NULL;
+        ssize_t size = 0;
+
+        if (valJ && !json_object_is_type(valJ, json_type_string)) {
+            addCtlFail(request, "ctl-invalid-bytes", "devid='%s' name='%s' bytes val should be a base64 string", snd_ctl_name(ctlDev), ctlName);
+            goto OnErrorExit;
+        }
+        if (valJ) size = alsaBase64Decode(json_object_get_string(valJ), &bytes);
+        if (size < 0) {
+            addCtlFail(request, "ctl-invalid-base64", "devid='%s' name='%s' val is not a base64 string", snd_ctl_name(ctlDev), ctlName);
+            goto OnErrorExit;
+        }
+        for (int idx = 0; idx < count; idx++) snd_ctl_elem_value_set_byte(elemValue, idx, idx < size ? bytes[idx] : 0);
+        free(bytes);
+        goto WriteDefaultVal;
+    }
+
     for (int idx = 0; idx < snd_ctl_elem_info_get_count(elemInfo); idx++) {
-        
+
+        if (snd_ctl_elem_info_get_type(elemInfo) == SND_CTL_ELEM_TYPE_INTEGER64) {
+            snd_ctl_elem_value_set_integer64(elemValue, idx, json_object_get_int64(valJ));
+            continue;
+        }
+
         // initial default value should be a percentage for integer
         if (snd_ctl_elem_info_get_type(elemInfo) == SND_CTL_ELEM_TYPE_INTEGER) {
             double min = (double)snd_ctl_elem_info_get_min(elemInfo);
@@ -313,6 +386,7 @@ UpdateDefaultVal:
         }
     }
 
+WriteDefaultVal:
     // write default values in newly created control
     snd_ctl_elem_id_alloca(&elemId);
     snd_ctl_elem_info(ctlDev, elemInfo);
@@ -334,8 +408,10 @@ UpdateDefaultVal:
     }
 
 DoNotUpdate:
+    if (compact) return json_object_new_int(snd_ctl_elem_info_get_numid(elemInfo));
+
     // return newly created as a JSON object
-    alsaGetSingleCtl(ctlDev, elemId, &ctlRequest, queryMode);
+    alsaGetSingleCtl(ctlDev, elemId, &ctlRequest, queryMode, NULL);
     if (ctlRequest.used < 0) {
         AFB_WARNING("addOneSndCtl: crl=%s numid=%d Fail to get value", json_object_get_string(ctlJ), snd_ctl_elem_info_get_numid(elemInfo));
     }
@@ -345,9 +421,55 @@ OnErrorExit:
     return NULL;
 }
 
+// Provision every control of one card over a single handle, failed controls are reported by name
+
+STATIC json_object *addCardSndCtls(const char *devid, json_object *ctlsJ) {
+    json_object *responseJ, *numidsJ, *failedJ, *ctlJ, *numidJ, *tmpJ;
+    snd_ctl_t *ctlDev;
+    int err, written = 0, skipped = 0;
+
+    err = snd_ctl_open(&ctlDev, devid, 0);
+    if (err < 0) {
+        AFB_ERROR("addCardSndCtls: SndCard devid=[%s] Not Found err=%s", devid, snd_strerror(err));
+        return NULL;
+    }
+
+    numidsJ = json_object_new_object();
+    failedJ = json_object_new_array();
+    for (int idx = 0; idx < json_object_array_length(ctlsJ); idx++) {
+        int ctlSkipped = 0;
+
+        ctlJ = json_object_array_get_idx(ctlsJ, idx);
+        json_object_object_get_ex(ctlJ, "name", &tmpJ);
+        const char *ctlName = tmpJ ? json_object_get_string(tmpJ) : json_object_get_string(ctlJ);
+
+        numidJ = addOneSndCtl(NULL, ctlDev, ctlJ, QUERY_QUIET, 1, &ctlSkipped);
+        if (!numidJ) {
+            json_object_array_add(failedJ, json_object_new_string(ctlName));
+            continue;
+        }
+        json_object_object_add(numidsJ, ctlName, numidJ);
+        if (ctlSkipped) skipped++;
+        else written++;
+    }
+    snd_ctl_close(ctlDev);
+
+    // card control list changed, cached catalog is obsolete
+    if (written) alsaCardCacheInvalidate(alsaCardIndex(devid));
+
+    responseJ = json_object_new_object();
+    json_object_object_add(responseJ, "devid", json_object_new_string(devid));
+    json_object_object_add(responseJ, "written", json_object_new_int(written));
+    json_object_object_add(responseJ, "skipped", json_object_new_int(skipped));
+    json_object_object_add(responseJ, "numids", numidsJ);
+    if (json_object_array_length(failedJ) > 0) json_object_object_add(responseJ, "failed", failedJ);
+    else json_object_put(failedJ);
+    return responseJ;
+}
+
 PUBLIC void alsaAddCustomCtls(afb_req_t request) {
-    int err;
-    json_object *ctlsJ, *ctlsValues, *ctlValues;
+    int err, skipped;
+    json_object *ctlsJ = NULL, *ctlsValues, *ctlValues, *tmpJ;
     enum json_type;
     snd_ctl_t *ctlDev = NULL;
     const char *devid, *mode;
@@ -358,6 +480,33 @@ PUBLIC void alsaAddCustomCtls(afb_req_t request) {
         goto OnErrorExit;
     }
 
+    // controls are taken from request json, only string arguments are parsed
+    if (!json_object_object_get_ex(afb_req_json(request), "ctl", &tmpJ) || !tmpJ) {
+        afb_req_fail_f(request, "ctls-missing", "ctls MUST be defined as a JSON array for alsaAddCustomCtls");
+        goto OnErrorExit;
+    }
+    if (json_object_is_type(tmpJ, json_type_string)) ctlsJ = json_tokener_parse(json_object_get_string(tmpJ));
+    else ctlsJ = json_object_get(tmpJ);
+    if (!ctlsJ) {
+        afb_req_fail_f(request, "ctls-missing", "ctls MUST be defined as a JSON array for alsaAddCustomCtls");
+        goto OnErrorExit;
+    }
+
+    // batch mode skips existing matching controls and returns numids only
+    if (json_object_object_get_ex(afb_req_json(request), "batch", &tmpJ) && json_object_get_boolean(tmpJ)) {
+        if (!json_object_is_type(ctlsJ, json_type_array)) {
+            afb_req_fail_f(request, "ctls-invalid", "ctls=%s batch requires a JSON array", json_object_get_string(ctlsJ));
+            goto OnErrorExit;
+        }
+        ctlsValues = addCardSndCtls(devid, ctlsJ);
+        if (!ctlsValues) {
+            afb_req_fail_f(request, "devid-unknown", "SndCard devid=[%s] Not Found", devid);
+            goto OnErrorExit;
+        }
+        afb_req_success(request, ctlsValues, NULL);
+        goto OnErrorExit;
+    }
+
     // open control interface for devid
     err = snd_ctl_open(&ctlDev, devid, 0);
     if (err < 0) {
@@ -372,16 +521,9 @@ PUBLIC void alsaAddCustomCtls(afb_req_t request) {
         sscanf(mode, "%i", (int*) &queryMode);
     }
 
-    // extract sound controls and parse json
-    ctlsJ = json_tokener_parse(afb_req_value(request, "ctl"));
-    if (!ctlsJ) {
-        afb_req_fail_f(request, "ctls-missing", "ctls MUST be defined as a JSON array for alsaAddCustomCtls");
-        goto OnErrorExit;
-    }
-
     switch (json_object_get_type(ctlsJ)) {
         case json_type_object:
-            ctlsValues = addOneSndCtl(request, ctlDev, ctlsJ, queryMode);
+            ctlsValues = addOneSndCtl(request, ctlDev, ctlsJ, queryMode, 0, &skipped);
             if (!ctlsValues) goto OnErrorExit;
             break;
 
@@ -389,9 +531,12 @@ PUBLIC void alsaAddCustomCtls(afb_req_t request) {
             ctlsValues = json_object_new_array();
             for (int idx = 0; idx < json_object_array_length(ctlsJ); idx++) {
                 json_object *ctlJ = json_object_array_get_idx(ctlsJ, idx);
-                ctlValues = addOneSndCtl(request, ctlDev, ctlJ, queryMode);
-                if (ctlValues) json_object_array_add(ctlsValues, ctlValues);
-                else goto OnErrorExit;
+                ctlValues = addOneSndCtl(request, ctlDev, ctlJ, queryMode, 0, &skipped);
+                if (!ctlValues) {
+                    json_object_put(ctlsValues);
+                    goto OnErrorExit;
+                }
+                json_object_array_add(ctlsValues, ctlValues);
             }
             break;
 
@@ -404,6 +549,54 @@ PUBLIC void alsaAddCustomCtls(afb_req_t request) {
     afb_req_success(request, ctlsValues, NULL);
 
 OnErrorExit:
+    // card control list changed, cached catalog is obsolete
+    if (ctlDev) alsaCardCacheInvalidate(alsaCardIndex(devid));
     if (ctlDev) snd_ctl_close(ctlDev);
+    // ctl was parsed or referenced from request json, released on every path
+    if (ctlsJ) json_object_put(ctlsJ);
     return;
 }
+
+// Provision custom controls declared in ALSACORE_CUSTOMCTLS json file: [{"devid":"hw:0","ctls":[{...}]}, ...]
+
+PUBLIC int alsaAddCustomCtlsInit(void) {
+    json_object *configJ, *cardJ, *devidJ, *ctlsJ, *resultJ;
+    const char *path = getenv("ALSACORE_CUSTOMCTLS");
+    int err = 0;
+
+    if (!path) path = ALSA_CUSTOM_CTLS;
+    if (!path || !*path) return 0;
+
+    configJ = json_object_from_file(path);
+    if (!configJ) {
+        AFB_WARNING("alsaAddCustomCtlsInit: path=%s missing or invalid json", path);
+        return -1;
+    }
+    if (json_object_is_type(configJ, json_type_object)) {
+        json_object *arrayJ = json_object_new_array();
+        json_object_array_add(arrayJ, configJ);
+        configJ = arrayJ;
+    }
+
+    for (int idx = 0; idx < json_object_array_length(configJ); idx++) {
+        cardJ = json_object_array_get_idx(configJ, idx);
+        if (!json_object_object_get_ex(cardJ, "devid", &devidJ) || !json_object_object_get_ex(cardJ, "ctls", &ctlsJ)
+                || !json_object_is_type(ctlsJ, json_type_array)) {
+            AFB_WARNING("alsaAddCustomCtlsInit: path=%s entry=%d devid or ctls array missing", path, idx);
+            err = -1;
+            continue;
+        }
+
+        resultJ = addCardSndCtls(json_object_get_string(devidJ), ctlsJ);
+        if (!resultJ) {
+            err = -1;
+            continue;
+        }
+        AFB_NOTICE("alsaAddCustomCtlsInit: %s", json_object_get_string(resultJ));
+        if (json_object_object_get_ex(resultJ, "failed", NULL)) err = -1;
+        json_object_put(resultJ);
+    }
+
+    json_object_put(configJ);
+    return err;
+}
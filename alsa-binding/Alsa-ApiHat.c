@@ -45,23 +45,55 @@ static const afb_verb_t api_verbs[] = {
     { .verb = "ctlget", .callback = alsaGetCtls, .info="Get one or many control values"},
     { .verb = "ctlset", .callback = alsaSetCtls, .info="Set one control or more"},
     { .verb = "subscribe", .callback = alsaEvtSubcribe, .info="subscribe to alsa events"},
+    { .verb = "hotplug", .callback = alsaCardHotplugSubscribe, .info="subscribe to card-added/card-removed events"},
     { .verb = "cardidget", .callback = alsaGetCardId, .info="get sound card id"},
     { .verb = "halregister", .callback = alsaRegisterHal, .info="register a new HAL in alsacore"},
+    { .verb = "halunregister", .callback = alsaUnregisterHal, .info="unregister a HAL from its api prefix"},
     { .verb = "hallist", .callback = alsaActiveHal, .info="Get list of currently active HAL"},
     { .verb = "pcminfo", .callback = alsaPcmInfo, .info="Get Alsa Info About a given PCM"},
+    { .verb = "pcmcaps", .callback = alsaPcmCaps, .info="Get hardware capabilities of one or many PCM"},
     { .verb = "ucmquery", .callback = alsaUseCaseQuery,.info="Use Case Manager Query"},
     { .verb = "ucmset", .callback = alsaUseCaseSet,.info="Use Case Manager set"},
     { .verb = "ucmget", .callback = alsaUseCaseGet,.info="Use Case Manager Get"},
     { .verb = "ucmreset", .callback = alsaUseCaseReset, .info="Use Case Manager Reset"},
     { .verb = "ucmclose", .callback = alsaUseCaseClose, .info="Use Case Manager Close"},
+    { .verb = "ucmstate", .callback = alsaUseCaseState, .info="Use Case Manager current state"},
     { .verb = "addcustomctl", .callback = alsaAddCustomCtls, .info="Add Software Alsa Custom Control"},
+    { .verb = "tlvwrite", .callback = alsaTlvWrite, .info="Upload chunked TLV payload (base64 or file)"},
+    { .verb = "ctlsave", .callback = alsaSnapshotSave, .info="Save mixer state of every sound card into snapshot"},
+    { .verb = "ctlrestore", .callback = alsaSnapshotRestore, .info="Restore mixer state from snapshot"},
+    { .verb = "hooktelemetry", .callback = alsaHookTelemetry, .info="Record alsa-hook stream telemetry or get it aggregated per pcm/app"},
     { .verb = NULL} /* marker for end of the array */
 };
 
+/*
+ * binding init, restore mixer state before any client request
+ */
+STATIC int alsaBindingInit(afb_api_t api) {
+
+    // UCM managers are opened on worker threads and handed back to mainloop
+    alsaUseCaseInit();
+
+    // present sound cards, refreshed on /dev/snd hotplug
+    alsaCardTableInit();
+
+    // declared custom controls exist before card catalogs get cached
+    if (alsaAddCustomCtlsInit() < 0) AFB_WARNING("alsaBindingInit: some custom controls could not be created");
+
+    // prewarm card capability cache (and optionally UCM/events) in parallel
+    alsaCardCacheInit();
+
+    // a broken snapshot should never prevent alsacore from starting
+    if (alsaSnapshotInit() < 0) AFB_WARNING("alsaBindingInit: mixer snapshot restore failed");
+
+    return 0;
+}
+
 /*
  * description of the binding for afb-daemon
  */
 const afb_binding_t afbBindingExport = {
     .api = "alsacore",
     .verbs = api_verbs,
+    .init = alsaBindingInit,
 };
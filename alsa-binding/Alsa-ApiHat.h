@@ -38,6 +38,55 @@
   #define CONTROL_MAXPATH_LEN 255
 #endif
 
+// same as SNDRV_CTL_ELEM_ID_NAME_MAXLEN (not exported by alsa-lib)
+#ifndef CTL_NAME_MAXLEN
+  #define CTL_NAME_MAXLEN 44
+#endif
+
+// mixer snapshot restored at binding init (overload with ALSACORE_SNAPSHOT env)
+#ifndef ALSA_SNAPSHOT_PATH
+  #define ALSA_SNAPSHOT_PATH "/var/lib/alsacore/mixer.snapshot"
+#endif
+
+// sound card capabilities cache directory (overload with ALSACORE_CACHEDIR env)
+#ifndef ALSA_CACHE_DIR
+  #define ALSA_CACHE_DIR "/var/cache/alsacore"
+#endif
+
+// card prewarm at init also opens UCM manager/sndctl events (overload with ALSACORE_PREWARM_UCM/EVT env)
+#ifndef ALSA_PREWARM_UCM
+  #define ALSA_PREWARM_UCM 0
+#endif
+#ifndef ALSA_PREWARM_EVT
+  #define ALSA_PREWARM_EVT 0
+#endif
+
+// custom controls json file provisioned at init (overload with ALSACORE_CUSTOMCTLS env)
+#ifndef ALSA_CUSTOM_CTLS
+  #define ALSA_CUSTOM_CTLS NULL
+#endif
+
+// tlvwrite default chunk and max payload size (bytes)
+#ifndef ALSA_TLV_CHUNK_SIZE
+  #define ALSA_TLV_CHUNK_SIZE 4096
+#endif
+#ifndef ALSA_TLV_MAX_SIZE
+  #define ALSA_TLV_MAX_SIZE (4 * 1024 * 1024)
+#endif
+// tlvwrite path=name only reads files from this directory (overload with ALSACORE_TLVDIR env)
+#ifndef ALSA_TLV_DIR
+  #define ALSA_TLV_DIR "/etc/alsacore/tlv"
+#endif
+// kernel refuses TLV ioctl above 128KB (type/length header included)
+#ifndef ALSA_TLV_KERNEL_MAX
+  #define ALSA_TLV_KERNEL_MAX (128 * 1024)
+#endif
+
+// max UCM managers kept open, least recently used is closed first (overload with ALSACORE_UCM_MAX env)
+#ifndef ALSA_UCM_MAX_OPEN
+  #define ALSA_UCM_MAX_OPEN MAX_SND_CARD
+#endif
+
 typedef enum {
   QUERY_QUIET   =0,
   QUERY_COMPACT =1,
@@ -72,12 +121,60 @@ typedef struct {
     int used;
 } ctlRequestT;
 
+// control access rights as cached within catalog
+typedef enum {
+    CTL_ACL_READ      = 1 << 0,
+    CTL_ACL_WRITE     = 1 << 1,
+    CTL_ACL_VOLATILE  = 1 << 2,
+    CTL_ACL_TLV_READ  = 1 << 3,
+    CTL_ACL_TLV_WRITE = 1 << 4,
+    CTL_ACL_TLV_CMD   = 1 << 5,
+    CTL_ACL_USER      = 1 << 6,
+} ctlAclE;
+
+// one catalog entry per control, element ID is the stable key (numid may change at reboot)
+typedef struct {
+    unsigned int numid;
+    snd_ctl_elem_iface_t iface;
+    unsigned int device;
+    unsigned int subdevice;
+    unsigned int index;
+    char name[CTL_NAME_MAXLEN];
+    snd_ctl_elem_type_t type;
+    unsigned int count;
+    long long min;
+    long long max;
+    long long step;
+    unsigned int acl;
+    char **enums;
+    unsigned int tlvSize;
+    unsigned int *tlv;
+} ctlEntryT;
+
+typedef struct {
+    int cardId;
+    int ucount;
+    int metadata;
+    unsigned int count;
+    ctlEntryT *ctls;
+} ctlCatalogT;
+
+// snd_ctl_card_info fields (sizes from struct snd_ctl_card_info)
+typedef struct {
+    int cardId;
+    char id[16];
+    char driver[16];
+    char name[32];
+    char longname[80];
+    char mixername[80];
+} cardInfoT;
+
 // import from AlsaAfbBinding
 extern const struct afb_binding_interface *afbIface;
 PUBLIC json_object *alsaCheckQuery (afb_req_t request, queryValuesT *queryValues);
 
 // AlseCoreSetGet exports
-PUBLIC int alsaGetSingleCtl (snd_ctl_t *ctlDev, snd_ctl_elem_id_t *elemId, ctlRequestT *ctlRequest, queryModeE queryMode);
+PUBLIC int alsaGetSingleCtl (snd_ctl_t *ctlDev, snd_ctl_elem_id_t *elemId, ctlRequestT *ctlRequest, queryModeE queryMode, ctlEntryT *ctlEntry);
 PUBLIC void alsaGetInfo (afb_req_t request);
 PUBLIC void alsaGetCtls(afb_req_t request);
 PUBLIC void alsaSetCtls(afb_req_t request);
@@ -89,14 +186,81 @@ PUBLIC void alsaUseCaseSet(afb_req_t request);
 PUBLIC void alsaUseCaseGet(afb_req_t request);
 PUBLIC void alsaUseCaseClose(afb_req_t request);
 PUBLIC void alsaUseCaseReset(afb_req_t request);
+PUBLIC void alsaUseCaseState(afb_req_t request);
+PUBLIC int alsaUseCasePreload(int cardId);
+PUBLIC void alsaUseCaseDropCard(int cardId);
+PUBLIC int alsaUseCaseInit(void);
 PUBLIC void alsaAddCustomCtls(afb_req_t request);
+PUBLIC int alsaAddCustomCtlsInit(void);
 
 // AlsaRegEvt
 PUBLIC void alsaEvtSubcribe (afb_req_t request);
+PUBLIC int alsaEvtPreload (int cardId);
+PUBLIC void alsaEvtDropCard (int cardId);
 PUBLIC void alsaGetCardId (afb_req_t request);
-PUBLIC void alsaRegisterHal (afb_req_t request);
-PUBLIC void alsaActiveHal (afb_req_t request);
+PUBLIC json_object *alsaProbeCardId(afb_req_t request);
+
+// AlsaPcmIndex
+PUBLIC int alsaPcmIndexResolve(const char *pcmName, snd_pcm_stream_t pcmStream, int *cardId, int *device, int *subdevice);
+PUBLIC int alsaPcmIndexDevices(int cardId, int *devices, snd_pcm_stream_t *streams, int max);
+PUBLIC void alsaPcmIndexDrop(int cardId);
 PUBLIC void alsaPcmInfo (afb_req_t request);
 
+// AlsaPcmCaps
+PUBLIC void alsaPcmCapsDrop(int cardId);
+PUBLIC void alsaPcmCaps(afb_req_t request);
+
+// AlsaHalRegistry
+PUBLIC int alsaHalFromCardid(int cardid, json_object *responseJ);
+PUBLIC int alsaHalCardBusy(int cardid);
+PUBLIC char *alsaHalApiFromName(const char *shortname);
+PUBLIC void alsaActiveHal (afb_req_t request);
+PUBLIC void alsaRegisterHal (afb_req_t request);
+PUBLIC void alsaUnregisterHal (afb_req_t request);
+
+// AlsaCatalog
+PUBLIC ctlCatalogT *alsaCatalogBuild(snd_ctl_t *ctlDev, int metadata);
+PUBLIC void alsaCatalogFree(ctlCatalogT *catalog);
+PUBLIC ctlEntryT *alsaCatalogSearch(ctlCatalogT *catalog, snd_ctl_elem_iface_t iface, const char *name, unsigned int index, unsigned int device, unsigned int subdevice, unsigned int *hint);
+PUBLIC ctlEntryT *alsaCatalogNumid(ctlCatalogT *catalog, unsigned int numid, const char *name);
+PUBLIC void alsaCatalogSetId(ctlEntryT *ctl, snd_ctl_elem_id_t *elemId);
+PUBLIC int alsaCatalogMatch(ctlCatalogT *catalog, snd_ctl_elem_list_t *ctlList);
+PUBLIC json_object *alsaCatalogToJson(ctlCatalogT *catalog);
+PUBLIC ctlCatalogT *alsaCatalogFromJson(json_object *ctlsJ, int cardId);
+
+// AlsaCardCache
+PUBLIC int alsaCardIndex(const char *devid);
+PUBLIC ctlCatalogT *alsaCardCatalogGet(int cardId);
+PUBLIC void alsaCardCatalogRelease(ctlCatalogT *catalog);
+PUBLIC void alsaCardCacheInvalidate(int cardId);
+PUBLIC void alsaCardCacheDrop(int cardId);
+PUBLIC json_object *alsaCardUcmTreeGet(int cardId);
+PUBLIC void alsaCardUcmTreeSet(int cardId, json_object *ucmTreeJ);
+PUBLIC int alsaCardCacheInit(void);
+
+// AlsaTlvWrite
+PUBLIC void alsaTlvWrite(afb_req_t request);
+
+// AlsaBase64
+PUBLIC char *alsaBase64Encode(const void *data, size_t size);
+PUBLIC ssize_t alsaBase64Decode(const char *text, unsigned char **data);
+
+// AlsaCardTable
+PUBLIC void alsaCardInfoFill(cardInfoT *info, snd_ctl_card_info_t *cardinfo);
+PUBLIC int alsaCardTableGet(int cardId, cardInfoT *info);
+PUBLIC int alsaCardTableList(cardInfoT *infos, int max);
+PUBLIC int alsaCardTableFind(const char *name);
+PUBLIC int alsaCardTableFindId(const char *id);
+PUBLIC int alsaCardTableInit(void);
+PUBLIC void alsaCardHotplugSubscribe(afb_req_t request);
+
+// AlsaSnapshot
+PUBLIC int alsaSnapshotInit(void);
+PUBLIC void alsaSnapshotSave(afb_req_t request);
+PUBLIC void alsaSnapshotRestore(afb_req_t request);
+
+// AlsaHookTelemetry
+PUBLIC void alsaHookTelemetry(afb_req_t request);
+
 #endif /* ALSALIBMAPPING_H */
 
@@ -0,0 +1,116 @@
+/*
+ * AlsaBase64 -- base64 encoding of binary control payloads (BYTES, IEC958, TLV)
+ * Copyright (C) 2015,2016,2017, Fulup Ar Foll fulup@iot.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Encoder uses standard alphabet with padding (RFC4648 section 4). Decoder also accepts the URL and
+ * filename safe alphabet ('-' and '_', section 5), ignores whitespace and missing padding but rejects
+ * a dangling 6-bit group, non zero trailing bits, misplaced padding and anything after padding.
+ */
+
+#define _GNU_SOURCE  // needed for vasprintf
+
+#include "Alsa-ApiHat.h"
+
+static const char base64Chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+STATIC int base64Value(char c) {
+    if (c >= 'A' && c <= 'Z') return c - 'A';
+    if (c >= 'a' && c <= 'z') return c - 'a' + 26;
+    if (c >= '0' && c <= '9') return c - '0' + 52;
+    if (c == '+' || c == '-') return 62;
+    if (c == '/' || c == '_') return 63;
+    return -1;
+}
+
+// Return a zero terminated base64 string (caller should free it)
+
+PUBLIC char *alsaBase64Encode(const void *data, size_t size) {
+    const unsigned char *bytes = data;
+    char *text = malloc(((size + 2) / 3) * 4 + 1);
+    size_t idx, jdx = 0;
+
+    if (!text) return NULL;
+
+    for (idx = 0; idx + 2 < size; idx += 3) {
+        text[jdx++] = base64Chars[bytes[idx] >> 2];
+        text[jdx++] = base64Chars[((bytes[idx] & 0x03) << 4) | (bytes[idx + 1] >> 4)];
+        text[jdx++] = base64Chars[((bytes[idx + 1] & 0x0f) << 2) | (bytes[idx + 2] >> 6)];
+        text[jdx++] = base64Chars[bytes[idx + 2] & 0x3f];
+    }
+
+    if (idx < size) {
+        text[jdx++] = base64Chars[bytes[idx] >> 2];
+        if (idx + 1 < size) {
+            text[jdx++] = base64Chars[((bytes[idx] & 0x03) << 4) | (bytes[idx + 1] >> 4)];
+            text[jdx++] = base64Chars[(bytes[idx + 1] & 0x0f) << 2];
+        } else {
+            text[jdx++] = base64Chars[(bytes[idx] & 0x03) << 4];
+            text[jdx++] = '=';
+        }
+        text[jdx++] = '=';
+    }
+
+    text[jdx] = '\0';
+    return text;
+}
+
+// Decode base64 text into a newly allocated buffer, return decoded size or -1 on invalid text
+
+PUBLIC ssize_t alsaBase64Decode(const char *text, unsigned char **data) {
+    unsigned char *bytes;
+    unsigned int acc = 0;
+    int bits = 0, value, pads = 0;
+    size_t size = 0, symbols = 0;
+    const char *ptr;
+
+    *data = NULL;
+    if (!text) return -1;
+
+    bytes = malloc(strlen(text) / 4 * 3 + 3);
+    if (!bytes) return -1;
+
+    for (ptr = text; *ptr && *ptr != '='; ptr++) {
+        if (*ptr == ' ' || *ptr == '\n' || *ptr == '\r' || *ptr == '\t') continue;
+
+        value = base64Value(*ptr);
+        if (value < 0) goto OnErrorExit;
+
+        acc = (acc << 6) | (unsigned int) value;
+        bits += 6;
+        symbols++;
+        if (bits >= 8) {
+            bits -= 8;
+            bytes[size++] = (unsigned char) (acc >> bits);
+        }
+    }
+
+    // only padding then whitespace may follow data
+    for (; *ptr; ptr++) {
+        if (*ptr == '=' && pads < 2) pads++;
+        else if (*ptr != ' ' && *ptr != '\n' && *ptr != '\r' && *ptr != '\t') goto OnErrorExit;
+    }
+
+    // a single symbol cannot encode a byte, padding should complete last quantum, unused bits are zero
+    if (symbols % 4 == 1) goto OnErrorExit;
+    if (pads && (symbols + (size_t) pads) % 4) goto OnErrorExit;
+    if (acc & ((1u << bits) - 1)) goto OnErrorExit;
+
+    *data = bytes;
+    return (ssize_t) size;
+
+OnErrorExit:
+    free(bytes);
+    return -1;
+}
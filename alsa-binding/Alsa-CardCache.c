@@ -0,0 +1,418 @@
+/*
+ * AlsaCardCache -- in memory + on disk cache of sound card capabilities
+ * Copyright (C) 2015,2016,2017, Fulup Ar Foll fulup@iot.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * One json file per card (ALSA_CACHE_DIR/<cardid>.json) keyed by driver+longname for UCM tree
+ * and by the full control list (numid, element ID) for catalog metadata (enums, TLV).
+ * Validation only cost one card info + one element list ioctl, a full probe is done on mismatch.
+ */
+
+#define _GNU_SOURCE  // needed for vasprintf
+
+#include <pthread.h>
+#include <time.h>
+
+#include "Alsa-ApiHat.h"
+
+#define CARD_CACHE_VERSION 1
+
+typedef struct {
+    ctlCatalogT *catalog;
+    json_object *ucmTreeJ;
+    char *id;
+    char *driver;
+    char *longname;
+    int stale;
+} cardCacheT;
+
+static cardCacheT cardCaches[MAX_SND_CARD];
+static pthread_mutex_t cardCacheLock = PTHREAD_MUTEX_INITIALIZER;
+
+// Return card index from a control devid (hw:N or hw:ID) without opening the control
+
+PUBLIC int alsaCardIndex(const char *devid) {
+    char name[32];
+    int cardId;
+
+    if (!devid || strncmp(devid, "hw:", 3)) return -1;
+
+    // ignore any ",device" suffix
+    strncpy(name, &devid[3], sizeof (name) - 1);
+    name[sizeof (name) - 1] = '\0';
+    char *comma = strchr(name, ',');
+    if (comma) *comma = '\0';
+
+    if (name[0] >= '0' && name[0] <= '9') cardId = atoi(name);
+    else cardId = alsaCardTableFindId(name);
+
+    if (cardId < 0 || cardId >= MAX_SND_CARD) return -1;
+    return cardId;
+}
+
+STATIC char *cardCachePath(const char *id) {
+    char *path;
+    const char *dir = getenv("ALSACORE_CACHEDIR");
+    if (!dir) dir = ALSA_CACHE_DIR;
+
+    if (asprintf(&path, "%s/%s.json", dir, id) < 0) return NULL;
+    return path;
+}
+
+// Write card cache file, caller should not hold cardCacheLock
+
+STATIC void cardCacheSave(int cardId) {
+    cardCacheT *cache = &cardCaches[cardId];
+    char *path = NULL, *tmpPath = NULL;
+    json_object *cacheJ;
+
+    pthread_mutex_lock(&cardCacheLock);
+    if (!cache->id) {
+        pthread_mutex_unlock(&cardCacheLock);
+        return;
+    }
+
+    path = cardCachePath(cache->id);
+    cacheJ = json_object_new_object();
+    json_object_object_add(cacheJ, "version", json_object_new_int(CARD_CACHE_VERSION));
+    json_object_object_add(cacheJ, "driver", json_object_new_string(cache->driver));
+    json_object_object_add(cacheJ, "longname", json_object_new_string(cache->longname));
+    if (cache->catalog) {
+        json_object_object_add(cacheJ, "count", json_object_new_int((int) cache->catalog->count));
+        json_object_object_add(cacheJ, "ctls", alsaCatalogToJson(cache->catalog));
+    }
+    if (cache->ucmTreeJ) json_object_object_add(cacheJ, "ucm", json_object_get(cache->ucmTreeJ));
+    pthread_mutex_unlock(&cardCacheLock);
+
+    if (!path || asprintf(&tmpPath, "%s.tmp", path) < 0) {
+        tmpPath = NULL;
+        goto OnErrorExit;
+    }
+
+    // write+rename to never leave a truncated cache behind
+    if (json_object_to_file_ext(tmpPath, cacheJ, JSON_C_TO_STRING_PLAIN) < 0 || rename(tmpPath, path) < 0) {
+        AFB_NOTICE("cardCacheSave: path=%s fail to write cache", path);
+        unlink(tmpPath);
+    }
+
+OnErrorExit:
+    json_object_put(cacheJ);
+    free(tmpPath);
+    free(path);
+}
+
+// Load card cache file and check it still matches live card
+
+STATIC ctlCatalogT *cardCacheLoad(snd_ctl_t *ctlDev, snd_ctl_card_info_t *cardinfo, json_object **ucmTreeJ) {
+    snd_ctl_elem_list_t *ctlList;
+    json_object *cacheJ = NULL, *tmpJ;
+    ctlCatalogT *catalog = NULL;
+    char *path;
+
+    path = cardCachePath(snd_ctl_card_info_get_id(cardinfo));
+    if (!path) goto OnErrorExit;
+
+    cacheJ = json_object_from_file(path);
+    if (!cacheJ) goto OnErrorExit;
+
+    // driver+longname is the sound card key
+    if (!json_object_object_get_ex(cacheJ, "version", &tmpJ) || json_object_get_int(tmpJ) != CARD_CACHE_VERSION) goto OnMismatchExit;
+    if (!json_object_object_get_ex(cacheJ, "driver", &tmpJ) || strcmp(json_object_get_string(tmpJ), snd_ctl_card_info_get_driver(cardinfo))) goto OnMismatchExit;
+    if (!json_object_object_get_ex(cacheJ, "longname", &tmpJ) || strcmp(json_object_get_string(tmpJ), snd_ctl_card_info_get_longname(cardinfo))) goto OnMismatchExit;
+
+    if (json_object_object_get_ex(cacheJ, "ucm", &tmpJ)) *ucmTreeJ = json_object_get(tmpJ);
+
+    // catalog is only valid when control list did not change
+    snd_ctl_elem_list_alloca(&ctlList);
+    if (snd_ctl_elem_list(ctlDev, ctlList) < 0) goto OnErrorExit;
+    if (!json_object_object_get_ex(cacheJ, "count", &tmpJ) || json_object_get_int(tmpJ) != (int) snd_ctl_elem_list_get_count(ctlList)) goto OnMismatchExit;
+    if (snd_ctl_elem_list_alloc_space(ctlList, snd_ctl_elem_list_get_count(ctlList)) < 0) goto OnErrorExit;
+    if (snd_ctl_elem_list(ctlDev, ctlList) < 0) goto OnListExit;
+
+    if (!json_object_object_get_ex(cacheJ, "ctls", &tmpJ)) goto OnListExit;
+    catalog = alsaCatalogFromJson(tmpJ, snd_ctl_card_info_get_card(cardinfo));
+    if (!catalog || !alsaCatalogMatch(catalog, ctlList)) {
+        alsaCatalogFree(catalog);
+        catalog = NULL;
+        AFB_NOTICE("cardCacheLoad: path=%s control list changed", path);
+    }
+
+OnListExit:
+    snd_ctl_elem_list_free_space(ctlList);
+    json_object_put(cacheJ);
+    free(path);
+    return catalog;
+
+OnMismatchExit:
+    AFB_NOTICE("cardCacheLoad: path=%s does not match sound card", path);
+OnErrorExit:
+    if (cacheJ) json_object_put(cacheJ);
+    free(path);
+    return NULL;
+}
+
+// Fill card cache from disk, or probe it when cache is missing/stale
+
+STATIC int cardCacheProbe(int cardId) {
+    char devid[32];
+    snd_ctl_t *ctlDev = NULL;
+    snd_ctl_card_info_t *cardinfo;
+    ctlCatalogT *catalog = NULL, *oldCatalog = NULL;
+    json_object *ucmTreeJ = NULL;
+    int err, stale, dirty = 0;
+
+    snprintf(devid, sizeof (devid), "hw:%i", cardId);
+    if ((err = snd_ctl_open(&ctlDev, devid, SND_CTL_READONLY)) < 0) {
+        AFB_INFO("cardCacheProbe: devid=%s open error=%s", devid, snd_strerror(err));
+        goto OnErrorExit;
+    }
+
+    snd_ctl_card_info_alloca(&cardinfo);
+    if ((err = snd_ctl_card_info(ctlDev, cardinfo)) < 0) goto OnErrorExit;
+
+    pthread_mutex_lock(&cardCacheLock);
+    stale = cardCaches[cardId].stale;
+    pthread_mutex_unlock(&cardCacheLock);
+
+    // a stale cache was invalidated by an event, disk version is stale too
+    if (!stale) catalog = cardCacheLoad(ctlDev, cardinfo, &ucmTreeJ);
+    if (!catalog) {
+        catalog = alsaCatalogBuild(ctlDev, 1);
+        if (!catalog) goto OnErrorExit;
+        dirty = 1;
+    }
+    catalog->ucount = 1;
+
+    pthread_mutex_lock(&cardCacheLock);
+    cardCacheT *cache = &cardCaches[cardId];
+    if (!cache->id || strcmp(cache->id, snd_ctl_card_info_get_id(cardinfo))) {
+        free(cache->id);
+        free(cache->driver);
+        free(cache->longname);
+        cache->id = strdup(snd_ctl_card_info_get_id(cardinfo));
+        cache->driver = strdup(snd_ctl_card_info_get_driver(cardinfo));
+        cache->longname = strdup(snd_ctl_card_info_get_longname(cardinfo));
+    }
+    oldCatalog = cache->catalog;
+    cache->catalog = catalog;
+    cache->stale = 0;
+    if (ucmTreeJ && !cache->ucmTreeJ) cache->ucmTreeJ = json_object_get(ucmTreeJ);
+    if (oldCatalog && --oldCatalog->ucount == 0) alsaCatalogFree(oldCatalog);
+    pthread_mutex_unlock(&cardCacheLock);
+
+    if (dirty) cardCacheSave(cardId);
+
+    if (ucmTreeJ) json_object_put(ucmTreeJ);
+    snd_ctl_close(ctlDev);
+    return 0;
+
+OnErrorExit:
+    // cardCacheLoad may hand back ucm tree even when catalog is not usable
+    if (ucmTreeJ) json_object_put(ucmTreeJ);
+    if (ctlDev) snd_ctl_close(ctlDev);
+    return -1;
+}
+
+// Return a reference on card catalog, probe card on 1st call
+
+PUBLIC ctlCatalogT *alsaCardCatalogGet(int cardId) {
+    ctlCatalogT *catalog;
+
+    if (cardId < 0 || cardId >= MAX_SND_CARD) return NULL;
+
+    for (int retry = 0; retry < 2; retry++) {
+        pthread_mutex_lock(&cardCacheLock);
+        catalog = cardCaches[cardId].catalog;
+        if (catalog) catalog->ucount++;
+        pthread_mutex_unlock(&cardCacheLock);
+
+        if (catalog) return catalog;
+        if (cardCacheProbe(cardId) < 0) break;
+    }
+    return NULL;
+}
+
+PUBLIC void alsaCardCatalogRelease(ctlCatalogT *catalog) {
+    if (!catalog) return;
+
+    pthread_mutex_lock(&cardCacheLock);
+    int ucount = --catalog->ucount;
+    pthread_mutex_unlock(&cardCacheLock);
+
+    if (ucount == 0) alsaCatalogFree(catalog);
+}
+
+// Drop cached catalog (controls added/removed or metadata changed), it is rebuilt on next use
+
+PUBLIC void alsaCardCacheInvalidate(int cardId) {
+    ctlCatalogT *catalog;
+
+    if (cardId < 0 || cardId >= MAX_SND_CARD) return;
+
+    pthread_mutex_lock(&cardCacheLock);
+    catalog = cardCaches[cardId].catalog;
+    cardCaches[cardId].catalog = NULL;
+    cardCaches[cardId].stale = 1;
+    int ucount = catalog ? --catalog->ucount : -1;
+    pthread_mutex_unlock(&cardCacheLock);
+
+    if (ucount == 0) alsaCatalogFree(catalog);
+}
+
+// Forget everything about a card slot (card unplugged or replaced), disk cache is kept for next plug
+
+PUBLIC void alsaCardCacheDrop(int cardId) {
+    cardCacheT cache;
+
+    if (cardId < 0 || cardId >= MAX_SND_CARD) return;
+
+    pthread_mutex_lock(&cardCacheLock);
+    cache = cardCaches[cardId];
+    memset(&cardCaches[cardId], 0, sizeof (cardCacheT));
+    int ucount = cache.catalog ? --cache.catalog->ucount : -1;
+    pthread_mutex_unlock(&cardCacheLock);
+
+    if (ucount == 0) alsaCatalogFree(cache.catalog);
+    if (cache.ucmTreeJ) json_object_put(cache.ucmTreeJ);
+    free(cache.id);
+    free(cache.driver);
+    free(cache.longname);
+}
+
+PUBLIC json_object *alsaCardUcmTreeGet(int cardId) {
+    json_object *ucmTreeJ;
+
+    if (cardId < 0 || cardId >= MAX_SND_CARD) return NULL;
+
+    pthread_mutex_lock(&cardCacheLock);
+    ucmTreeJ = cardCaches[cardId].ucmTreeJ;
+    if (ucmTreeJ) json_object_get(ucmTreeJ);
+    pthread_mutex_unlock(&cardCacheLock);
+
+    return ucmTreeJ;
+}
+
+PUBLIC void alsaCardUcmTreeSet(int cardId, json_object *ucmTreeJ) {
+    json_object *oldTreeJ;
+
+    if (cardId < 0 || cardId >= MAX_SND_CARD) return;
+
+    // card should be known before its cache can be written
+    pthread_mutex_lock(&cardCacheLock);
+    int known = (cardCaches[cardId].id != NULL);
+    pthread_mutex_unlock(&cardCacheLock);
+    if (!known && cardCacheProbe(cardId) < 0) return;
+
+    pthread_mutex_lock(&cardCacheLock);
+    oldTreeJ = cardCaches[cardId].ucmTreeJ;
+    cardCaches[cardId].ucmTreeJ = ucmTreeJ ? json_object_get(ucmTreeJ) : NULL;
+    pthread_mutex_unlock(&cardCacheLock);
+
+    if (oldTreeJ) json_object_put(oldTreeJ);
+    cardCacheSave(cardId);
+}
+
+// Check card against prewarm whitelist (comma separated list of hw:N, N or card ID)
+
+STATIC int cardCacheSelected(const char *whitelist, int cardId) {
+    char *list, *token, *saveptr;
+    int selected = 0;
+
+    if (!whitelist) return 1;
+
+    list = strdup(whitelist);
+    for (token = strtok_r(list, ", ", &saveptr); token; token = strtok_r(NULL, ", ", &saveptr)) {
+        if (!strncmp(token, "hw:", 3)) token += 3;
+        if ((token[0] >= '0' && token[0] <= '9' && atoi(token) == cardId) || alsaCardTableFind(token) == cardId) {
+            selected = 1;
+            break;
+        }
+    }
+    free(list);
+    return selected;
+}
+
+typedef struct {
+    int cardId;
+    int withUcm;
+    int status;
+    int joinable;
+    pthread_t tid;
+} prewarmJobT;
+
+STATIC long elapsedMs(struct timespec *start) {
+    struct timespec stop;
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+    return (stop.tv_sec - start->tv_sec) * 1000 + (stop.tv_nsec - start->tv_nsec) / 1000000;
+}
+
+STATIC void *cardCachePrewarm(void *userData) {
+    prewarmJobT *job = (prewarmJobT*) userData;
+    struct timespec start;
+    long catalogMs;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    job->status = cardCacheProbe(job->cardId);
+    catalogMs = elapsedMs(&start);
+
+    // UCM profile parsing is the most expensive part of a card open
+    if (job->status == 0 && job->withUcm) alsaUseCasePreload(job->cardId);
+
+    AFB_NOTICE("cardCachePrewarm: hw:%d status=%d catalog=%ldms total=%ldms", job->cardId, job->status, catalogMs, elapsedMs(&start));
+    return NULL;
+}
+
+// Load/validate cache of every present (and whitelisted) sound card in parallel at binding init
+
+PUBLIC int alsaCardCacheInit(void) {
+    prewarmJobT jobs[MAX_SND_CARD];
+    cardInfoT cards[MAX_SND_CARD];
+    struct timespec start;
+    const char *whitelist, *value;
+    int ncards, count = 0, njobs = 0, withUcm, withEvt;
+
+    whitelist = getenv("ALSACORE_PREWARM");
+    value = getenv("ALSACORE_PREWARM_UCM");
+    withUcm = value ? atoi(value) : ALSA_PREWARM_UCM;
+    value = getenv("ALSACORE_PREWARM_EVT");
+    withEvt = value ? atoi(value) : ALSA_PREWARM_EVT;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    ncards = alsaCardTableList(cards, MAX_SND_CARD);
+    for (int idx = 0; idx < ncards; idx++) {
+        int card = cards[idx].cardId;
+        if (!cardCacheSelected(whitelist, card)) continue;
+
+        prewarmJobT *job = &jobs[njobs++];
+        job->cardId = card;
+        job->withUcm = withUcm;
+        job->status = -1;
+        job->joinable = (pthread_create(&job->tid, NULL, cardCachePrewarm, job) == 0);
+
+        // no thread available, do it inline
+        if (!job->joinable) cardCachePrewarm(job);
+    }
+
+    for (int idx = 0; idx < njobs; idx++) {
+        if (jobs[idx].joinable) pthread_join(jobs[idx].tid, NULL);
+        if (jobs[idx].status < 0) continue;
+        count++;
+
+        // event sources should be attached from mainloop thread
+        if (withEvt) alsaEvtPreload(jobs[idx].cardId);
+    }
+
+    AFB_NOTICE("alsaCardCacheInit: cards=%d/%d loaded in %ldms", count, njobs, elapsedMs(&start));
+    return 0;
+}
@@ -0,0 +1,285 @@
+/*
+ * AlsaCardTable -- table of present sound cards refreshed on /dev/snd hotplug
+ * Copyright (C) 2015,2016,2017, Fulup Ar Foll fulup@iot.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Card identity (id, name, driver, ...) never changes while a card is plugged. Table is built
+ * with snd_card_next and only refreshed when a controlC* node appears/disappears in /dev/snd.
+ * When inotify is not available the table is rebuilt by a mainloop timer every CARD_TABLE_POLL ms.
+ * Each refresh is compared with previous table to push card-added/card-removed events and to
+ * release every cached object (catalog, UCM manager, sndctl events) attached to a removed card.
+ */
+
+#define _GNU_SOURCE  // needed for vasprintf
+
+#include <pthread.h>
+#include <sys/inotify.h>
+
+#include "Alsa-ApiHat.h"
+
+#define SND_DEV_DIR "/dev/snd"
+
+// table refresh period (ms) when /dev/snd cannot be watched
+#ifndef CARD_TABLE_POLL
+  #define CARD_TABLE_POLL 2000
+#endif
+
+typedef struct {
+    int present;
+    cardInfoT info;
+} cardSlotT;
+
+static cardSlotT cardTable[MAX_SND_CARD];
+static pthread_mutex_t cardTableLock = PTHREAD_MUTEX_INITIALIZER;
+static sd_event_source *cardTableSrc = NULL;
+static afb_event_t cardAddedEvt, cardRemovedEvt;
+
+PUBLIC void alsaCardInfoFill(cardInfoT *info, snd_ctl_card_info_t *cardinfo) {
+    info->cardId = snd_ctl_card_info_get_card(cardinfo);
+    strncpy(info->id, snd_ctl_card_info_get_id(cardinfo), sizeof (info->id) - 1);
+    strncpy(info->driver, snd_ctl_card_info_get_driver(cardinfo), sizeof (info->driver) - 1);
+    strncpy(info->name, snd_ctl_card_info_get_name(cardinfo), sizeof (info->name) - 1);
+    strncpy(info->longname, snd_ctl_card_info_get_longname(cardinfo), sizeof (info->longname) - 1);
+    strncpy(info->mixername, snd_ctl_card_info_get_mixername(cardinfo), sizeof (info->mixername) - 1);
+}
+
+STATIC json_object *cardInfoToJson(cardInfoT *info) {
+    json_object *cardJ = json_object_new_object();
+    char devid[32];
+
+    snprintf(devid, sizeof (devid), "hw:%i", info->cardId);
+    json_object_object_add(cardJ, "devid", json_object_new_string(devid));
+    json_object_object_add(cardJ, "cardid", json_object_new_int(info->cardId));
+    json_object_object_add(cardJ, "id", json_object_new_string(info->id));
+    json_object_object_add(cardJ, "name", json_object_new_string(info->name));
+    json_object_object_add(cardJ, "driver", json_object_new_string(info->driver));
+    json_object_object_add(cardJ, "longname", json_object_new_string(info->longname));
+    return cardJ;
+}
+
+STATIC int cardSlotSame(cardSlotT *slot1, cardSlotT *slot2) {
+    if (!slot1->present || !slot2->present) return 0;
+    return !strcmp(slot1->info.id, slot2->info.id) && !strcmp(slot1->info.driver, slot2->info.driver) && !strcmp(slot1->info.longname, slot2->info.longname);
+}
+
+// Release removed cards cached objects and notify subscribed clients
+
+STATIC void cardTableNotify(cardSlotT *oldTable, cardSlotT *newTable) {
+    for (int idx = 0; idx < MAX_SND_CARD; idx++) {
+        if (cardSlotSame(&oldTable[idx], &newTable[idx])) continue;
+
+        if (oldTable[idx].present) {
+            AFB_NOTICE("cardTableNotify: card removed hw:%i id=%s", idx, oldTable[idx].info.id);
+            alsaEvtDropCard(idx);
+            alsaUseCaseDropCard(idx);
+            alsaCardCacheDrop(idx);
+            alsaPcmIndexDrop(idx);
+            alsaPcmCapsDrop(idx);
+            if (afb_event_is_valid(cardRemovedEvt)) afb_event_push(cardRemovedEvt, cardInfoToJson(&oldTable[idx].info));
+        }
+
+        if (newTable[idx].present) {
+            AFB_NOTICE("cardTableNotify: card added hw:%i id=%s", idx, newTable[idx].info.id);
+            if (!oldTable[idx].present) {
+                alsaCardCacheDrop(idx);
+                alsaPcmIndexDrop(idx);
+                alsaPcmCapsDrop(idx);
+                alsaUseCasePreload(idx);
+            }
+            if (afb_event_is_valid(cardAddedEvt)) afb_event_push(cardAddedEvt, cardInfoToJson(&newTable[idx].info));
+        }
+    }
+}
+
+// Rebuild table from live cards (only cards present in /dev/snd are opened)
+
+STATIC void cardTableRefresh(void) {
+    cardSlotT table[MAX_SND_CARD], oldTable[MAX_SND_CARD];
+    snd_ctl_card_info_t *cardinfo;
+    snd_ctl_t *ctlDev;
+    char devid[32];
+    int card = -1, err;
+
+    memset(table, 0, sizeof (table));
+    snd_ctl_card_info_alloca(&cardinfo);
+
+    while (snd_card_next(&card) == 0 && card >= 0 && card < MAX_SND_CARD) {
+        snprintf(devid, sizeof (devid), "hw:%i", card);
+        if ((err = snd_ctl_open(&ctlDev, devid, SND_CTL_READONLY)) < 0) {
+            AFB_INFO("cardTableRefresh: devid=%s open error=%s", devid, snd_strerror(err));
+            continue;
+        }
+        err = snd_ctl_card_info(ctlDev, cardinfo);
+        snd_ctl_close(ctlDev);
+        if (err < 0) continue;
+
+        table[card].present = 1;
+        alsaCardInfoFill(&table[card].info, cardinfo);
+    }
+
+    pthread_mutex_lock(&cardTableLock);
+    memcpy(oldTable, cardTable, sizeof (oldTable));
+    memcpy(cardTable, table, sizeof (table));
+    pthread_mutex_unlock(&cardTableLock);
+
+    cardTableNotify(oldTable, table);
+}
+
+// Return 0 and a copy of card info when card is present
+
+PUBLIC int alsaCardTableGet(int cardId, cardInfoT *info) {
+    int present;
+
+    if (cardId < 0 || cardId >= MAX_SND_CARD) return -1;
+
+    pthread_mutex_lock(&cardTableLock);
+    present = cardTable[cardId].present;
+    if (present && info) *info = cardTable[cardId].info;
+    pthread_mutex_unlock(&cardTableLock);
+
+    return present ? 0 : -1;
+}
+
+// Copy every present card info, return card count
+
+PUBLIC int alsaCardTableList(cardInfoT *infos, int max) {
+    int count = 0;
+
+    pthread_mutex_lock(&cardTableLock);
+    for (int idx = 0; idx < MAX_SND_CARD && count < max; idx++) {
+        if (cardTable[idx].present) infos[count++] = cardTable[idx].info;
+    }
+    pthread_mutex_unlock(&cardTableLock);
+
+    return count;
+}
+
+// Search card by id or shortname (case insensitive), return card index
+
+PUBLIC int alsaCardTableFind(const char *name) {
+    int cardId = -1;
+
+    if (!name) return -1;
+
+    pthread_mutex_lock(&cardTableLock);
+    for (int idx = 0; idx < MAX_SND_CARD; idx++) {
+        if (!cardTable[idx].present) continue;
+        if (!strcasecmp(name, cardTable[idx].info.id) || !strcasecmp(name, cardTable[idx].info.name)) {
+            cardId = idx;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cardTableLock);
+
+    return cardId;
+}
+
+// Search card by ALSA id (hw:ID), return card index
+
+PUBLIC int alsaCardTableFindId(const char *id) {
+    int cardId = -1;
+
+    if (!id) return -1;
+
+    pthread_mutex_lock(&cardTableLock);
+    for (int idx = 0; idx < MAX_SND_CARD; idx++) {
+        if (cardTable[idx].present && !strcmp(id, cardTable[idx].info.id)) {
+            cardId = idx;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&cardTableLock);
+
+    return cardId;
+}
+
+// Only control nodes reflect card arrival/removal. IN_ATTRIB covers udev fixing permissions after creation
+
+STATIC int cardTableEventCB(sd_event_source* src, int fd, uint32_t revents, void* userData) {
+    char buffer[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+    ssize_t len;
+    int changed = 0;
+
+    while ((len = read(fd, buffer, sizeof (buffer))) > 0) {
+        for (char *ptr = buffer; ptr < buffer + len; ptr += sizeof (struct inotify_event) + ((struct inotify_event*) ptr)->len) {
+            struct inotify_event *event = (struct inotify_event*) ptr;
+            if (event->len && !strncmp(event->name, "controlC", 8)) changed = 1;
+        }
+    }
+
+    if (changed) {
+        AFB_DEBUG("cardTableEventCB: %s changed, refreshing sound card table", SND_DEV_DIR);
+        cardTableRefresh();
+    }
+    return 0;
+}
+
+// fallback without inotify: refresh (and notify) from mainloop, lookups never refresh table themselves
+
+STATIC int cardTablePollCB(sd_event_source* src, uint64_t usec, void* userData) {
+    cardTableRefresh();
+    sd_event_source_set_time(src, usec + CARD_TABLE_POLL * 1000);
+    return 0;
+}
+
+// Subscribe to card-added/card-removed events
+
+PUBLIC void alsaCardHotplugSubscribe(afb_req_t request) {
+
+    if (afb_req_subscribe(request, cardAddedEvt) != 0 || afb_req_subscribe(request, cardRemovedEvt) != 0) {
+        afb_req_fail_f(request, "register-eventname", "Cannot subscribe hotplug events [invalid channel]");
+        goto OnErrorExit;
+    }
+
+    afb_req_success(request, NULL, NULL);
+
+OnErrorExit:
+    return;
+}
+
+PUBLIC int alsaCardTableInit(void) {
+    int fd, err;
+
+    cardAddedEvt = afb_daemon_make_event("card-added");
+    cardRemovedEvt = afb_daemon_make_event("card-removed");
+
+    fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fd < 0) goto OnErrorExit;
+
+    if (inotify_add_watch(fd, SND_DEV_DIR, IN_CREATE | IN_DELETE | IN_ATTRIB) < 0) {
+        close(fd);
+        goto OnErrorExit;
+    }
+
+    err = sd_event_add_io(afb_daemon_get_event_loop(), &cardTableSrc, fd, EPOLLIN, cardTableEventCB, NULL);
+    if (err < 0) {
+        cardTableSrc = NULL;
+        close(fd);
+        goto OnErrorExit;
+    }
+
+    cardTableRefresh();
+    return 0;
+
+OnErrorExit:
+    AFB_WARNING("alsaCardTableInit: cannot watch %s, sound card table refreshed every %dms", SND_DEV_DIR, CARD_TABLE_POLL);
+    cardTableRefresh();
+
+    uint64_t usec;
+    sd_event_now(afb_daemon_get_event_loop(), CLOCK_MONOTONIC, &usec);
+    err = sd_event_add_time(afb_daemon_get_event_loop(), &cardTableSrc, CLOCK_MONOTONIC, usec + CARD_TABLE_POLL * 1000, 100000, cardTablePollCB, NULL);
+    if (err >= 0) sd_event_source_set_enabled(cardTableSrc, SD_EVENT_ON);
+    else cardTableSrc = NULL;
+    return -1;
+}
@@ -0,0 +1,331 @@
+/*
+ * AlsaCatalog -- per sound card control catalog (stable element keys + metadata)
+ * Copyright (C) 2015,2016,2017, Fulup Ar Foll fulup@iot.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+
+ */
+
+#define _GNU_SOURCE  // needed for vasprintf
+
+#include "Alsa-ApiHat.h"
+
+// Load enumerated labels and TLV, this is the expensive part of a catalog (one ioctl per enum item)
+
+STATIC void alsaCatalogMetadata(snd_ctl_t *ctlDev, snd_ctl_elem_info_t *elemInfo, snd_ctl_elem_id_t *elemId, ctlEntryT *ctl) {
+    int err;
+
+    if (ctl->type == SND_CTL_ELEM_TYPE_ENUMERATED && ctl->max > 0) {
+        ctl->enums = calloc((size_t) ctl->max, sizeof (char*));
+        for (unsigned int item = 0; item < ctl->max; item++) {
+            snd_ctl_elem_info_set_item(elemInfo, item);
+            if (snd_ctl_elem_info(ctlDev, elemInfo) >= 0) ctl->enums[item] = strdup(snd_ctl_elem_info_get_item_name(elemInfo));
+            else ctl->enums[item] = strdup("");
+        }
+    }
+
+    if (ctl->acl & CTL_ACL_TLV_READ) {
+        unsigned int *tlv = alloca(TLV_BYTE_SIZE);
+        if ((err = snd_ctl_elem_tlv_read(ctlDev, elemId, tlv, TLV_BYTE_SIZE)) < 0) {
+            AFB_NOTICE("alsaCatalogMetadata: devid=%s numid=%d TLV read error=%s", snd_ctl_name(ctlDev), ctl->numid, snd_strerror(err));
+            return;
+        }
+
+        // tlv[1] is payload length in bytes
+        ctl->tlvSize = tlv[1] + 2 * (unsigned int) sizeof (unsigned int);
+        if (ctl->tlvSize > TLV_BYTE_SIZE) ctl->tlvSize = TLV_BYTE_SIZE;
+        ctl->tlv = malloc(ctl->tlvSize);
+        memcpy(ctl->tlv, tlv, ctl->tlvSize);
+    }
+}
+
+// Build a catalog of every control of a given sound card with one list + one info per element
+
+PUBLIC ctlCatalogT *alsaCatalogBuild(snd_ctl_t *ctlDev, int metadata) {
+    snd_ctl_elem_list_t *ctlList;
+    snd_ctl_elem_info_t *elemInfo;
+    snd_ctl_elem_id_t *elemId;
+    snd_ctl_card_info_t *cardinfo;
+    ctlCatalogT *catalog = NULL;
+    unsigned int count;
+    int err;
+
+    snd_ctl_elem_list_alloca(&ctlList);
+    snd_ctl_elem_info_alloca(&elemInfo);
+    snd_ctl_elem_id_alloca(&elemId);
+    snd_ctl_card_info_alloca(&cardinfo);
+
+    if ((err = snd_ctl_card_info(ctlDev, cardinfo)) < 0) {
+        AFB_WARNING("alsaCatalogBuild: devid=%s card info error=%s", snd_ctl_name(ctlDev), snd_strerror(err));
+        goto OnErrorExit;
+    }
+
+    if ((err = snd_ctl_elem_list(ctlDev, ctlList)) < 0) goto OnListError;
+    if ((err = snd_ctl_elem_list_alloc_space(ctlList, snd_ctl_elem_list_get_count(ctlList))) < 0) goto OnListError;
+    if ((err = snd_ctl_elem_list(ctlDev, ctlList)) < 0) goto OnListError;
+
+    count = snd_ctl_elem_list_get_used(ctlList);
+    catalog = calloc(1, sizeof (ctlCatalogT));
+    catalog->cardId = snd_ctl_card_info_get_card(cardinfo);
+    catalog->metadata = metadata;
+    catalog->ctls = calloc(count ? count : 1, sizeof (ctlEntryT));
+
+    for (unsigned int idx = 0; idx < count; idx++) {
+        ctlEntryT *ctl = &catalog->ctls[catalog->count];
+
+        snd_ctl_elem_list_get_id(ctlList, idx, elemId);
+        snd_ctl_elem_info_set_id(elemInfo, elemId);
+        if ((err = snd_ctl_elem_info(ctlDev, elemInfo)) < 0) {
+            AFB_NOTICE("alsaCatalogBuild: devid=%s numid=%d info error=%s", snd_ctl_name(ctlDev), snd_ctl_elem_id_get_numid(elemId), snd_strerror(err));
+            continue;
+        }
+
+        ctl->numid = snd_ctl_elem_id_get_numid(elemId);
+        ctl->iface = snd_ctl_elem_id_get_interface(elemId);
+        ctl->device = snd_ctl_elem_id_get_device(elemId);
+        ctl->subdevice = snd_ctl_elem_id_get_subdevice(elemId);
+        ctl->index = snd_ctl_elem_id_get_index(elemId);
+        strncpy(ctl->name, snd_ctl_elem_id_get_name(elemId), sizeof (ctl->name) - 1);
+
+        ctl->type = snd_ctl_elem_info_get_type(elemInfo);
+        ctl->count = snd_ctl_elem_info_get_count(elemInfo);
+        if (snd_ctl_elem_info_is_readable(elemInfo)) ctl->acl |= CTL_ACL_READ;
+        if (snd_ctl_elem_info_is_writable(elemInfo)) ctl->acl |= CTL_ACL_WRITE;
+        if (snd_ctl_elem_info_is_volatile(elemInfo)) ctl->acl |= CTL_ACL_VOLATILE;
+        if (snd_ctl_elem_info_is_tlv_readable(elemInfo)) ctl->acl |= CTL_ACL_TLV_READ;
+        if (snd_ctl_elem_info_is_tlv_writable(elemInfo)) ctl->acl |= CTL_ACL_TLV_WRITE;
+        if (snd_ctl_elem_info_is_tlv_commandable(elemInfo)) ctl->acl |= CTL_ACL_TLV_CMD;
+        if (snd_ctl_elem_info_is_user(elemInfo)) ctl->acl |= CTL_ACL_USER;
+
+        switch (ctl->type) {
+            case SND_CTL_ELEM_TYPE_INTEGER:
+                ctl->min = snd_ctl_elem_info_get_min(elemInfo);
+                ctl->max = snd_ctl_elem_info_get_max(elemInfo);
+                ctl->step = snd_ctl_elem_info_get_step(elemInfo);
+                break;
+            case SND_CTL_ELEM_TYPE_INTEGER64:
+                ctl->min = snd_ctl_elem_info_get_min64(elemInfo);
+                ctl->max = snd_ctl_elem_info_get_max64(elemInfo);
+                ctl->step = snd_ctl_elem_info_get_step64(elemInfo);
+                break;
+            case SND_CTL_ELEM_TYPE_ENUMERATED:
+                ctl->max = snd_ctl_elem_info_get_items(elemInfo);
+                break;
+            case SND_CTL_ELEM_TYPE_BOOLEAN:
+                ctl->max = 1;
+                break;
+            default:
+                break;
+        }
+
+        if (metadata) alsaCatalogMetadata(ctlDev, elemInfo, elemId, ctl);
+        catalog->count++;
+    }
+
+    snd_ctl_elem_list_free_space(ctlList);
+    return catalog;
+
+OnListError:
+    AFB_WARNING("alsaCatalogBuild: devid=%s element list error=%s", snd_ctl_name(ctlDev), snd_strerror(err));
+    snd_ctl_elem_list_free_space(ctlList);
+OnErrorExit:
+    return NULL;
+}
+
+PUBLIC void alsaCatalogFree(ctlCatalogT *catalog) {
+    if (!catalog) return;
+
+    for (unsigned int idx = 0; idx < catalog->count; idx++) {
+        ctlEntryT *ctl = &catalog->ctls[idx];
+        if (ctl->enums) {
+            for (unsigned int item = 0; item < ctl->max; item++) free(ctl->enums[item]);
+            free(ctl->enums);
+        }
+        free(ctl->tlv);
+    }
+    free(catalog->ctls);
+    free(catalog);
+}
+
+// Search a control from its stable key. Hint is the position of previous match, as controls are
+// usually searched in catalog order this makes the search almost free.
+
+PUBLIC ctlEntryT *alsaCatalogSearch(ctlCatalogT *catalog, snd_ctl_elem_iface_t iface, const char *name, unsigned int index, unsigned int device, unsigned int subdevice, unsigned int *hint) {
+    unsigned int start = (hint && *hint < catalog->count) ? *hint : 0;
+
+    for (unsigned int jdx = 0; jdx < catalog->count; jdx++) {
+        unsigned int idx = (start + jdx) % catalog->count;
+        ctlEntryT *ctl = &catalog->ctls[idx];
+
+        if (ctl->iface != iface || ctl->index != index || ctl->device != device || ctl->subdevice != subdevice) continue;
+        if (strcmp(ctl->name, name)) continue;
+
+        if (hint) *hint = idx + 1;
+        return ctl;
+    }
+    return NULL;
+}
+
+// Fill an Alsa element ID from a catalog entry
+
+PUBLIC void alsaCatalogSetId(ctlEntryT *ctl, snd_ctl_elem_id_t *elemId) {
+    snd_ctl_elem_id_set_numid(elemId, ctl->numid);
+    snd_ctl_elem_id_set_interface(elemId, ctl->iface);
+    snd_ctl_elem_id_set_device(elemId, ctl->device);
+    snd_ctl_elem_id_set_subdevice(elemId, ctl->subdevice);
+    snd_ctl_elem_id_set_index(elemId, ctl->index);
+    snd_ctl_elem_id_set_name(elemId, ctl->name);
+}
+
+// Search a control from its numid, name is checked to detect a stale catalog
+
+PUBLIC ctlEntryT *alsaCatalogNumid(ctlCatalogT *catalog, unsigned int numid, const char *name) {
+    ctlEntryT *ctl = NULL;
+
+    // numids are usually allocated sequentially from 1
+    if (numid > 0 && numid <= catalog->count && catalog->ctls[numid - 1].numid == numid) {
+        ctl = &catalog->ctls[numid - 1];
+    } else {
+        for (unsigned int idx = 0; idx < catalog->count; idx++) {
+            if (catalog->ctls[idx].numid == numid) {
+                ctl = &catalog->ctls[idx];
+                break;
+            }
+        }
+    }
+
+    if (ctl && name && strcmp(ctl->name, name)) return NULL;
+    return ctl;
+}
+
+// Check a catalog still describes a live element list (in memory compare, no ioctl)
+
+PUBLIC int alsaCatalogMatch(ctlCatalogT *catalog, snd_ctl_elem_list_t *ctlList) {
+    unsigned int count = snd_ctl_elem_list_get_used(ctlList);
+
+    if (count != catalog->count) return 0;
+
+    for (unsigned int idx = 0; idx < count; idx++) {
+        ctlEntryT *ctl = &catalog->ctls[idx];
+
+        if (ctl->numid != snd_ctl_elem_list_get_numid(ctlList, idx)) return 0;
+        if (ctl->iface != snd_ctl_elem_list_get_interface(ctlList, idx)) return 0;
+        if (ctl->index != snd_ctl_elem_list_get_index(ctlList, idx)) return 0;
+        if (ctl->device != snd_ctl_elem_list_get_device(ctlList, idx)) return 0;
+        if (ctl->subdevice != snd_ctl_elem_list_get_subdevice(ctlList, idx)) return 0;
+        if (strcmp(ctl->name, snd_ctl_elem_list_get_name(ctlList, idx))) return 0;
+    }
+    return 1;
+}
+
+// Serialize catalog with its metadata as a compact json array (used by card cache)
+
+PUBLIC json_object *alsaCatalogToJson(ctlCatalogT *catalog) {
+    json_object *ctlsJ = json_object_new_array();
+
+    for (unsigned int idx = 0; idx < catalog->count; idx++) {
+        ctlEntryT *ctl = &catalog->ctls[idx];
+        json_object *ctlJ = json_object_new_object();
+
+        json_object_object_add(ctlJ, "numid", json_object_new_int((int) ctl->numid));
+        json_object_object_add(ctlJ, "iface", json_object_new_int(ctl->iface));
+        json_object_object_add(ctlJ, "dev", json_object_new_int((int) ctl->device));
+        json_object_object_add(ctlJ, "sub", json_object_new_int((int) ctl->subdevice));
+        json_object_object_add(ctlJ, "index", json_object_new_int((int) ctl->index));
+        json_object_object_add(ctlJ, "name", json_object_new_string(ctl->name));
+        json_object_object_add(ctlJ, "type", json_object_new_int(ctl->type));
+        json_object_object_add(ctlJ, "count", json_object_new_int((int) ctl->count));
+        json_object_object_add(ctlJ, "min", json_object_new_int64(ctl->min));
+        json_object_object_add(ctlJ, "max", json_object_new_int64(ctl->max));
+        json_object_object_add(ctlJ, "step", json_object_new_int64(ctl->step));
+        json_object_object_add(ctlJ, "acl", json_object_new_int((int) ctl->acl));
+
+        if (ctl->enums) {
+            json_object *enumsJ = json_object_new_array();
+            for (unsigned int item = 0; item < ctl->max; item++) json_object_array_add(enumsJ, json_object_new_string(ctl->enums[item]));
+            json_object_object_add(ctlJ, "enums", enumsJ);
+        }
+
+        if (ctl->tlv) {
+            json_object *tlvJ = json_object_new_array();
+            for (unsigned int jdx = 0; jdx < ctl->tlvSize / sizeof (unsigned int); jdx++) json_object_array_add(tlvJ, json_object_new_int64(ctl->tlv[jdx]));
+            json_object_object_add(ctlJ, "tlv", tlvJ);
+        }
+
+        json_object_array_add(ctlsJ, ctlJ);
+    }
+    return ctlsJ;
+}
+
+PUBLIC ctlCatalogT *alsaCatalogFromJson(json_object *ctlsJ, int cardId) {
+    json_object *tmpJ;
+
+    if (json_object_get_type(ctlsJ) != json_type_array) return NULL;
+
+    unsigned int count = (unsigned int) json_object_array_length(ctlsJ);
+    ctlCatalogT *catalog = calloc(1, sizeof (ctlCatalogT));
+    catalog->cardId = cardId;
+    catalog->metadata = 1;
+    catalog->ctls = calloc(count ? count : 1, sizeof (ctlEntryT));
+
+    for (unsigned int idx = 0; idx < count; idx++) {
+        json_object *ctlJ = json_object_array_get_idx(ctlsJ, idx);
+        ctlEntryT *ctl = &catalog->ctls[idx];
+
+        if (!json_object_object_get_ex(ctlJ, "name", &tmpJ)) goto OnErrorExit;
+        strncpy(ctl->name, json_object_get_string(tmpJ), sizeof (ctl->name) - 1);
+
+        json_object_object_get_ex(ctlJ, "numid", &tmpJ);
+        ctl->numid = (unsigned int) json_object_get_int(tmpJ);
+        json_object_object_get_ex(ctlJ, "iface", &tmpJ);
+        ctl->iface = json_object_get_int(tmpJ);
+        json_object_object_get_ex(ctlJ, "dev", &tmpJ);
+        ctl->device = (unsigned int) json_object_get_int(tmpJ);
+        json_object_object_get_ex(ctlJ, "sub", &tmpJ);
+        ctl->subdevice = (unsigned int) json_object_get_int(tmpJ);
+        json_object_object_get_ex(ctlJ, "index", &tmpJ);
+        ctl->index = (unsigned int) json_object_get_int(tmpJ);
+        json_object_object_get_ex(ctlJ, "type", &tmpJ);
+        ctl->type = json_object_get_int(tmpJ);
+        json_object_object_get_ex(ctlJ, "count", &tmpJ);
+        ctl->count = (unsigned int) json_object_get_int(tmpJ);
+        json_object_object_get_ex(ctlJ, "min", &tmpJ);
+        ctl->min = json_object_get_int64(tmpJ);
+        json_object_object_get_ex(ctlJ, "max", &tmpJ);
+        ctl->max = json_object_get_int64(tmpJ);
+        json_object_object_get_ex(ctlJ, "step", &tmpJ);
+        ctl->step = json_object_get_int64(tmpJ);
+        json_object_object_get_ex(ctlJ, "acl", &tmpJ);
+        ctl->acl = (unsigned int) json_object_get_int(tmpJ);
+        catalog->count++;
+
+        if (json_object_object_get_ex(ctlJ, "enums", &tmpJ)) {
+            if (ctl->type != SND_CTL_ELEM_TYPE_ENUMERATED || json_object_array_length(tmpJ) != (size_t) ctl->max) goto OnErrorExit;
+            ctl->enums = calloc((size_t) ctl->max, sizeof (char*));
+            for (unsigned int item = 0; item < ctl->max; item++) ctl->enums[item] = strdup(json_object_get_string(json_object_array_get_idx(tmpJ, item)));
+        }
+
+        if (json_object_object_get_ex(ctlJ, "tlv", &tmpJ)) {
+            size_t length = json_object_array_length(tmpJ);
+            if (length < 2 || length * sizeof (unsigned int) > TLV_BYTE_SIZE) goto OnErrorExit;
+            ctl->tlvSize = (unsigned int) (length * sizeof (unsigned int));
+            ctl->tlv = malloc(ctl->tlvSize);
+            for (size_t jdx = 0; jdx < length; jdx++) ctl->tlv[jdx] = (unsigned int) json_object_get_int64(json_object_array_get_idx(tmpJ, jdx));
+        }
+    }
+    return catalog;
+
+OnErrorExit:
+    alsaCatalogFree(catalog);
+    return NULL;
+}
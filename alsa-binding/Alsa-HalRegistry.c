@@ -0,0 +1,288 @@
+/*
+ * AlsaHalRegistry -- registry of loaded HAL bindings indexed by cardid, sndname and api prefix
+ * Copyright (C) 2015,2016,2017, Fulup Ar Foll fulup@iot.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Entries are chained in three hash tables (no size limit) plus a list keeping registration order
+ * for hallist. A HAL whose api vanished from the binder is purged when it is looked up.
+ */
+
+#define _GNU_SOURCE  // needed for vasprintf
+
+#include <pthread.h>
+
+#include "Alsa-ApiHat.h"
+
+#ifndef HAL_HASH_SIZE
+#define HAL_HASH_SIZE 64
+#endif
+
+typedef struct halEntryS {
+    int  cardid;
+    char *devid;
+    char *apiprefix;
+    char *drivername;
+    char *shortname;
+    char *longname;
+    struct halEntryS *nextCard;
+    struct halEntryS *nextName;
+    struct halEntryS *nextApi;
+    struct halEntryS *next;
+} halEntryT;
+
+static halEntryT *halByCard[HAL_HASH_SIZE];
+static halEntryT *halByName[HAL_HASH_SIZE];
+static halEntryT *halByApi[HAL_HASH_SIZE];
+static halEntryT *halList = NULL;
+static pthread_mutex_t halLock = PTHREAD_MUTEX_INITIALIZER;
+
+STATIC unsigned int halHash(const char *key) {
+    unsigned int hash = 5381;
+    if (!key) return 0;
+    while (*key) hash = hash * 33 + (unsigned char) *key++;
+    return hash % HAL_HASH_SIZE;
+}
+
+STATIC unsigned int halHashCard(int cardid) {
+    return (unsigned int) cardid % HAL_HASH_SIZE;
+}
+
+STATIC void halEntryFree(halEntryT *hal) {
+    free(hal->devid);
+    free(hal->apiprefix);
+    free(hal->drivername);
+    free(hal->shortname);
+    free(hal->longname);
+    free(hal);
+}
+
+// remove entry from every index, caller holds halLock
+
+STATIC void halUnlink(halEntryT *hal) {
+    halEntryT **link;
+
+    for (link = &halByCard[halHashCard(hal->cardid)]; *link && *link != hal; link = &(*link)->nextCard);
+    if (*link) *link = hal->nextCard;
+
+    for (link = &halByName[halHash(hal->shortname)]; *link && *link != hal; link = &(*link)->nextName);
+    if (*link) *link = hal->nextName;
+
+    for (link = &halByApi[halHash(hal->apiprefix)]; *link && *link != hal; link = &(*link)->nextApi);
+    if (*link) *link = hal->nextApi;
+
+    for (link = &halList; *link && *link != hal; link = &(*link)->next);
+    if (*link) *link = hal->next;
+}
+
+// HAL binding is alive as long as its api is still exported by the binder
+
+STATIC int halAlive(halEntryT *hal) {
+    if (afb_daemon_require_api(hal->apiprefix, 0) == 0) return 1;
+
+    AFB_NOTICE("halAlive: api=%s vanished, unregistering HAL", hal->apiprefix);
+    halUnlink(hal);
+    halEntryFree(hal);
+    return 0;
+}
+
+STATIC halEntryT *halSearchApi(const char *apiprefix) {
+    for (halEntryT *hal = halByApi[halHash(apiprefix)]; hal; hal = hal->nextApi) {
+        if (!strcmp(hal->apiprefix, apiprefix)) return hal;
+    }
+    return NULL;
+}
+
+STATIC void halToJson(halEntryT *hal, json_object *responseJ) {
+    json_object_object_add(responseJ, "api", json_object_new_string(hal->apiprefix));
+    if (hal->devid) json_object_object_add(responseJ, "devid", json_object_new_string(hal->devid));
+    if (hal->shortname) json_object_object_add(responseJ, "shortname", json_object_new_string(hal->shortname));
+    if (hal->drivername) json_object_object_add(responseJ, "drivername", json_object_new_string(hal->drivername));
+    if (hal->longname) json_object_object_add(responseJ, "longname", json_object_new_string(hal->longname));
+}
+
+// Return 1st live HAL registered for cardid (0 when a HAL was found)
+
+PUBLIC int alsaHalFromCardid(int cardid, json_object *responseJ) {
+    halEntryT *hal, *next;
+    int err = -1;
+
+    pthread_mutex_lock(&halLock);
+    for (hal = halByCard[halHashCard(cardid)]; hal; hal = next) {
+        next = hal->nextCard;
+        if (hal->cardid != cardid || !halAlive(hal)) continue;
+
+        json_object_object_add(responseJ, "api", json_object_new_string(hal->apiprefix));
+        if (hal->shortname) json_object_object_add(responseJ, "shortname", json_object_new_string(hal->shortname));
+        if (hal->longname) json_object_object_add(responseJ, "longname", json_object_new_string(hal->longname));
+        err = 0;
+        break;
+    }
+    pthread_mutex_unlock(&halLock);
+
+    return err;
+}
+
+// Return true when a live HAL is registered for cardid
+
+PUBLIC int alsaHalCardBusy(int cardid) {
+    halEntryT *hal, *next;
+    int busy = 0;
+
+    pthread_mutex_lock(&halLock);
+    for (hal = halByCard[halHashCard(cardid)]; hal; hal = next) {
+        next = hal->nextCard;
+        if (hal->cardid == cardid && halAlive(hal)) {
+            busy = 1;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&halLock);
+
+    return busy;
+}
+
+// Return api prefix of 1st live HAL registered with sndname (caller should free it)
+
+PUBLIC char *alsaHalApiFromName(const char *shortname) {
+    halEntryT *hal, *next;
+    char *apiprefix = NULL;
+
+    pthread_mutex_lock(&halLock);
+    for (hal = halByName[halHash(shortname)]; hal; hal = next) {
+        next = hal->nextName;
+        if (strcmp(hal->shortname, shortname) || !halAlive(hal)) continue;
+
+        apiprefix = strdup(hal->apiprefix);
+        break;
+    }
+    pthread_mutex_unlock(&halLock);
+
+    return apiprefix;
+}
+
+// Return list of active resgistrated HAL with corresponding sndcard
+
+PUBLIC void alsaActiveHal(afb_req_t request) {
+    json_object *responseJ = json_object_new_array();
+    halEntryT *hal, *next;
+
+    pthread_mutex_lock(&halLock);
+    for (hal = halList; hal; hal = next) {
+        next = hal->next;
+        if (!halAlive(hal)) continue;
+
+        json_object *haldevJ = json_object_new_object();
+        halToJson(hal, haldevJ);
+        json_object_array_add(responseJ, haldevJ);
+    }
+    pthread_mutex_unlock(&halLock);
+
+    afb_req_success(request, responseJ, NULL);
+}
+
+// Register loaded HAL with board Name and API prefix
+
+PUBLIC void alsaRegisterHal(afb_req_t request) {
+    json_object *responseJ, *tmpJ;
+    const char *shortname, *apiPrefix;
+    halEntryT *hal, *oldHal;
+    unsigned int hash;
+
+    apiPrefix = afb_req_value(request, "prefix");
+    if (apiPrefix == NULL) {
+        afb_req_fail_f(request, "argument-missing", "prefix=BindingApiPrefix missing");
+        goto OnErrorExit;
+    }
+
+    shortname = afb_req_value(request, "sndname");
+    if (shortname == NULL) {
+        afb_req_fail_f(request, "argument-missing", "sndname=SndCardName missing");
+        goto OnErrorExit;
+    }
+
+    // alsaGetCardId should be check to register only valid card
+    responseJ = alsaProbeCardId(request);
+    if (!responseJ) goto OnErrorExit;
+
+    hal = calloc(1, sizeof (halEntryT));
+    hal->apiprefix = strdup(apiPrefix);
+    hal->shortname = strdup(shortname);
+
+    json_object_object_get_ex(responseJ, "cardid", &tmpJ);
+    hal->cardid = json_object_get_int(tmpJ);
+    if (json_object_object_get_ex(responseJ, "devid", &tmpJ)) hal->devid = strdup(json_object_get_string(tmpJ));
+    if (json_object_object_get_ex(responseJ, "drivername", &tmpJ)) hal->drivername = strdup(json_object_get_string(tmpJ));
+    if (json_object_object_get_ex(responseJ, "longname", &tmpJ)) hal->longname = strdup(json_object_get_string(tmpJ));
+
+    pthread_mutex_lock(&halLock);
+
+    // a restarted HAL registers again with the same api prefix
+    oldHal = halSearchApi(apiPrefix);
+    if (oldHal) halUnlink(oldHal);
+
+    hash = halHashCard(hal->cardid);
+    hal->nextCard = halByCard[hash];
+    halByCard[hash] = hal;
+
+    hash = halHash(hal->shortname);
+    hal->nextName = halByName[hash];
+    halByName[hash] = hal;
+
+    hash = halHash(hal->apiprefix);
+    hal->nextApi = halByApi[hash];
+    halByApi[hash] = hal;
+
+    // keep registration order for hallist
+    halEntryT **link;
+    for (link = &halList; *link; link = &(*link)->next);
+    *link = hal;
+
+    pthread_mutex_unlock(&halLock);
+    if (oldHal) halEntryFree(oldHal);
+
+    // If OK return sound card Alsa ID+Info
+    afb_req_success(request, responseJ, NULL);
+
+OnErrorExit:
+    return;
+}
+
+// Unregister HAL from its API prefix
+
+PUBLIC void alsaUnregisterHal(afb_req_t request) {
+    const char *apiPrefix;
+    halEntryT *hal;
+
+    apiPrefix = afb_req_value(request, "prefix");
+    if (apiPrefix == NULL) {
+        afb_req_fail_f(request, "argument-missing", "prefix=BindingApiPrefix missing");
+        goto OnErrorExit;
+    }
+
+    pthread_mutex_lock(&halLock);
+    hal = halSearchApi(apiPrefix);
+    if (hal) halUnlink(hal);
+    pthread_mutex_unlock(&halLock);
+
+    if (!hal) {
+        afb_req_fail_f(request, "alsahal-unknown", "No HAL registered with prefix=[%s]", apiPrefix);
+        goto OnErrorExit;
+    }
+
+    halEntryFree(hal);
+    afb_req_success(request, NULL, NULL);
+
+OnErrorExit:
+    return;
+}
@@ -0,0 +1,270 @@
+/*
+ * AlsaHookTelemetry -- aggregate stream telemetry posted by alsa-hook per PCM and application
+ * Copyright (C) 2015,2016,2017, Fulup Ar Foll fulup@iot.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Hook posts {"pcm","app","pid","role","samples":[{"ts","state","delay","avail","xruns","starts","trigger_us"}]}
+ * while stream runs and once at close with "install_us","release_us","granted","leased","xruns","starts".
+ * hooktelemetry records such posts; called without samples/install_us it returns the aggregates
+ * (optional pcm/app filters, reset=true clears them after report). At most TELEMETRY_MAX_ENTRIES
+ * pcm/app pairs are kept, least recently seen one is evicted for a new pair.
+ */
+
+#define _GNU_SOURCE  // needed for vasprintf
+
+#include <pthread.h>
+#include <time.h>
+
+#include "Alsa-ApiHat.h"
+
+#ifndef TELEMETRY_HASH_SIZE
+#define TELEMETRY_HASH_SIZE 64
+#endif
+
+#ifndef TELEMETRY_MAX_ENTRIES
+#define TELEMETRY_MAX_ENTRIES 256
+#endif
+
+typedef struct telemetryEntryS {
+    char *pcm;
+    char *app;
+    char *role;
+    int pid;
+    char state[16];
+    time_t lastSeen;
+    unsigned int streams;
+    unsigned int granted;
+    unsigned int leased;
+    uint64_t installSum;
+    uint64_t installMax;
+    uint64_t releaseSum;
+    uint64_t releaseMax;
+    unsigned int xruns;
+    unsigned int starts;
+    unsigned int liveXruns;   // xruns reported by running stream samples
+    unsigned int samples;
+    int64_t delaySum;
+    int64_t delayMax;
+    int64_t availMin;
+    struct telemetryEntryS *next;
+} telemetryEntryT;
+
+static telemetryEntryT *telemetryHash[TELEMETRY_HASH_SIZE];
+static int telemetryCount = 0;
+static pthread_mutex_t telemetryLock = PTHREAD_MUTEX_INITIALIZER;
+
+STATIC unsigned int telemetryHashKey(const char *pcm, const char *app) {
+    unsigned int hash = 5381;
+    while (*pcm) hash = hash * 33 + (unsigned char) *pcm++;
+    hash = hash * 33 + '/';
+    while (*app) hash = hash * 33 + (unsigned char) *app++;
+    return hash % TELEMETRY_HASH_SIZE;
+}
+
+STATIC void telemetryEntryFree(telemetryEntryT *entry) {
+    free(entry->pcm);
+    free(entry->app);
+    free(entry->role);
+    free(entry);
+}
+
+// drop least recently seen entry, caller holds telemetryLock
+STATIC void telemetryEvict(void) {
+    telemetryEntryT **oldest = NULL, **link;
+
+    for (int hash = 0; hash < TELEMETRY_HASH_SIZE; hash++) {
+        for (link = &telemetryHash[hash]; *link; link = &(*link)->next) {
+            if (!oldest || (*link)->lastSeen < (*oldest)->lastSeen) oldest = link;
+        }
+    }
+    if (!oldest) return;
+
+    telemetryEntryT *entry = *oldest;
+    *oldest = entry->next;
+    telemetryEntryFree(entry);
+    telemetryCount--;
+}
+
+// Return entry for pcm/app, created on first report (NULL when out of memory), caller holds telemetryLock
+
+STATIC telemetryEntryT *telemetryEntryGet(const char *pcm, const char *app) {
+    unsigned int hash = telemetryHashKey(pcm, app);
+    telemetryEntryT *entry;
+
+    for (entry = telemetryHash[hash]; entry; entry = entry->next) {
+        if (!strcmp(entry->pcm, pcm) && !strcmp(entry->app, app)) return entry;
+    }
+
+    if (telemetryCount >= TELEMETRY_MAX_ENTRIES) telemetryEvict();
+
+    entry = calloc(1, sizeof (telemetryEntryT));
+    if (!entry) return NULL;
+    entry->pcm = strdup(pcm);
+    entry->app = strdup(app);
+    if (!entry->pcm || !entry->app) {
+        telemetryEntryFree(entry);
+        return NULL;
+    }
+    entry->availMin = -1;
+    entry->next = telemetryHash[hash];
+    telemetryHash[hash] = entry;
+    telemetryCount++;
+    return entry;
+}
+
+STATIC void telemetrySample(telemetryEntryT *entry, json_object *sampleJ) {
+    json_object *tmpJ;
+
+    if (json_object_object_get_ex(sampleJ, "state", &tmpJ))
+        snprintf(entry->state, sizeof (entry->state), "%s", json_object_get_string(tmpJ));
+
+    if (json_object_object_get_ex(sampleJ, "delay", &tmpJ)) {
+        int64_t delay = json_object_get_int64(tmpJ);
+        entry->delaySum += delay;
+        if (delay > entry->delayMax) entry->delayMax = delay;
+    }
+
+    if (json_object_object_get_ex(sampleJ, "avail", &tmpJ)) {
+        int64_t avail = json_object_get_int64(tmpJ);
+        if (entry->availMin < 0 || avail < entry->availMin) entry->availMin = avail;
+    }
+
+    if (json_object_object_get_ex(sampleJ, "xruns", &tmpJ)) entry->liveXruns = (unsigned int) json_object_get_int(tmpJ);
+    entry->samples++;
+}
+
+STATIC void telemetryRecord(telemetryEntryT *entry, json_object *queryJ) {
+    json_object *tmpJ;
+    size_t count;
+
+    if (json_object_object_get_ex(queryJ, "pid", &tmpJ)) entry->pid = json_object_get_int(tmpJ);
+    if (json_object_object_get_ex(queryJ, "role", &tmpJ) && (!entry->role || strcmp(entry->role, json_object_get_string(tmpJ)))) {
+        free(entry->role);
+        entry->role = strdup(json_object_get_string(tmpJ));
+    }
+    entry->lastSeen = time(NULL);
+
+    if (json_object_object_get_ex(queryJ, "samples", &tmpJ) && json_object_is_type(tmpJ, json_type_array)) {
+        count = json_object_array_length(tmpJ);
+        for (size_t idx = 0; idx < count; idx++) telemetrySample(entry, json_object_array_get_idx(tmpJ, idx));
+    }
+
+    // close report carries stream totals
+    if (!json_object_object_get_ex(queryJ, "install_us", &tmpJ)) return;
+
+    uint64_t install = (uint64_t) json_object_get_int64(tmpJ);
+    entry->streams++;
+    entry->installSum += install;
+    if (install > entry->installMax) entry->installMax = install;
+
+    if (json_object_object_get_ex(queryJ, "release_us", &tmpJ)) {
+        uint64_t release = (uint64_t) json_object_get_int64(tmpJ);
+        entry->releaseSum += release;
+        if (release > entry->releaseMax) entry->releaseMax = release;
+    }
+    if (json_object_object_get_ex(queryJ, "granted", &tmpJ) && json_object_get_boolean(tmpJ)) entry->granted++;
+    if (json_object_object_get_ex(queryJ, "leased", &tmpJ) && json_object_get_boolean(tmpJ)) entry->leased++;
+    if (json_object_object_get_ex(queryJ, "xruns", &tmpJ)) entry->xruns += (unsigned int) json_object_get_int(tmpJ);
+    if (json_object_object_get_ex(queryJ, "starts", &tmpJ)) entry->starts += (unsigned int) json_object_get_int(tmpJ);
+    entry->liveXruns = 0;
+}
+
+STATIC json_object *telemetryToJson(telemetryEntryT *entry) {
+    json_object *entryJ = json_object_new_object();
+
+    json_object_object_add(entryJ, "pcm", json_object_new_string(entry->pcm));
+    json_object_object_add(entryJ, "app", json_object_new_string(entry->app));
+    if (entry->role) json_object_object_add(entryJ, "role", json_object_new_string(entry->role));
+    json_object_object_add(entryJ, "pid", json_object_new_int(entry->pid));
+    json_object_object_add(entryJ, "last_seen", json_object_new_int64((int64_t) entry->lastSeen));
+    if (entry->state[0]) json_object_object_add(entryJ, "state", json_object_new_string(entry->state));
+    json_object_object_add(entryJ, "streams", json_object_new_int((int) entry->streams));
+    json_object_object_add(entryJ, "granted", json_object_new_int((int) entry->granted));
+    json_object_object_add(entryJ, "leased", json_object_new_int((int) entry->leased));
+    if (entry->streams) {
+        json_object_object_add(entryJ, "install_avg_us", json_object_new_int64((int64_t) (entry->installSum / entry->streams)));
+        json_object_object_add(entryJ, "install_max_us", json_object_new_int64((int64_t) entry->installMax));
+        json_object_object_add(entryJ, "release_avg_us", json_object_new_int64((int64_t) (entry->releaseSum / entry->streams)));
+        json_object_object_add(entryJ, "release_max_us", json_object_new_int64((int64_t) entry->releaseMax));
+    }
+    json_object_object_add(entryJ, "xruns", json_object_new_int((int) (entry->xruns + entry->liveXruns)));
+    json_object_object_add(entryJ, "starts", json_object_new_int((int) entry->starts));
+    json_object_object_add(entryJ, "samples", json_object_new_int((int) entry->samples));
+    if (entry->samples) {
+        json_object_object_add(entryJ, "delay_avg", json_object_new_int64(entry->delaySum / entry->samples));
+        json_object_object_add(entryJ, "delay_max", json_object_new_int64(entry->delayMax));
+        json_object_object_add(entryJ, "avail_min", json_object_new_int64(entry->availMin));
+    }
+    return entryJ;
+}
+
+// Record hook telemetry post, or return aggregates when called without samples
+
+PUBLIC void alsaHookTelemetry(afb_req_t request) {
+    json_object *queryJ = afb_req_json(request);
+    json_object *tmpJ, *responseJ;
+    const char *pcm, *app;
+    telemetryEntryT *entry, **link;
+    int reset = 0;
+
+    pcm = afb_req_value(request, "pcm");
+    app = afb_req_value(request, "app");
+
+    if (json_object_object_get_ex(queryJ, "samples", &tmpJ) || json_object_object_get_ex(queryJ, "install_us", &tmpJ)) {
+        if (!pcm || !app) {
+            afb_req_fail_f(request, "argument-missing", "pcm=PcmName and app=AppName required with samples");
+            goto OnErrorExit;
+        }
+
+        pthread_mutex_lock(&telemetryLock);
+        entry = telemetryEntryGet(pcm, app);
+        if (entry) telemetryRecord(entry, queryJ);
+        pthread_mutex_unlock(&telemetryLock);
+
+        if (!entry) {
+            afb_req_fail_f(request, "out-of-memory", "pcm=%s app=%s fail to allocate telemetry entry", pcm, app);
+            goto OnErrorExit;
+        }
+
+        afb_req_success(request, NULL, NULL);
+        return;
+    }
+
+    if (json_object_object_get_ex(queryJ, "reset", &tmpJ)) reset = json_object_get_boolean(tmpJ);
+
+    responseJ = json_object_new_array();
+    pthread_mutex_lock(&telemetryLock);
+    for (int hash = 0; hash < TELEMETRY_HASH_SIZE; hash++) {
+        for (link = &telemetryHash[hash]; (entry = *link);) {
+            if ((pcm && strcmp(entry->pcm, pcm)) || (app && strcmp(entry->app, app))) {
+                link = &entry->next;
+                continue;
+            }
+            json_object_array_add(responseJ, telemetryToJson(entry));
+            if (reset) {
+                *link = entry->next;
+                telemetryEntryFree(entry);
+                telemetryCount--;
+                continue;
+            }
+            link = &entry->next;
+        }
+    }
+    pthread_mutex_unlock(&telemetryLock);
+
+    afb_req_success(request, responseJ, NULL);
+
+OnErrorExit:
+    return;
+}
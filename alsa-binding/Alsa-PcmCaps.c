@@ -0,0 +1,224 @@
+/*
+ * AlsaPcmCaps -- cached PCM hardware capabilities (rates, formats, channels, buffer/period ranges)
+ * Copyright (C) 2015,2016,2017, Fulup Ar Foll fulup@iot.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * A PCM is probed once, on first pcmcaps request, with a non blocking open (a busy PCM is reported,
+ * never waited for). PCMs are never probed ahead of requests: hw PCMs are exclusive and an application
+ * opening one during a background probe would get EBUSY. Results are dropped on card hotplug.
+ */
+
+#define _GNU_SOURCE  // needed for vasprintf
+
+#include <pthread.h>
+
+#include "Alsa-ApiHat.h"
+
+typedef struct pcmCapsS {
+    char *name;
+    snd_pcm_stream_t stream;
+    int cardId;
+    json_object *capsJ;
+    struct pcmCapsS *next;
+} pcmCapsT;
+
+static pcmCapsT *pcmCapsList = NULL;
+static pthread_mutex_t pcmCapsLock = PTHREAD_MUTEX_INITIALIZER;
+
+STATIC json_object *pcmCapsProbe(const char *pcmName, snd_pcm_stream_t pcmStream, int *busy) {
+    snd_pcm_t *pcmHandle = NULL;
+    snd_pcm_hw_params_t *hwParams;
+    snd_pcm_format_mask_t *formatMask;
+    snd_pcm_uframes_t frameMin, frameMax;
+    unsigned int valMin, valMax;
+    json_object *capsJ, *rangeJ, *formatsJ;
+    int err, dir;
+
+    *busy = 0;
+
+    // never wait for a PCM used by an active stream
+    err = snd_pcm_open(&pcmHandle, pcmName, pcmStream, SND_PCM_NONBLOCK);
+    if (err < 0) {
+        *busy = (err == -EBUSY);
+        AFB_INFO("pcmCapsProbe: pcm=%s stream=%d open error=%s", pcmName, pcmStream, snd_strerror(err));
+        goto OnErrorExit;
+    }
+
+    snd_pcm_hw_params_alloca(&hwParams);
+    if ((err = snd_pcm_hw_params_any(pcmHandle, hwParams)) < 0) {
+        AFB_INFO("pcmCapsProbe: pcm=%s fail to get hw params error=%s", pcmName, snd_strerror(err));
+        goto OnErrorExit;
+    }
+
+    capsJ = json_object_new_object();
+
+    snd_pcm_hw_params_get_rate_min(hwParams, &valMin, &dir);
+    snd_pcm_hw_params_get_rate_max(hwParams, &valMax, &dir);
+    rangeJ = json_object_new_object();
+    json_object_object_add(rangeJ, "min", json_object_new_int((int) valMin));
+    json_object_object_add(rangeJ, "max", json_object_new_int((int) valMax));
+    json_object_object_add(capsJ, "rate", rangeJ);
+
+    snd_pcm_hw_params_get_channels_min(hwParams, &valMin);
+    snd_pcm_hw_params_get_channels_max(hwParams, &valMax);
+    rangeJ = json_object_new_object();
+    json_object_object_add(rangeJ, "min", json_object_new_int((int) valMin));
+    json_object_object_add(rangeJ, "max", json_object_new_int((int) valMax));
+    json_object_object_add(capsJ, "channels", rangeJ);
+
+    snd_pcm_hw_params_get_buffer_size_min(hwParams, &frameMin);
+    snd_pcm_hw_params_get_buffer_size_max(hwParams, &frameMax);
+    rangeJ = json_object_new_object();
+    json_object_object_add(rangeJ, "min", json_object_new_int64((int64_t) frameMin));
+    json_object_object_add(rangeJ, "max", json_object_new_int64((int64_t) frameMax));
+    json_object_object_add(capsJ, "buffer", rangeJ);
+
+    snd_pcm_hw_params_get_period_size_min(hwParams, &frameMin, &dir);
+    snd_pcm_hw_params_get_period_size_max(hwParams, &frameMax, &dir);
+    rangeJ = json_object_new_object();
+    json_object_object_add(rangeJ, "min", json_object_new_int64((int64_t) frameMin));
+    json_object_object_add(rangeJ, "max", json_object_new_int64((int64_t) frameMax));
+    json_object_object_add(capsJ, "period", rangeJ);
+
+    snd_pcm_hw_params_get_periods_min(hwParams, &valMin, &dir);
+    snd_pcm_hw_params_get_periods_max(hwParams, &valMax, &dir);
+    rangeJ = json_object_new_object();
+    json_object_object_add(rangeJ, "min", json_object_new_int((int) valMin));
+    json_object_object_add(rangeJ, "max", json_object_new_int((int) valMax));
+    json_object_object_add(capsJ, "periods", rangeJ);
+
+    snd_pcm_format_mask_alloca(&formatMask);
+    snd_pcm_hw_params_get_format_mask(hwParams, formatMask);
+    formatsJ = json_object_new_array();
+    for (int format = 0; format <= SND_PCM_FORMAT_LAST; format++) {
+        if (snd_pcm_format_mask_test(formatMask, (snd_pcm_format_t) format)) {
+            json_object_array_add(formatsJ, json_object_new_string(snd_pcm_format_name((snd_pcm_format_t) format)));
+        }
+    }
+    json_object_object_add(capsJ, "formats", formatsJ);
+
+    snd_pcm_close(pcmHandle);
+    return capsJ;
+
+OnErrorExit:
+    if (pcmHandle) snd_pcm_close(pcmHandle);
+    return NULL;
+}
+
+// Return a reference on pcm caps, probe pcm on cache miss
+
+STATIC json_object *pcmCapsGet(const char *pcmName, snd_pcm_stream_t pcmStream, int *busy) {
+    pcmCapsT *caps;
+    json_object *capsJ = NULL;
+    int cardId, device, subdevice;
+
+    *busy = 0;
+    pthread_mutex_lock(&pcmCapsLock);
+    for (caps = pcmCapsList; caps; caps = caps->next) {
+        if (caps->stream == pcmStream && !strcmp(caps->name, pcmName)) {
+            capsJ = json_object_get(caps->capsJ);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pcmCapsLock);
+    if (capsJ) return capsJ;
+
+    // probe outside of lock, opening a plugin chain may take a while
+    capsJ = pcmCapsProbe(pcmName, pcmStream, busy);
+    if (!capsJ) return NULL;
+
+    // attach caps to their sound card for hotplug drop
+    if (alsaPcmIndexResolve(pcmName, pcmStream, &cardId, &device, &subdevice) < 0) cardId = -1;
+
+    caps = calloc(1, sizeof (pcmCapsT));
+    caps->name = strdup(pcmName);
+    caps->stream = pcmStream;
+    caps->cardId = cardId;
+    caps->capsJ = json_object_get(capsJ);
+
+    pthread_mutex_lock(&pcmCapsLock);
+    caps->next = pcmCapsList;
+    pcmCapsList = caps;
+    pthread_mutex_unlock(&pcmCapsLock);
+
+    return capsJ;
+}
+
+// Drop cached caps of a removed card (and of pcm without sound card)
+
+PUBLIC void alsaPcmCapsDrop(int cardId) {
+    pcmCapsT *caps, **capsLink;
+
+    pthread_mutex_lock(&pcmCapsLock);
+    for (capsLink = &pcmCapsList; (caps = *capsLink);) {
+        if (caps->cardId != cardId && caps->cardId >= 0) {
+            capsLink = &caps->next;
+            continue;
+        }
+        *capsLink = caps->next;
+        json_object_put(caps->capsJ);
+        free(caps->name);
+        free(caps);
+    }
+    pthread_mutex_unlock(&pcmCapsLock);
+}
+
+// Return caps for one ("name":"xxx") or many ("name":["xxx","yyy"]) pcm
+
+PUBLIC void alsaPcmCaps(afb_req_t request) {
+    int done, busy;
+    json_object *tmpJ, *namesJ, *responseJ;
+
+    json_object* queryJ = afb_req_json(request);
+
+    done = json_object_object_get_ex(queryJ, "name", &namesJ);
+    if (!done || (json_object_get_type(namesJ) != json_type_string && json_object_get_type(namesJ) != json_type_array)) {
+        afb_req_fail_f(request, "name:invalid", "PCM 'name:xxx' missing or not a string/array query='%s'", json_object_get_string(queryJ));
+        goto OnErrorExit;
+    }
+
+    done = json_object_object_get_ex(queryJ, "stream", &tmpJ);
+    if (done && json_object_get_type(tmpJ) != json_type_int) {
+        afb_req_fail_f(request, "stream:invalid", "PCM 'stream:SND_PCM_STREAM_PLAYBACK/SND_PCM_STREAM_CAPTURE' should be integer query='%s'", json_object_get_string(queryJ));
+        goto OnErrorExit;
+    }
+    snd_pcm_stream_t pcmStream = done ? (snd_pcm_stream_t) json_object_get_int(tmpJ) : SND_PCM_STREAM_PLAYBACK;
+
+    if (json_object_get_type(namesJ) == json_type_string) {
+        const char *pcmName = json_object_get_string(namesJ);
+        responseJ = pcmCapsGet(pcmName, pcmStream, &busy);
+        if (!responseJ) {
+            afb_req_fail_f(request, busy ? "pcm:busy" : "pcm:invalid", "PCM 'name:%s' fail to probe capabilities", pcmName);
+            goto OnErrorExit;
+        }
+        afb_req_success(request, responseJ, NULL);
+        return;
+    }
+
+    responseJ = json_object_new_array();
+    for (int idx = 0; idx < json_object_array_length(namesJ); idx++) {
+        const char *pcmName = json_object_get_string(json_object_array_get_idx(namesJ, idx));
+        json_object *pcmJ = json_object_new_object();
+        json_object *capsJ = pcmCapsGet(pcmName, pcmStream, &busy);
+
+        json_object_object_add(pcmJ, "pcm", json_object_new_string(pcmName));
+        if (capsJ) json_object_object_add(pcmJ, "caps", capsJ);
+        else json_object_object_add(pcmJ, "error", json_object_new_string(busy ? "pcm:busy" : "pcm:invalid"));
+        json_object_array_add(responseJ, pcmJ);
+    }
+    afb_req_success(request, responseJ, NULL);
+
+OnErrorExit:
+    return;
+}
@@ -0,0 +1,414 @@
+/*
+ * AlsaPcmIndex -- PCM topology index answering pcminfo without opening any PCM
+ * Copyright (C) 2015,2016,2017, Fulup Ar Foll fulup@iot.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Hardware PCM devices are listed per card with snd_ctl_pcm_next_device/snd_ctl_pcm_info.
+ * PCM names (hw:x,y plughw:... dmix, asym, user defined, ...) are resolved to their hw card/device
+ * by walking snd_config "pcm" definitions through slave/playback/capture pcm references.
+ * Both are cached until the sound card table reports a hotplug.
+ */
+
+#define _GNU_SOURCE  // needed for vasprintf
+
+#include <pthread.h>
+
+#include "Alsa-ApiHat.h"
+
+#define PCM_RESOLVE_MAXDEPTH 8
+
+typedef struct {
+    int device;
+    snd_pcm_stream_t stream;
+    int subdevices;
+    char id[64];
+    char name[80];
+    char subname[32];
+} pcmDevT;
+
+typedef struct {
+    int loaded;
+    int count;
+    pcmDevT *devs;
+} pcmCardT;
+
+typedef struct pcmAliasS {
+    char *name;
+    snd_pcm_stream_t stream;
+    int status;
+    int typed;
+    snd_pcm_type_t type;
+    int cardId;
+    int device;
+    int subdevice;
+    struct pcmAliasS *next;
+} pcmAliasT;
+
+static pcmCardT pcmCards[MAX_SND_CARD];
+static pcmAliasT *pcmAliases = NULL;
+static pthread_mutex_t pcmIndexLock = PTHREAD_MUTEX_INITIALIZER;
+
+// List card hardware PCM devices, caller holds pcmIndexLock
+
+STATIC void pcmCardLoad(int cardId) {
+    pcmCardT *card = &pcmCards[cardId];
+    snd_ctl_t *ctlDev;
+    snd_pcm_info_t *pcmInfo;
+    char devid[32];
+    int device = -1, err;
+
+    card->loaded = 1;
+    snprintf(devid, sizeof (devid), "hw:%i", cardId);
+    if ((err = snd_ctl_open(&ctlDev, devid, SND_CTL_READONLY)) < 0) {
+        AFB_INFO("pcmCardLoad: devid=%s open error=%s", devid, snd_strerror(err));
+        return;
+    }
+
+    snd_pcm_info_alloca(&pcmInfo);
+    while (snd_ctl_pcm_next_device(ctlDev, &device) == 0 && device >= 0) {
+        for (int stream = SND_PCM_STREAM_PLAYBACK; stream <= SND_PCM_STREAM_LAST; stream++) {
+            snd_pcm_info_set_device(pcmInfo, (unsigned int) device);
+            snd_pcm_info_set_subdevice(pcmInfo, 0);
+            snd_pcm_info_set_stream(pcmInfo, (snd_pcm_stream_t) stream);
+            if (snd_ctl_pcm_info(ctlDev, pcmInfo) < 0) continue; // device has no such stream
+
+            card->devs = realloc(card->devs, sizeof (pcmDevT) * (size_t) (card->count + 1));
+            pcmDevT *dev = &card->devs[card->count++];
+            memset(dev, 0, sizeof (pcmDevT));
+            dev->device = device;
+            dev->stream = (snd_pcm_stream_t) stream;
+            dev->subdevices = (int) snd_pcm_info_get_subdevices_count(pcmInfo);
+            strncpy(dev->id, snd_pcm_info_get_id(pcmInfo), sizeof (dev->id) - 1);
+            strncpy(dev->name, snd_pcm_info_get_name(pcmInfo), sizeof (dev->name) - 1);
+            strncpy(dev->subname, snd_pcm_info_get_subdevice_name(pcmInfo), sizeof (dev->subname) - 1);
+        }
+    }
+    snd_ctl_close(ctlDev);
+}
+
+STATIC pcmDevT *pcmDevSearch(int cardId, int device, snd_pcm_stream_t stream) {
+    if (cardId < 0 || cardId >= MAX_SND_CARD) return NULL;
+
+    pcmCardT *card = &pcmCards[cardId];
+    if (!card->loaded) pcmCardLoad(cardId);
+
+    for (int idx = 0; idx < card->count; idx++) {
+        if (card->devs[idx].device == device && card->devs[idx].stream == stream) return &card->devs[idx];
+    }
+    return NULL;
+}
+
+// builtin plugin type, -1 for external plugins (ioplug/extplug based)
+
+STATIC int pcmTypeFromName(const char *typeName) {
+    for (int type = 0; type <= SND_PCM_TYPE_LAST; type++) {
+        const char *name = snd_pcm_type_name((snd_pcm_type_t) type);
+        if (name && !strcasecmp(name, typeName)) return type;
+    }
+    return -1;
+}
+
+// same value as snd_pcm_type() on opened pcm: references, asym and empty open their slave directly
+
+STATIC void pcmConfType(pcmAliasT *alias, const char *type) {
+    int pcmType;
+
+    if (alias->typed || !strcmp(type, "asym") || !strcmp(type, "empty")) return;
+
+    pcmType = pcmTypeFromName(type);
+    alias->typed = (pcmType < 0) ? -1 : 1;
+    if (pcmType >= 0) alias->type = (snd_pcm_type_t) pcmType;
+}
+
+// external plugin type is only known once opened (nonblock, never waits on a busy device)
+
+STATIC void pcmProbeType(pcmAliasT *alias) {
+    snd_pcm_t *pcmHandle;
+
+    if (snd_pcm_open(&pcmHandle, alias->name, alias->stream, SND_PCM_NONBLOCK) < 0) {
+        alias->type = SND_PCM_TYPE_IOPLUG;
+        return;
+    }
+    alias->type = snd_pcm_type(pcmHandle);
+    snd_pcm_close(pcmHandle);
+}
+
+STATIC int pcmConfInteger(snd_config_t *conf, const char *key, int defval) {
+    snd_config_t *node;
+    const char *str;
+    long value;
+
+    if (snd_config_search(conf, key, &node) < 0) return defval;
+    if (snd_config_get_integer(node, &value) == 0) return (int) value;
+    if (snd_config_get_string(node, &str) == 0) return atoi(str);
+    return defval;
+}
+
+STATIC int pcmResolveName(const char *name, pcmAliasT *alias, int depth);
+
+// Follow pcm definition down to its hw plugin, caller holds pcmIndexLock
+
+STATIC int pcmResolveConf(snd_config_t *conf, pcmAliasT *alias, int depth) {
+    snd_config_t *node;
+    const char *type, *str;
+
+    if (depth > PCM_RESOLVE_MAXDEPTH) return -1;
+
+    // a string is a reference to another pcm definition
+    if (snd_config_get_string(conf, &str) == 0) return pcmResolveName(str, alias, depth + 1);
+
+    if (snd_config_search(conf, "type", &node) < 0 || snd_config_get_string(node, &type) < 0) return -1;
+    pcmConfType(alias, type);
+
+    if (!strcmp(type, "hw")) {
+        if (snd_config_search(conf, "card", &node) < 0) return -1;
+        if (snd_config_get_string(node, &str) == 0) {
+            // card table is not used here, its refresh may drop this index
+            alias->cardId = snd_card_get_index(str);
+        } else {
+            alias->cardId = pcmConfInteger(conf, "card", -1);
+        }
+        alias->device = pcmConfInteger(conf, "device", 0);
+        alias->subdevice = pcmConfInteger(conf, "subdevice", -1);
+        return (alias->cardId < 0) ? -1 : 0;
+    }
+
+    // asym use one slave per stream
+    if (!strcmp(type, "asym")) {
+        if (snd_config_search(conf, alias->stream == SND_PCM_STREAM_PLAYBACK ? "playback.pcm" : "capture.pcm", &node) < 0) return -1;
+        return pcmResolveConf(node, alias, depth + 1);
+    }
+
+    // slave.pcm or slave referencing a pcm_slave definition
+    if (snd_config_search(conf, "slave.pcm", &node) == 0) return pcmResolveConf(node, alias, depth + 1);
+    if (snd_config_search(conf, "slave", &node) == 0 && snd_config_get_string(node, &str) == 0) {
+        snd_config_t *slaveConf;
+        int err;
+
+        if (snd_config_search_definition(snd_config, "pcm_slave", str, &slaveConf) < 0) return -1;
+        err = (snd_config_search(slaveConf, "pcm", &node) == 0) ? pcmResolveConf(node, alias, depth + 1) : -1;
+        snd_config_delete(slaveConf);
+        return err;
+    }
+
+    // multi only reports its 1st slave
+    if (snd_config_search(conf, "slaves", &node) == 0) {
+        snd_config_iterator_t iter = snd_config_iterator_first(node);
+        if (iter == snd_config_iterator_end(node)) return -1;
+        if (snd_config_search(snd_config_iterator_entry(iter), "pcm", &node) < 0) return -1;
+        return pcmResolveConf(node, alias, depth + 1);
+    }
+
+    // pure software plugins (null, pulse, ...) have no sound card
+    return -1;
+}
+
+STATIC int pcmResolveName(const char *name, pcmAliasT *alias, int depth) {
+    snd_config_t *conf;
+    int err;
+
+    if (depth > PCM_RESOLVE_MAXDEPTH) return -1;
+
+    // search_definition expands arguments (hw:0,1 plughw:CARD=PCH ...)
+    if (snd_config_search_definition(snd_config, "pcm", name, &conf) < 0) return -1;
+    err = pcmResolveConf(conf, alias, depth);
+    snd_config_delete(conf);
+    return err;
+}
+
+// Return cached resolution of a pcm name, caller holds pcmIndexLock
+
+STATIC pcmAliasT *pcmAliasGet(const char *name, snd_pcm_stream_t stream) {
+    pcmAliasT *alias;
+
+    for (alias = pcmAliases; alias; alias = alias->next) {
+        if (alias->stream == stream && !strcmp(alias->name, name)) return alias;
+    }
+
+    alias = calloc(1, sizeof (pcmAliasT));
+    alias->name = strdup(name);
+    alias->stream = stream;
+    alias->cardId = -1;
+
+    snd_config_update();
+    alias->status = pcmResolveName(name, alias, 0);
+    if (alias->status == 0 && alias->typed < 0) pcmProbeType(alias);
+
+    alias->next = pcmAliases;
+    pcmAliases = alias;
+    return alias;
+}
+
+// Drop cached pcm of a card (aliases may reference card by id, they are all dropped)
+
+PUBLIC void alsaPcmIndexDrop(int cardId) {
+    pcmAliasT *alias, *next;
+
+    pthread_mutex_lock(&pcmIndexLock);
+    if (cardId >= 0 && cardId < MAX_SND_CARD) {
+        free(pcmCards[cardId].devs);
+        memset(&pcmCards[cardId], 0, sizeof (pcmCardT));
+    }
+    for (alias = pcmAliases; alias; alias = next) {
+        next = alias->next;
+        free(alias->name);
+        free(alias);
+    }
+    pcmAliases = NULL;
+    pthread_mutex_unlock(&pcmIndexLock);
+}
+
+// Copy card hardware pcm device/stream list, return count
+
+PUBLIC int alsaPcmIndexDevices(int cardId, int *devices, snd_pcm_stream_t *streams, int max) {
+    int count = 0;
+
+    if (cardId < 0 || cardId >= MAX_SND_CARD) return 0;
+
+    pthread_mutex_lock(&pcmIndexLock);
+    pcmCardT *card = &pcmCards[cardId];
+    if (!card->loaded) pcmCardLoad(cardId);
+    for (int idx = 0; idx < card->count && count < max; idx++, count++) {
+        devices[count] = card->devs[idx].device;
+        streams[count] = card->devs[idx].stream;
+    }
+    pthread_mutex_unlock(&pcmIndexLock);
+
+    return count;
+}
+
+// Resolve pcm name to its hw card/device (return -1 for unknown or pure software pcm)
+
+PUBLIC int alsaPcmIndexResolve(const char *pcmName, snd_pcm_stream_t pcmStream, int *cardId, int *device, int *subdevice) {
+    pthread_mutex_lock(&pcmIndexLock);
+    pcmAliasT *alias = pcmAliasGet(pcmName, pcmStream);
+    int status = alias->status;
+    *cardId = alias->cardId;
+    *device = alias->device;
+    *subdevice = alias->subdevice < 0 ? 0 : alias->subdevice;
+    pthread_mutex_unlock(&pcmIndexLock);
+
+    return status;
+}
+
+STATIC json_object *pcmInfoOne(const char *pcmName, snd_pcm_stream_t pcmStream, int mode, const char **errLabel) {
+    json_object *responseJ;
+    pcmAliasT *alias;
+    pcmDevT *dev;
+
+    pthread_mutex_lock(&pcmIndexLock);
+    alias = pcmAliasGet(pcmName, pcmStream);
+    if (alias->status < 0) {
+        *errLabel = "pcm:invalid";
+        goto OnErrorExit;
+    }
+
+    // pcm should exist on hardware
+    dev = pcmDevSearch(alias->cardId, alias->device, pcmStream);
+    if (!dev) {
+        *errLabel = "pcm:error";
+        goto OnErrorExit;
+    }
+
+    // prepare an object for response
+    responseJ = json_object_new_object();
+
+    if (alsaHalFromCardid(alias->cardId, responseJ) < 0) {
+        *errLabel = "pcm:nohal";
+        json_object_put(responseJ);
+        goto OnErrorExit;
+    }
+
+    json_object_object_add(responseJ, "type", json_object_new_int(alias->type));
+
+    // in mode mode we return full info about PCM
+    if (mode > 0) {
+        json_object_object_add(responseJ, "stream", json_object_new_int(pcmStream));
+        json_object_object_add(responseJ, "cardid", json_object_new_int(alias->cardId));
+        json_object_object_add(responseJ, "devid" , json_object_new_int(alias->device));
+        json_object_object_add(responseJ, "subid" , json_object_new_int(alias->subdevice < 0 ? 0 : alias->subdevice));
+    }
+
+    // in super mode we also return information about snd card
+    if (mode > 1) {
+        json_object_object_add(responseJ, "id"     , json_object_new_string(dev->id));
+        json_object_object_add(responseJ, "name"   , json_object_new_string(dev->name));
+        json_object_object_add(responseJ, "subdev" , json_object_new_string(dev->subname));
+    }
+    pthread_mutex_unlock(&pcmIndexLock);
+
+    return responseJ;
+
+OnErrorExit:
+    pthread_mutex_unlock(&pcmIndexLock);
+    return NULL;
+}
+
+// Return pcm info from name ("name":"xxx" or "name":["xxx","yyy"]) without opening it
+
+PUBLIC void alsaPcmInfo (afb_req_t request) {
+    int done, mode;
+    json_object *tmpJ, *namesJ, *responseJ;
+    const char *errLabel = NULL;
+
+    json_object* queryJ = afb_req_json(request);
+
+    done = json_object_object_get_ex(queryJ, "name", &namesJ);
+    if (!done || (json_object_get_type(namesJ) != json_type_string && json_object_get_type(namesJ) != json_type_array)) {
+        afb_req_fail_f(request, "name:invalid", "PCM 'name:xxx' missing or not a string/array query='%s'", json_object_get_string(queryJ));
+        goto OnErrorExit;
+    }
+
+    done = json_object_object_get_ex(queryJ, "stream", &tmpJ);
+    if (done && json_object_get_type(tmpJ) != json_type_int) {
+        afb_req_fail_f(request, "stream:invalid", "PCM 'stream:SND_PCM_STREAM_PLAYBACK/SND_PCM_STREAM_CAPTURE' should be integer query='%s'", json_object_get_string(queryJ));
+        goto OnErrorExit;
+    }
+    snd_pcm_stream_t pcmStream = done ? (snd_pcm_stream_t) json_object_get_int(tmpJ) : SND_PCM_STREAM_PLAYBACK;
+
+    done = json_object_object_get_ex(queryJ, "mode", &tmpJ);
+    if (!done) {
+        mode = 0;
+    } else {
+        mode = json_object_get_int(tmpJ);
+    }
+
+    // single name keep historical response format
+    if (json_object_get_type(namesJ) == json_type_string) {
+        const char *pcmName = json_object_get_string(namesJ);
+        responseJ = pcmInfoOne(pcmName, pcmStream, mode, &errLabel);
+        if (!responseJ) {
+            afb_req_fail_f(request, errLabel, "PCM 'name:%s' fail to retrieve sndcard/hal info", pcmName);
+            goto OnErrorExit;
+        }
+        afb_req_success(request, responseJ, NULL);
+        return;
+    }
+
+    responseJ = json_object_new_array();
+    for (int idx = 0; idx < json_object_array_length(namesJ); idx++) {
+        const char *pcmName = json_object_get_string(json_object_array_get_idx(namesJ, idx));
+        json_object *pcmJ = pcmInfoOne(pcmName, pcmStream, mode, &errLabel);
+        if (!pcmJ) {
+            pcmJ = json_object_new_object();
+            json_object_object_add(pcmJ, "error", json_object_new_string(errLabel));
+        }
+        json_object_object_add(pcmJ, "pcm", json_object_new_string(pcmName));
+        json_object_array_add(responseJ, pcmJ);
+    }
+    afb_req_success(request, responseJ, NULL);
+
+OnErrorExit:
+    return;
+}
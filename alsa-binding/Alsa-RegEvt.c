@@ -20,10 +20,6 @@
 
 #include "Alsa-ApiHat.h"
 
-#ifndef MAX_SND_HAL
-#define MAX_SND_HAL 10
-#endif
-
 // generic sndctrl event handle hook to event callback when pooling
 
 typedef struct {
@@ -31,6 +27,7 @@ typedef struct {
     sd_event_source *src;
     snd_ctl_t *ctlDev;
     int mode;
+    int cardId;
     afb_event_t afbevt;
 } evtHandleT;
 
@@ -40,27 +37,6 @@ typedef struct {
     evtHandleT *evtHandle;
 } sndHandleT;
 
-typedef struct {
-    int  cardid;
-    char *devid;
-    char *apiprefix;
-    char *drivername;
-    char *shortname;
-    char *longname;
-} cardRegistryT;
-
-cardRegistryT *cardRegistry[MAX_SND_HAL + 1];
-
-STATIC int getHalIdxFromCardid (int cardid) {
-    
-    for (int idx = 0; idx < MAX_SND_HAL; idx++) {
-        if (!cardRegistry[idx]) return -1;
-        if (cardRegistry[idx]->cardid == cardid) return idx;
-    }
-    
-    return -1;
-}
-
 PUBLIC json_object *alsaCheckQuery(afb_req_t request, queryValuesT *queryValues) {
 
     json_object *tmpJ;
@@ -102,7 +78,9 @@ STATIC int sndCtlEventCB(sd_event_source* src, int fd, uint32_t revents, void* u
     snd_ctl_elem_id_t *elemId;
 
     if ((revents & EPOLLHUP) != 0) {
+        // handle is released by card-removed hotplug, stop polling a dead fd meanwhile
         AFB_NOTICE("SndCtl hanghup [car disconnected]");
+        sd_event_source_set_enabled(src, SD_EVENT_OFF);
         goto ExitOnSucess;
     }
 
@@ -118,13 +96,19 @@ STATIC int sndCtlEventCB(sd_event_source* src, int fd, uint32_t revents, void* u
         // we only process sndctrl element
         if (snd_ctl_event_get_type(eventId) != SND_CTL_EVENT_ELEM) goto ExitOnSucess;
 
-        // we only process value changed events
+        // control added/removed or metadata changed, cached catalog is obsolete
         mask = snd_ctl_event_elem_get_mask(eventId);
+        if (mask == SND_CTL_EVENT_MASK_REMOVE || (mask & (SND_CTL_EVENT_MASK_ADD | SND_CTL_EVENT_MASK_INFO | SND_CTL_EVENT_MASK_TLV))) {
+            alsaCardCacheInvalidate(evtHandle->cardId);
+        }
+        if (mask == SND_CTL_EVENT_MASK_REMOVE) goto ExitOnSucess;
+
+        // we only process value changed events
         if (!(mask & SND_CTL_EVENT_MASK_VALUE)) goto ExitOnSucess;
 
         snd_ctl_event_elem_get_id(eventId, elemId);
 
-        err = alsaGetSingleCtl(evtHandle->ctlDev, elemId, &ctlRequest, evtHandle->mode);
+        err = alsaGetSingleCtl(evtHandle->ctlDev, elemId, &ctlRequest, evtHandle->mode, NULL);
         if (err) goto OnErrorExit;
 
         // If CTL as a value use it as container for response
@@ -162,15 +146,113 @@ OnErrorExit:
     return (0);
 }
 
+static sndHandleT sndHandles[MAX_SND_CARD];
+
+// Open sndctl event source for a card and attach it to binder mainloop (return slot index)
+
+STATIC int evtHandleCreate(const char *devid, int cardId, int mode, const char **errLabel) {
+    evtHandleT *evtHandle;
+    int err, idx, idxFree = -1;
+
+    // search for an existing subscription and mark 1st free slot
+    for (idx = 0; idx < MAX_SND_CARD; idx++) {
+        if (sndHandles[idx].evtHandle && cardId == sndHandles[idx].cardId) return idx;
+        else if (!sndHandles[idx].evtHandle && idxFree == -1) idxFree = idx;
+    };
+
+    // reach MAX_SND_CARD event registration
+    if (idxFree == -1) {
+        *errLabel = "register-toomany";
+        goto OnErrorExit;
+    }
+
+    evtHandle = calloc(1, sizeof (evtHandleT));
+    evtHandle->mode = mode;
+    evtHandle->cardId = cardId;
+
+    err = snd_ctl_open(&evtHandle->ctlDev, devid, SND_CTL_READONLY);
+    if (err < 0) {
+        *errLabel = "devid-unknown";
+        goto OnFreeExit;
+    }
+
+    // subscribe for sndctl events attached to devid
+    err = snd_ctl_subscribe_events(evtHandle->ctlDev, 1);
+    if (err < 0) {
+        *errLabel = "subscribe-fail";
+        goto OnFreeExit;
+    }
+
+    // get pollfd attach to this sound board
+    snd_ctl_poll_descriptors(evtHandle->ctlDev, &evtHandle->pfds, 1);
+
+    // register sound event to binder main loop
+    err = sd_event_add_io(afb_daemon_get_event_loop(), &evtHandle->src, evtHandle->pfds.fd, EPOLLIN, sndCtlEventCB, evtHandle);
+    if (err < 0) {
+        *errLabel = "register-mainloop";
+        goto OnFreeExit;
+    }
+
+    // create binder event attached to devid name
+    evtHandle->afbevt = afb_daemon_make_event(devid);
+    if (!afb_event_is_valid(evtHandle->afbevt)) {
+        *errLabel = "register-event";
+        sd_event_source_unref(evtHandle->src);
+        goto OnFreeExit;
+    }
+
+    // everything looks OK let's move forward
+    sndHandles[idxFree].ucount = 0;
+    sndHandles[idxFree].cardId = cardId;
+    sndHandles[idxFree].evtHandle = evtHandle;
+    return idxFree;
+
+OnFreeExit:
+    if (evtHandle->ctlDev) snd_ctl_close(evtHandle->ctlDev);
+    free(evtHandle);
+OnErrorExit:
+    return -1;
+}
+
+// Release card event source when card is removed (subscribers are dropped with binder event)
+
+PUBLIC void alsaEvtDropCard(int cardId) {
+    for (int idx = 0; idx < MAX_SND_CARD; idx++) {
+        evtHandleT *evtHandle = sndHandles[idx].evtHandle;
+        if (!evtHandle || sndHandles[idx].cardId != cardId) continue;
+
+        sd_event_source_unref(evtHandle->src);
+        snd_ctl_close(evtHandle->ctlDev);
+        afb_event_unref(evtHandle->afbevt);
+        free(evtHandle);
+
+        sndHandles[idx].evtHandle = NULL;
+        sndHandles[idx].ucount = 0;
+    }
+}
+
+// Attach card event source at init, 1st subscribe only has to join binder event
+
+PUBLIC int alsaEvtPreload(int cardId) {
+    const char *errLabel = NULL;
+    char devid[32];
+
+    snprintf(devid, sizeof (devid), "hw:%i", cardId);
+    if (evtHandleCreate(devid, cardId, QUERY_QUIET, &errLabel) < 0) {
+        AFB_NOTICE("alsaEvtPreload: devid=%s fail error=%s", devid, errLabel);
+        return -1;
+    }
+    return 0;
+}
+
 // Subscribe to every Alsa CtlEvent send by a given board
 
 PUBLIC void alsaEvtSubcribe(afb_req_t request) {
-    static sndHandleT sndHandles[MAX_SND_CARD];
-    evtHandleT *evtHandle = NULL;
     snd_ctl_t *ctlDev = NULL;
-    int err, idx, cardId, idxFree = -1;
+    int err, idx, cardId;
     snd_ctl_card_info_t *cardinfo;
     queryValuesT queryValues;
+    const char *errLabel = NULL;
 
     json_object *queryJ = alsaCheckQuery(request, &queryValues);
     if (!queryJ) goto OnErrorExit;
@@ -190,60 +272,15 @@ PUBLIC void alsaEvtSubcribe(afb_req_t request) {
 
     cardId = snd_ctl_card_info_get_card(cardinfo);
 
-    // search for an existing subscription and mark 1st free slot
-    for (idx = 0; idx < MAX_SND_CARD; idx++) {
-        if (sndHandles[idx].ucount > 0 && cardId == sndHandles[idx].cardId) {
-            evtHandle = sndHandles[idx].evtHandle;
-            break;
-        } else if (idxFree == -1) idxFree = idx;
-    };
-
-    // if not subscription exist for the event let's create one
-    if (idx == MAX_SND_CARD) {
-
-        // reach MAX_SND_CARD event registration
-        if (idxFree == -1) {
-            afb_req_fail_f(request, "register-toomany", "Cannot register new event Maxcard==%d", idx);
-            goto OnErrorExit;
-        }
-
-        evtHandle = malloc(sizeof (evtHandleT));
-        evtHandle->ctlDev = ctlDev;
-        evtHandle->mode = queryValues.mode;
-        sndHandles[idxFree].ucount = 0;
-        sndHandles[idxFree].cardId = cardId;
-        sndHandles[idxFree].evtHandle = evtHandle;
-
-        // subscribe for sndctl events attached to devid
-        err = snd_ctl_subscribe_events(evtHandle->ctlDev, 1);
-        if (err < 0) {
-            afb_req_fail_f(request, "subscribe-fail", "Cannot subscribe events from devid=%s err=%d", queryValues.devid, err);
-            goto OnErrorExit;
-        }
-
-        // get pollfd attach to this sound board
-        snd_ctl_poll_descriptors(evtHandle->ctlDev, &evtHandle->pfds, 1);
-
-        // register sound event to binder main loop
-        err = sd_event_add_io(afb_daemon_get_event_loop(), &evtHandle->src, evtHandle->pfds.fd, EPOLLIN, sndCtlEventCB, evtHandle);
-        if (err < 0) {
-            afb_req_fail_f(request, "register-mainloop", "Cannot hook events to mainloop devid=%s err=%d", queryValues.devid, err);
-            goto OnErrorExit;
-        }
-
-        // create binder event attached to devid name
-        evtHandle->afbevt = afb_daemon_make_event(queryValues.devid);
-        if (!afb_event_is_valid(evtHandle->afbevt)) {
-            afb_req_fail_f(request, "register-event", "Cannot register new binder event name=%s", queryValues.devid);
-            goto OnErrorExit;
-        }
-
-        // everything looks OK let's move forward
-        idx = idxFree;
+    // reuse existing (or prewarmed) card event handle or create a new one
+    idx = evtHandleCreate(queryValues.devid, cardId, queryValues.mode, &errLabel);
+    if (idx < 0) {
+        afb_req_fail_f(request, errLabel, "Cannot register sndctl events devid=%s Maxcard==%d", queryValues.devid, MAX_SND_CARD);
+        goto OnErrorExit;
     }
 
     // subscribe to binder event
-    err = afb_req_subscribe(request, evtHandle->afbevt);
+    err = afb_req_subscribe(request, sndHandles[idx].evtHandle->afbevt);
     if (err != 0) {
         afb_req_fail_f(request, "register-eventname", "Cannot subscribe binder event name=%s [invalid channel]", queryValues.devid);
         goto OnErrorExit;
@@ -252,7 +289,6 @@ PUBLIC void alsaEvtSubcribe(afb_req_t request) {
     // increase usage count and return success
     sndHandles[idx].ucount++;
     afb_req_success(request, NULL, NULL);
-    return;
 
 OnErrorExit:
     if (ctlDev) snd_ctl_close(ctlDev);
@@ -261,13 +297,11 @@ OnErrorExit:
 
 // Subscribe to every Alsa CtlEvent send by a given board
 
-STATIC json_object *alsaProbeCardId(afb_req_t request) {
+PUBLIC json_object *alsaProbeCardId(afb_req_t request) {
     char devid [32];
-    const char *ctlName, *shortname, *longname, *mixername, *drivername;
-    int done, mode, card, err, index, idx;
+    int done, mode, card, idx;
     json_object *responseJ, *tmpJ;
-    snd_ctl_t *ctlDev;
-    snd_ctl_card_info_t *cardinfo;
+    cardInfoT cards[MAX_SND_CARD], info;
 
     json_object* queryJ = afb_req_json(request);
         
@@ -286,85 +320,52 @@ STATIC json_object *alsaProbeCardId(afb_req_t request) {
     }
     
 
-    // loop on potential card number
-    snd_ctl_card_info_alloca(&cardinfo);
-    char *driverId = NULL; // when not name match use drivername as backup plan
-    for (card = 0; card < MAX_SND_CARD; card++) {
-
-        // build card devid and probe it
-        snprintf(devid, sizeof (devid), "hw:%i", card);
-
-        // open control interface for devid
-        err = snd_ctl_open(&ctlDev, devid, SND_CTL_READONLY);
-        if (err < 0) continue;
-
-        // extract sound card information
-        snd_ctl_card_info(ctlDev, cardinfo);
-        index = snd_ctl_card_info_get_card(cardinfo);
-        ctlName = snd_ctl_card_info_get_id(cardinfo);
-        shortname = snd_ctl_card_info_get_name(cardinfo);
-        longname = snd_ctl_card_info_get_longname(cardinfo);
-        mixername  = snd_ctl_card_info_get_mixername(cardinfo);
-        drivername = snd_ctl_card_info_get_driver(cardinfo);
-
-        snd_ctl_close(ctlDev);
-        
-        // check if short|long name match
-        if (!strcasecmp(sndname, ctlName)) break;
-        if (!strcasecmp(sndname, shortname)) break;
-        
-        // if name does not match search for a free HAL with driver name matching
-        if (driverId==NULL && getHalIdxFromCardid(card)<0 && !strcasecmp(sndname, drivername)) driverId=strdup(devid);
-    }
+    // check if card id|short name match
+    card = alsaCardTableFind(sndname);
+
+    // if name does not match search for a free HAL with driver name matching
+    if (card < 0) {
+        int count = alsaCardTableList(cards, MAX_SND_CARD);
+        for (idx = 0; idx < count; idx++) {
+            if (!alsaHalCardBusy(cards[idx].cardId) && !strcasecmp(sndname, cards[idx].driver)) {
+                card = cards[idx].cardId;
+                break;
+            }
+        }
 
-    if (card == MAX_SND_CARD) {
-        if (!driverId) {
+        if (card < 0) {
             afb_req_fail_f(request, "ctlDev-notfound", "Fail to find card with name=%s", sndname);
             goto OnErrorExit;
-        } 
-                
-        // refresh devid and clean up driverId
-        strncpy (devid, driverId, sizeof(devid));       
-        free(driverId);
-        
-        err = snd_ctl_open(&ctlDev, devid, SND_CTL_READONLY);
-        if (err < 0) {
-            afb_req_fail_f(request, "ctlDev-notfound", "Fail to find card with name=%s devid=%s", sndname, devid);
-            goto OnErrorExit;
         }
+        AFB_WARNING("alsaProbeCardId Fallback to HAL=%s ==> devid=hw:%i name=%s long=%s\n ", cards[idx].driver, card, cards[idx].name, cards[idx].longname);
+    }
 
-        // Sound not found by name, backup to driver name
-        snd_ctl_card_info(ctlDev, cardinfo);
-        index = snd_ctl_card_info_get_card(cardinfo);
-        ctlName = snd_ctl_card_info_get_id(cardinfo);
-        shortname = snd_ctl_card_info_get_name(cardinfo);
-        longname = snd_ctl_card_info_get_longname(cardinfo);
-        mixername  = snd_ctl_card_info_get_mixername(cardinfo);
-        drivername = snd_ctl_card_info_get_driver(cardinfo);
-        AFB_WARNING("alsaProbeCardId Fallback to HAL=%s ==> devid=%s name=%s long=%s\n ", drivername, devid, shortname, longname);
-        snd_ctl_close(ctlDev);
+    if (alsaCardTableGet(card, &info) < 0) {
+        afb_req_fail_f(request, "ctlDev-notfound", "Fail to find card with name=%s devid=hw:%i", sndname, card);
+        goto OnErrorExit;
     }
+    snprintf(devid, sizeof (devid), "hw:%i", card);
+    const char *shortname = info.name;
 
     // proxy ctlevent as a binder event
     responseJ = json_object_new_object();
-    json_object_object_add(responseJ, "index", json_object_new_int(index));
+    json_object_object_add(responseJ, "index", json_object_new_int(info.cardId));
     json_object_object_add(responseJ, "cardid", json_object_new_int(card));
     json_object_object_add(responseJ, "devid", json_object_new_string(devid));
     json_object_object_add(responseJ, "shortname", json_object_new_string(shortname));
     
     if (mode > 0) {
-        json_object_object_add(responseJ, "longname", json_object_new_string(longname));
-        json_object_object_add(responseJ, "mixername", json_object_new_string(mixername));
-        json_object_object_add(responseJ, "drivername", json_object_new_string(drivername));
+        json_object_object_add(responseJ, "longname", json_object_new_string(info.longname));
+        json_object_object_add(responseJ, "mixername", json_object_new_string(info.mixername));
+        json_object_object_add(responseJ, "drivername", json_object_new_string(info.driver));
         
     }
 
     // search for a HAL binder card mapping name to api prefix
-    for (idx = 0; (idx < MAX_SND_HAL && cardRegistry[idx]); idx++) {
-        if (!strcmp(cardRegistry[idx]->shortname, shortname)) {
-            json_object_object_add(responseJ, "halapi", json_object_new_string(cardRegistry[idx]->apiprefix));
-            break;
-        }
+    char *halapi = alsaHalApiFromName(shortname);
+    if (halapi) {
+        json_object_object_add(responseJ, "halapi", json_object_new_string(halapi));
+        free(halapi);
     }
 
     return responseJ;
@@ -380,195 +381,3 @@ PUBLIC void alsaGetCardId(afb_req_t request) {
     json_object *responseJ = alsaProbeCardId(request);
     if (responseJ) afb_req_success(request, responseJ, NULL);
 }
-
-
-// Return HAL information about a given sound card ID
-
-STATIC int getHalApiFromCardid(int cardid, json_object *responseJ) {
-
-    
-    int idx = getHalIdxFromCardid (cardid);
-    if (idx < 0) goto OnErrorExit;
-    
-    json_object_object_add(responseJ, "api", json_object_new_string(cardRegistry[idx]->apiprefix));
-    if (cardRegistry[idx]->shortname)json_object_object_add(responseJ, "shortname", json_object_new_string(cardRegistry[idx]->shortname));
-    if (cardRegistry[idx]->longname) json_object_object_add(responseJ, "longname", json_object_new_string(cardRegistry[idx]->longname));
-
-    return 0;
-
-OnErrorExit:
-    return -1;
-}
-
-
-// Return list of active resgistrated HAL with corresponding sndcard
-
-PUBLIC void alsaActiveHal(afb_req_t request) {
-    json_object *responseJ = json_object_new_array();
-
-    for (int idx = 0; idx < MAX_SND_HAL; idx++) {
-        if (!cardRegistry[idx]) break;
-
-        json_object *haldevJ = json_object_new_object();
-        json_object_object_add(haldevJ, "api", json_object_new_string(cardRegistry[idx]->apiprefix));
-        if (cardRegistry[idx]->devid) json_object_object_add(haldevJ, "devid", json_object_new_string(cardRegistry[idx]->devid));
-        if (cardRegistry[idx]->shortname)json_object_object_add(haldevJ, "shortname", json_object_new_string(cardRegistry[idx]->shortname));
-        if (cardRegistry[idx]->drivername)json_object_object_add(haldevJ, "drivername", json_object_new_string(cardRegistry[idx]->drivername));
-        if (cardRegistry[idx]->longname) json_object_object_add(haldevJ, "longname", json_object_new_string(cardRegistry[idx]->longname));
-        json_object_array_add(responseJ, haldevJ);
-    }
-
-    afb_req_success(request, responseJ, NULL);
-}
-
-
-// Register loaded HAL with board Name and API prefix
-
-PUBLIC void alsaRegisterHal(afb_req_t request) {
-    static int index = 0;
-    json_object *responseJ;
-    const char *shortname, *apiPrefix;
-
-    apiPrefix = afb_req_value(request, "prefix");
-    if (apiPrefix == NULL) {
-        afb_req_fail_f(request, "argument-missing", "prefix=BindingApiPrefix missing");
-        goto OnErrorExit;
-    }
-
-    shortname = afb_req_value(request, "sndname");
-    if (shortname == NULL) {
-        afb_req_fail_f(request, "argument-missing", "sndname=SndCardName missing");
-        goto OnErrorExit;
-    }
-
-    if (index == MAX_SND_HAL) {
-        afb_req_fail_f(request, "alsahal-toomany", "Fail to register sndname=[%s]", shortname);
-        goto OnErrorExit;
-    }
-
-    // alsaGetCardId should be check to register only valid card
-    responseJ = alsaProbeCardId(request);
-    if (responseJ) {
-        json_object *tmpJ;
-        int done;
-
-        cardRegistry[index] = malloc(sizeof (cardRegistry));
-        cardRegistry[index]->apiprefix = strdup(apiPrefix);
-        cardRegistry[index]->shortname = strdup(shortname);
-        
-        json_object_object_get_ex(responseJ, "cardid", &tmpJ);
-        cardRegistry[index]->cardid = json_object_get_int(tmpJ);
-
-        done = json_object_object_get_ex(responseJ, "devid", &tmpJ);
-        if (done) cardRegistry[index]->devid = strdup(json_object_get_string(tmpJ));
-        else cardRegistry[index]->devid = NULL;
-
-        done = json_object_object_get_ex(responseJ, "drivername", &tmpJ);
-        if (done) cardRegistry[index]->drivername = strdup(json_object_get_string(tmpJ));
-        else cardRegistry[index]->drivername = NULL;
-
-        done = json_object_object_get_ex(responseJ, "longname", &tmpJ);
-        if (done) cardRegistry[index]->longname = strdup(json_object_get_string(tmpJ));
-        else cardRegistry[index]->longname = NULL;
-
-        // make sure register close with a null value
-        index++;
-        cardRegistry[index] = NULL;
-
-        afb_req_success(request, responseJ, NULL);
-    }
-
-    // If OK return sound card Alsa ID+Info
-    return;
-
-OnErrorExit:
-    return;
-}
-
-PUBLIC void alsaPcmInfo (afb_req_t request) {
-    int done, mode, err;
-    json_object *tmpJ, *responseJ = NULL;
-    snd_pcm_t *pcmHandle = NULL;
-    snd_pcm_info_t * pcmInfo = NULL;
-    
-    json_object* queryJ = afb_req_json(request);
-    
-    done = json_object_object_get_ex(queryJ, "name", &tmpJ);
-    if (!done || json_object_get_type(tmpJ) != json_type_string) {
-        afb_req_fail_f(request, "name:invalid", "PCM 'name:xxx' missing or not a string query='%s'", json_object_get_string(queryJ));
-        goto OnErrorExit;
-    }
-    const char *pcmName = json_object_get_string(tmpJ);
-    
-    done = json_object_object_get_ex(queryJ, "stream", &tmpJ);
-    if (done && json_object_get_type(tmpJ) != json_type_int) {
-        afb_req_fail_f(request, "stream:invalid", "PCM 'stream:SND_PCM_STREAM_PLAYBACK/SND_PCM_STREAM_CAPTURE' should be integer query='%s'", json_object_get_string(queryJ));
-        goto OnErrorExit;
-    }
-    snd_pcm_stream_t pcmStream = json_object_get_int(tmpJ);
-    
-    done = json_object_object_get_ex(queryJ, "mode", &tmpJ);
-    if (!done) {
-        mode = 0;
-    } else {
-        mode = json_object_get_int(tmpJ);        
-    }
-    
-    // open PCM from its name
-    err= snd_pcm_open(&pcmHandle, pcmName, pcmStream, 0);
-    if (err < 0) {
-        afb_req_fail_f(request, "pcm:invalid", "PCM 'name:%s' does cannot open error=%s", pcmName, snd_strerror(err));
-        goto OnErrorExit;
-    }
-    
-    // get pcm info
-    snd_pcm_info_alloca(&pcmInfo);      
-    err = snd_pcm_info(pcmHandle,pcmInfo);
-    if (err < 0)  {
-        afb_req_fail_f(request, "pcm:error", "PCM 'name:%s' fail to retrieve info error=%s", pcmName, snd_strerror(err));
-        goto OnErrorExit;
-    }
-
-    // get sub-device number
-    int cardId = snd_pcm_info_get_card(pcmInfo);
-    if (cardId < 0 )   {
-        afb_req_fail_f(request, "pcm:error", "PCM 'name:%s' fail to retrieve sndcard device error=%s", pcmName, snd_strerror(cardId));
-        goto OnErrorExit;
-    }
-    
-    // prepare an object for response
-    responseJ = json_object_new_object();
-    
-    err = getHalApiFromCardid (cardId, responseJ);
-    if (err < 0 )   {
-        afb_req_fail_f(request, "pcm:error", "PCM 'name:%s' snddev=hw:%d fail to retrieve hal API", pcmName, cardId);
-        goto OnErrorExit;
-    }
-
-    json_object_object_add(responseJ, "type", json_object_new_int(snd_pcm_type(pcmHandle)));
-
-    // in mode mode we return full info about PCM
-    if (mode > 0) {
-        json_object_object_add(responseJ, "stream", json_object_new_int(snd_pcm_info_get_stream (pcmInfo)));
-        json_object_object_add(responseJ, "cardid", json_object_new_int(snd_pcm_info_get_card(pcmInfo)));      
-        json_object_object_add(responseJ, "devid" , json_object_new_int(snd_pcm_info_get_device (pcmInfo)));     
-        json_object_object_add(responseJ, "subid" , json_object_new_int(snd_pcm_info_get_subdevice (pcmInfo)));     
-    }
-    
-    // in super mode we also return information about snd card
-    if (mode > 1) {
-        
-        json_object_object_add(responseJ, "id"     , json_object_new_string(snd_pcm_info_get_id (pcmInfo)));
-        json_object_object_add(responseJ, "name"   , json_object_new_string(snd_pcm_info_get_name (pcmInfo)));
-        json_object_object_add(responseJ, "subdev" , json_object_new_string(snd_pcm_info_get_subdevice_name (pcmInfo)));       
-    }
-    
-    afb_req_success(request, responseJ, NULL);
-    snd_pcm_close (pcmHandle);
-    return;
-    
-OnErrorExit:
-    if (responseJ) json_object_put (responseJ);
-    if (pcmHandle) snd_pcm_close (pcmHandle);
-    return;
-}
@@ -346,21 +346,55 @@ STATIC json_object *decodeTlv(unsigned int *tlv, unsigned int tlv_size, int mode
 }
 
 
+// pack card info as returned by infoget
+
+STATIC json_object* alsaCardInfoJson(cardInfoT *info) {
+    json_object *ctlDev;
+    char devid[6];
+
+    // start a new json object to store card info
+    ctlDev = json_object_new_object();
+
+    snprintf(devid, 6, "hw:%i", info->cardId);
+    json_object_object_add(ctlDev, "devid", json_object_new_string(devid));
+    json_object_object_add(ctlDev, "name", json_object_new_string(info->name));
+
+#if(AFB_BINDING_VERSION == 3)
+    if (afb_api_wants_log_level(afbBindingV3root, AFB_SYSLOG_LEVEL_NOTICE)) {
+#else
+    if (afb_get_verbosity() >= AFB_VERBOSITY_LEVEL_NOTICE) {
+#endif
+        json_object_object_add(ctlDev, "driver", json_object_new_string(info->driver));
+        json_object_object_add(ctlDev, "info", json_object_new_string(info->longname));
+        AFB_INFO("AJG: Soundcard devid=%-7s Name=%s\n", devid, info->longname);
+    }
+
+    return (ctlDev);
+}
+
 // retreive info for one given card
 
 STATIC json_object* alsaCardProbe(const char *rqt, InfoGetT infoType) {
-    const char *info, *name;
-    const char *driver;
-    char devid[6];
-    json_object *ctlDev;
+    cardInfoT info;
     snd_ctl_t *handle;
     snd_ctl_card_info_t *cardinfo;
-    int err, open_dev;
+    int err, open_dev, cardId;
 
+    memset(&info, 0, sizeof (info));
     snd_ctl_card_info_alloca(&cardinfo);
 
     switch(infoType) {
         case INFO_BY_DEVID:
+            // hw:N and hw:ID are served from card table
+            cardId = alsaCardIndex(rqt);
+            if (cardId >= 0) {
+                if (alsaCardTableGet(cardId, &info) < 0) {
+                    AFB_INFO("%s: '%s' Not Found", __func__, rqt);
+                    return NULL;
+                }
+                break;
+            }
+
             if((snd_ctl_open(&handle, rqt, 0)) < 0) {
                 AFB_INFO("%s: '%s' Not Found", __func__, rqt);
                 return NULL;
@@ -374,6 +408,7 @@ STATIC json_object* alsaCardProbe(const char *rqt, InfoGetT infoType) {
                 AFB_WARNING("%s: SndCard '%s' info error: %s", __func__, rqt, snd_strerror(err));
                 return NULL;
             }
+            alsaCardInfoFill(&info, cardinfo);
 
             break;
 
@@ -397,43 +432,21 @@ STATIC json_object* alsaCardProbe(const char *rqt, InfoGetT infoType) {
                 AFB_WARNING("%s: DevPath '%s' ioctl error: %i", __func__, rqt, err);
                 return NULL;
             }
+            alsaCardInfoFill(&info, cardinfo);
 
             break;
     }
 
-    // start a new json object to store card info
-    ctlDev = json_object_new_object();
-
-    snprintf(devid, 6, "hw:%i", snd_ctl_card_info_get_card(cardinfo));
-    json_object_object_add(ctlDev, "devid", json_object_new_string(devid));
-    name = snd_ctl_card_info_get_name(cardinfo);
-    json_object_object_add(ctlDev, "name", json_object_new_string(name));
-
-#if(AFB_BINDING_VERSION == 3)
-    if (afb_api_wants_log_level(afbBindingV3root, AFB_SYSLOG_LEVEL_NOTICE)) {
-#else
-    if (afb_get_verbosity() >= AFB_VERBOSITY_LEVEL_NOTICE) {
-#endif
-        driver = snd_ctl_card_info_get_driver(cardinfo);
-        json_object_object_add(ctlDev, "driver", json_object_new_string(driver));
-        info = strdup(snd_ctl_card_info_get_longname(cardinfo));
-        json_object_object_add(ctlDev, "info", json_object_new_string(info));
-        if(infoType == INFO_BY_DEVID)
-            AFB_INFO("AJG: Soundcard Devid=%-5s devid=%-7s Name=%s\n", rqt, devid, info);
-        else if(infoType == INFO_BY_DEVID)
-            AFB_INFO("AJG: Soundcard DevPath=%-5s devid=%-7s Name=%s\n", rqt, devid, info);
-    }
-
     // return info
-    return (ctlDev);
+    return alsaCardInfoJson(&info);
 }
 
-// Loop on every potential Sound card and register active one
+// Return every present sound card (from card table)
 
 PUBLIC void alsaGetInfo(afb_req_t request) {
-    int card;
+    cardInfoT infos[MAX_SND_CARD];
     json_object *ctlDev, *ctlDevs;
-    char devid[32];
+    int count;
 
     const char *rqtSndId = afb_req_value(request, "devid");
     const char *rqtDevPath = afb_req_value(request, "devpath");
@@ -457,18 +470,9 @@ PUBLIC void alsaGetInfo(afb_req_t request) {
         // return an array of ctlDev
         ctlDevs = json_object_new_array();
 
-        // loop on potential card number
-        for (card = 0; card < MAX_SND_CARD; card++) {
-
-            // build card devid and probe it
-            snprintf(devid, sizeof (devid), "hw:%i", card);
-            ctlDev = alsaCardProbe(devid, INFO_BY_DEVID);
-
-            // Alsa has hole within card list [ignore them]
-            if (ctlDev != NULL) {
-                // add current ctlDev to ctlDevs object
-                json_object_array_add(ctlDevs, ctlDev);
-            }
+        count = alsaCardTableList(infos, MAX_SND_CARD);
+        for (int idx = 0; idx < count; idx++) {
+            json_object_array_add(ctlDevs, alsaCardInfoJson(&infos[idx]));
         }
         afb_req_success(request, ctlDevs, NULL);
     }
@@ -501,30 +505,71 @@ STATIC json_object *getControlAcl(snd_ctl_elem_info_t *info) {
 
 // process ALSA control and store resulting value into ctlRequest
 
-PUBLIC int alsaSetSingleCtl(snd_ctl_t *ctlDev, snd_ctl_elem_id_t *elemId, ctlRequestT *ctlRequest) {
+PUBLIC int alsaSetSingleCtl(snd_ctl_t *ctlDev, snd_ctl_elem_id_t *elemId, ctlRequestT *ctlRequest, ctlEntryT *ctlEntry) {
     snd_ctl_elem_value_t *elemData;
     snd_ctl_elem_info_t *elemInfo;
-    int count, length, err, valueIsArray = 0;
+    snd_ctl_elem_type_t elemType;
+    int count, length, err, writable, valueIsArray = 0;
 
     // let's make sure we are processing the right control
     if (ctlRequest->numId != snd_ctl_elem_id_get_numid(elemId)) goto OnErrorExit;
 
-    // set info event ID and get value
-    snd_ctl_elem_info_alloca(&elemInfo);
-    snd_ctl_elem_info_set_id(elemInfo, elemId); // map ctlInfo to ctlId elemInfo is updated !!!
-    if (snd_ctl_elem_info(ctlDev, elemInfo) < 0) {
-        AFB_NOTICE("Fail to load ALSA NUMID=%d Values='%s'", ctlRequest->numId, json_object_get_string(ctlRequest->valuesJ));
-        goto OnErrorExit;
+    // when control is cataloged, metadata does not require an info request
+    if (ctlEntry) {
+        writable = (ctlEntry->acl & CTL_ACL_WRITE) != 0;
+        count = (int) ctlEntry->count;
+        elemType = ctlEntry->type;
+    } else {
+        snd_ctl_elem_info_alloca(&elemInfo);
+        snd_ctl_elem_info_set_id(elemInfo, elemId); // map ctlInfo to ctlId elemInfo is updated !!!
+        if (snd_ctl_elem_info(ctlDev, elemInfo) < 0) {
+            AFB_NOTICE("Fail to load ALSA NUMID=%d Values='%s'", ctlRequest->numId, json_object_get_string(ctlRequest->valuesJ));
+            goto OnErrorExit;
+        }
+        writable = snd_ctl_elem_info_is_writable(elemInfo);
+        count = snd_ctl_elem_info_get_count(elemInfo);
+        elemType = snd_ctl_elem_info_get_type(elemInfo);
     }
 
-    if (!snd_ctl_elem_info_is_writable(elemInfo)) {
+    if (!writable) {
         AFB_NOTICE("Not Writable ALSA NUMID=%d Values='%s'", ctlRequest->numId, json_object_get_string(ctlRequest->valuesJ));
         goto OnErrorExit;
     }
 
-    count = snd_ctl_elem_info_get_count(elemInfo);
     if (count == 0) goto OnErrorExit;
 
+    snd_ctl_elem_value_alloca(&elemData);
+    snd_ctl_elem_value_set_id(elemData, elemId); // map ctlInfo to ctlId elemInfo is updated !!!
+
+    // binary payloads are written in one pass from a base64 string
+    if (json_object_is_type(ctlRequest->valuesJ, json_type_string) && (elemType == SND_CTL_ELEM_TYPE_BYTES || elemType == SND_CTL_ELEM_TYPE_IEC958)) {
+        unsigned char *bytes;
+        ssize_t size = alsaBase64Decode(json_object_get_string(ctlRequest->valuesJ), &bytes);
+
+        if (size <= 0) {
+            AFB_NOTICE("Invalid base64 NUMID='%d' Values='%s'", ctlRequest->numId, json_object_get_string(ctlRequest->valuesJ));
+            free(bytes);
+            goto OnErrorExit;
+        }
+
+        if (elemType == SND_CTL_ELEM_TYPE_IEC958) {
+            snd_aes_iec958_t iec958;
+            memset(&iec958, 0, sizeof (iec958));
+            memcpy(iec958.status, bytes, (size_t) size < sizeof (iec958.status) ? (size_t) size : sizeof (iec958.status));
+            snd_ctl_elem_value_set_iec958(elemData, &iec958);
+        } else {
+            // shorter payload only overwrites its head
+            if (size < count && snd_ctl_elem_read(ctlDev, elemData) < 0) {
+                free(bytes);
+                goto OnErrorExit;
+            }
+            if (size > count) size = count;
+            for (int index = 0; index < size; index++) snd_ctl_elem_value_set_byte(elemData, index, bytes[index]);
+        }
+        free(bytes);
+        goto WriteValues;
+    }
+
     enum json_type jtype = json_object_get_type(ctlRequest->valuesJ);
     switch (jtype) {
         case json_type_array:
@@ -546,8 +591,6 @@ PUBLIC int alsaSetSingleCtl(snd_ctl_t *ctlDev, snd_ctl_elem_id_t *elemId, ctlReq
         goto OnErrorExit;
     }
 
-    snd_ctl_elem_value_alloca(&elemData);
-    snd_ctl_elem_value_set_id(elemData, elemId); // map ctlInfo to ctlId elemInfo is updated !!!
     if (snd_ctl_elem_read(ctlDev, elemData) < 0) goto OnErrorExit;
 
     // Loop on every control value and push to sndcard
@@ -562,10 +605,20 @@ PUBLIC int alsaSetSingleCtl(snd_ctl_t *ctlDev, snd_ctl_elem_id_t *elemId, ctlReq
             else element = json_object_array_get_idx(ctlRequest->valuesJ, length - 1);
         }
 
+        if (elemType == SND_CTL_ELEM_TYPE_INTEGER64) {
+            snd_ctl_elem_value_set_integer64(elemData, index, json_object_get_int64(element));
+            continue;
+        }
+        if (elemType == SND_CTL_ELEM_TYPE_BYTES) {
+            snd_ctl_elem_value_set_byte(elemData, index, (unsigned char) json_object_get_int(element));
+            continue;
+        }
+
         value = json_object_get_int(element);
         snd_ctl_elem_value_set_integer(elemData, index, value);
     }
 
+WriteValues:
     err = snd_ctl_elem_write(ctlDev, elemData);
     if (err < 0) {
         AFB_NOTICE("Fail to write ALSA NUMID=%d Values='%s' Error=%s", ctlRequest->numId, json_object_get_string(ctlRequest->valuesJ), snd_strerror(err));
@@ -582,36 +635,63 @@ OnErrorExit:
 
 // process ALSA control and store then into ctlRequest
 
-PUBLIC int alsaGetSingleCtl(snd_ctl_t *ctlDev, snd_ctl_elem_id_t *elemId, ctlRequestT *ctlRequest, queryModeE queryMode) {
+PUBLIC int alsaGetSingleCtl(snd_ctl_t *ctlDev, snd_ctl_elem_id_t *elemId, ctlRequestT *ctlRequest, queryModeE queryMode, ctlEntryT *ctlEntry) {
     snd_ctl_elem_type_t elemType;
     snd_ctl_elem_value_t *elemData;
     snd_ctl_elem_info_t *elemInfo;
-    int count, idx, err;
-
+    int count, idx, err, numid, readable;
 
-    // set info event ID and get value
+    // catalog metadata are only useful when enum+tlv were loaded
+    if (ctlEntry && !ctlEntry->enums && ctlEntry->type == SND_CTL_ELEM_TYPE_ENUMERATED) ctlEntry = NULL;
+    if (ctlEntry && !ctlEntry->tlv && (ctlEntry->acl & CTL_ACL_TLV_READ)) ctlEntry = NULL;
 
+    // set info event ID and get value, cached control only need info for dynamic flags
     snd_ctl_elem_info_alloca(&elemInfo);
-    snd_ctl_elem_info_set_id(elemInfo, elemId);
-    if (snd_ctl_elem_info(ctlDev, elemInfo) < 0) goto OnErrorExit;
-    count = snd_ctl_elem_info_get_count(elemInfo);
-    if (count == 0) goto OnErrorExit;
+    if (!ctlEntry || queryMode >= QUERY_FULL) {
+        snd_ctl_elem_info_set_id(elemInfo, elemId);
+        if (snd_ctl_elem_info(ctlDev, elemInfo) < 0) goto OnErrorExit;
+    }
 
-    if (!snd_ctl_elem_info_is_readable(elemInfo)) goto OnErrorExit;
-    elemType = snd_ctl_elem_info_get_type(elemInfo);
+    if (ctlEntry) {
+        count = (int) ctlEntry->count;
+        readable = (ctlEntry->acl & CTL_ACL_READ) != 0;
+        elemType = ctlEntry->type;
+        numid = (int) ctlEntry->numid;
+    } else {
+        count = snd_ctl_elem_info_get_count(elemInfo);
+        readable = snd_ctl_elem_info_is_readable(elemInfo);
+        elemType = snd_ctl_elem_info_get_type(elemInfo);
+        numid = snd_ctl_elem_info_get_numid(elemInfo);
+    }
+    if (count == 0) goto OnErrorExit;
+    if (!readable) goto OnErrorExit;
 
     snd_ctl_elem_value_alloca(&elemData);
     snd_ctl_elem_value_set_id(elemData, elemId);
     if (snd_ctl_elem_read(ctlDev, elemData) < 0) goto OnErrorExit;
 
-    int numid = snd_ctl_elem_info_get_numid(elemInfo);
-
     ctlRequest->valuesJ = json_object_new_object();
     json_object_object_add(ctlRequest->valuesJ, "id", json_object_new_int(numid));
-    if (queryMode >= 1) json_object_object_add(ctlRequest->valuesJ, "name", json_object_new_string(snd_ctl_elem_id_get_name(elemId)));
-    if (queryMode >= 2) json_object_object_add(ctlRequest->valuesJ, "iface", json_object_new_string(snd_ctl_elem_iface_name(snd_ctl_elem_id_get_interface(elemId))));
+    if (queryMode >= 1) json_object_object_add(ctlRequest->valuesJ, "name", json_object_new_string(ctlEntry ? ctlEntry->name : snd_ctl_elem_id_get_name(elemId)));
+    if (queryMode >= 2) json_object_object_add(ctlRequest->valuesJ, "iface", json_object_new_string(snd_ctl_elem_iface_name(ctlEntry ? ctlEntry->iface : snd_ctl_elem_id_get_interface(elemId))));
     if (queryMode >= 3) json_object_object_add(ctlRequest->valuesJ, "actif", json_object_new_boolean(!snd_ctl_elem_info_is_inactive(elemInfo)));
 
+    // binary payloads are returned in one base64 string (IEC958 as its 24 status bytes)
+    if (elemType == SND_CTL_ELEM_TYPE_BYTES || elemType == SND_CTL_ELEM_TYPE_IEC958) {
+        char *text;
+
+        if (elemType == SND_CTL_ELEM_TYPE_BYTES) {
+            text = alsaBase64Encode(snd_ctl_elem_value_get_bytes(elemData), (size_t) count);
+        } else {
+            snd_aes_iec958_t iec958;
+            snd_ctl_elem_value_get_iec958(elemData, &iec958);
+            text = alsaBase64Encode(iec958.status, sizeof (iec958.status));
+        }
+        json_object_object_add(ctlRequest->valuesJ, "val", json_object_new_string(text ? text : ""));
+        free(text);
+        goto ValuesDone;
+    }
+
     json_object *jsonValuesCtl = json_object_new_array();
     for (idx = 0; idx < count; idx++) { // start from one in amixer.c !!!
         switch (elemType) {
@@ -629,22 +709,6 @@ PUBLIC int alsaGetSingleCtl(snd_ctl_t *ctlDev, snd_ctl_elem_id_t *elemId, ctlReq
             case SND_CTL_ELEM_TYPE_ENUMERATED:
                 json_object_array_add(jsonValuesCtl, json_object_new_int(snd_ctl_elem_value_get_enumerated(elemData, idx)));
                 break;
-            case SND_CTL_ELEM_TYPE_BYTES:
-                json_object_array_add(jsonValuesCtl, json_object_new_int((int) snd_ctl_elem_value_get_byte(elemData, idx)));
-                break;
-            case SND_CTL_ELEM_TYPE_IEC958:
-            {
-                json_object *jsonIec958Ctl = json_object_new_object();
-                snd_aes_iec958_t iec958;
-                snd_ctl_elem_value_get_iec958(elemData, &iec958);
-
-                json_object_object_add(jsonIec958Ctl, "AES0", json_object_new_int(iec958.status[0]));
-                json_object_object_add(jsonIec958Ctl, "AES1", json_object_new_int(iec958.status[1]));
-                json_object_object_add(jsonIec958Ctl, "AES2", json_object_new_int(iec958.status[2]));
-                json_object_object_add(jsonIec958Ctl, "AES3", json_object_new_int(iec958.status[3]));
-                json_object_array_add(jsonValuesCtl, jsonIec958Ctl);
-                break;
-            }
             default:
                 json_object_array_add(jsonValuesCtl, json_object_new_string("?unknown?"));
                 break;
@@ -652,6 +716,8 @@ PUBLIC int alsaGetSingleCtl(snd_ctl_t *ctlDev, snd_ctl_elem_id_t *elemId, ctlReq
     }
     json_object_object_add(ctlRequest->valuesJ, "val", jsonValuesCtl);
 
+ValuesDone:
+
     if (queryMode >= 1) { // in simple mode do not print usable values
         json_object *jsonClassCtl = json_object_new_object();
         json_object_object_add(jsonClassCtl, "type", json_object_new_int(elemType));
@@ -659,24 +725,30 @@ PUBLIC int alsaGetSingleCtl(snd_ctl_t *ctlDev, snd_ctl_elem_id_t *elemId, ctlReq
 
         switch (elemType) {
             case SND_CTL_ELEM_TYPE_INTEGER:
-                json_object_object_add(jsonClassCtl, "min", json_object_new_int((int) snd_ctl_elem_info_get_min(elemInfo)));
-                json_object_object_add(jsonClassCtl, "max", json_object_new_int((int) snd_ctl_elem_info_get_max(elemInfo)));
-                json_object_object_add(jsonClassCtl, "step", json_object_new_int((int) snd_ctl_elem_info_get_step(elemInfo)));
+                json_object_object_add(jsonClassCtl, "min", json_object_new_int(ctlEntry ? (int) ctlEntry->min : (int) snd_ctl_elem_info_get_min(elemInfo)));
+                json_object_object_add(jsonClassCtl, "max", json_object_new_int(ctlEntry ? (int) ctlEntry->max : (int) snd_ctl_elem_info_get_max(elemInfo)));
+                json_object_object_add(jsonClassCtl, "step", json_object_new_int(ctlEntry ? (int) ctlEntry->step : (int) snd_ctl_elem_info_get_step(elemInfo)));
                 break;
             case SND_CTL_ELEM_TYPE_INTEGER64:
-                json_object_object_add(jsonClassCtl, "min", json_object_new_int64(snd_ctl_elem_info_get_min64(elemInfo)));
-                json_object_object_add(jsonClassCtl, "max", json_object_new_int64(snd_ctl_elem_info_get_max64(elemInfo)));
-                json_object_object_add(jsonClassCtl, "step", json_object_new_int64(snd_ctl_elem_info_get_step64(elemInfo)));
+                json_object_object_add(jsonClassCtl, "min", json_object_new_int64(ctlEntry ? ctlEntry->min : snd_ctl_elem_info_get_min64(elemInfo)));
+                json_object_object_add(jsonClassCtl, "max", json_object_new_int64(ctlEntry ? ctlEntry->max : snd_ctl_elem_info_get_max64(elemInfo)));
+                json_object_object_add(jsonClassCtl, "step", json_object_new_int64(ctlEntry ? ctlEntry->step : snd_ctl_elem_info_get_step64(elemInfo)));
                 break;
             case SND_CTL_ELEM_TYPE_ENUMERATED:
             {
-                unsigned int item, items = snd_ctl_elem_info_get_items(elemInfo);
                 json_object *jsonEnum = json_object_new_array();
 
-                for (item = 0; item < items; item++) {
-                    snd_ctl_elem_info_set_item(elemInfo, item);
-                    if ((err = snd_ctl_elem_info(ctlDev, elemInfo)) >= 0) {
-                        json_object_array_add(jsonEnum, json_object_new_string(snd_ctl_elem_info_get_item_name(elemInfo)));
+                if (ctlEntry) {
+                    for (unsigned int item = 0; item < ctlEntry->max; item++) {
+                        json_object_array_add(jsonEnum, json_object_new_string(ctlEntry->enums[item]));
+                    }
+                } else {
+                    unsigned int item, items = snd_ctl_elem_info_get_items(elemInfo);
+                    for (item = 0; item < items; item++) {
+                        snd_ctl_elem_info_set_item(elemInfo, item);
+                        if ((err = snd_ctl_elem_info(ctlDev, elemInfo)) >= 0) {
+                            json_object_array_add(jsonEnum, json_object_new_string(snd_ctl_elem_info_get_item_name(elemInfo)));
+                        }
                     }
                 }
                 json_object_object_add(jsonClassCtl, "enums", jsonEnum);
@@ -691,9 +763,11 @@ PUBLIC int alsaGetSingleCtl(snd_ctl_t *ctlDev, snd_ctl_elem_id_t *elemId, ctlReq
         if (queryMode >= QUERY_FULL) json_object_object_add(ctlRequest->valuesJ, "acl", getControlAcl(elemInfo));
 
         // check for tlv [direct port from amixer.c]
-        if (snd_ctl_elem_info_is_tlv_readable(elemInfo)) {
+        if (ctlEntry) {
+            if (ctlEntry->tlv) json_object_object_add(ctlRequest->valuesJ, "tlv", decodeTlv(ctlEntry->tlv, ctlEntry->tlvSize, queryMode));
+        } else if (snd_ctl_elem_info_is_tlv_readable(elemInfo)) {
             unsigned int *tlv = alloca(TLV_BYTE_SIZE);
-            if ((err = snd_ctl_elem_tlv_read(ctlDev, elemId, tlv, 4096)) < 0) {
+            if ((err = snd_ctl_elem_tlv_read(ctlDev, elemId, tlv, TLV_BYTE_SIZE)) < 0) {
                 AFB_NOTICE("Control numid=%d err=%s element TLV read error\n", numid, snd_strerror(err));
                 goto OnErrorExit;
             } else {
@@ -719,6 +793,7 @@ STATIC void alsaSetGetCtls(ActionSetGetT action, afb_req_t request) {
     unsigned int ctlCount;
     snd_ctl_t *ctlDev=NULL;
     snd_ctl_elem_list_t *ctlList;
+    ctlCatalogT *catalog = NULL;
     queryValuesT queryValues;
     json_object *queryJ, *numidsJ, *sndctls;
 
@@ -770,6 +845,14 @@ STATIC void alsaSetGetCtls(ActionSetGetT action, afb_req_t request) {
         goto OnErrorExit;
     }
 
+    // use cached catalog when it still matches control list
+    catalog = alsaCardCatalogGet(alsaCardIndex(queryValues.devid));
+    if (catalog && !alsaCatalogMatch(catalog, ctlList)) {
+        alsaCardCacheInvalidate(catalog->cardId);
+        alsaCardCatalogRelease(catalog);
+        catalog = NULL;
+    }
+
     // Parse numids string (empty == all)
     ctlCount = snd_ctl_elem_list_get_used(ctlList);
     if (queryValues.count == 0) {
@@ -819,14 +902,17 @@ STATIC void alsaSetGetCtls(ActionSetGetT action, afb_req_t request) {
             snd_ctl_elem_id_t *elemId;
             snd_ctl_elem_id_alloca(&elemId);
 
+            // catalog matches control list, entries share the same index
+            ctlEntryT *ctlEntry = catalog ? &catalog->ctls[ctlIndex] : NULL;
+
             snd_ctl_elem_list_get_id(ctlList, ctlIndex, elemId);
             switch (action) {
                 case ACTION_GET:
-                    err = alsaGetSingleCtl(ctlDev, elemId, &ctlRequest[jdx], queryValues.mode);
+                    err = alsaGetSingleCtl(ctlDev, elemId, &ctlRequest[jdx], queryValues.mode, ctlEntry);
                     break;
 
                 case ACTION_SET:
-                    err = alsaSetSingleCtl(ctlDev, elemId, &ctlRequest[jdx]);
+                    err = alsaSetSingleCtl(ctlDev, elemId, &ctlRequest[jdx], ctlEntry);
                     break;
 
                 default:
@@ -873,6 +959,7 @@ STATIC void alsaSetGetCtls(ActionSetGetT action, afb_req_t request) {
     // use OnErrorExit
 
 OnErrorExit:
+    alsaCardCatalogRelease(catalog);
     if (ctlDev) snd_ctl_close(ctlDev);
     return;
 }
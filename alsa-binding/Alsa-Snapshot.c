@@ -0,0 +1,569 @@
+/*
+ * AlsaSnapshot -- save/restore mixer state from a compact binary snapshot
+ * Copyright (C) 2015,2016,2017, Fulup Ar Foll fulup@iot.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * File layout (host endianness, every block is 8 bytes aligned)
+ *   snapHeaderT
+ *   snapCardT + [snapCtlT + values] * snapCardT.ctls   (repeated snapHeaderT.cards times)
+ *
+ * Values are stored as int64 for boolean/integer/enumerated/integer64 and as raw bytes for bytes controls.
+ * Cards are matched by Alsa card id and driver, controls by element ID (iface,name,index,device,subdevice).
+ */
+
+#define _GNU_SOURCE  // needed for vasprintf
+
+#include <stdint.h>
+#include <pthread.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Alsa-ApiHat.h"
+
+#define SNAPSHOT_MAGIC   0x50414e53  // "SNAP"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_ALIGN(size) (((size) + 7) & ~((size_t)7))
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t cards;
+    uint32_t size;
+    uint32_t reserved;
+} snapHeaderT;
+
+typedef struct {
+    char id[16];
+    char driver[16];
+    uint32_t ctls;
+    uint32_t size;
+} snapCardT;
+
+typedef struct {
+    char name[CTL_NAME_MAXLEN];
+    uint32_t iface;
+    uint32_t device;
+    uint32_t subdevice;
+    uint32_t index;
+    uint32_t type;
+    uint32_t count;
+    uint32_t size;
+    int64_t min;
+    int64_t max;
+} snapCtlT;
+
+typedef struct {
+    char *data;
+    size_t used;
+    size_t size;
+} snapBufferT;
+
+typedef struct {
+    const snapCardT *card;
+    pthread_t tid;
+    int joinable;
+    int cardId;
+    int status;
+    int written;
+    int unchanged;
+    int skipped;
+    uint64_t usec;
+} snapJobT;
+
+STATIC uint64_t snapNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+}
+
+STATIC const char *snapPath(void) {
+    const char *path = getenv("ALSACORE_SNAPSHOT");
+    if (path) return path;
+    return ALSA_SNAPSHOT_PATH;
+}
+
+// clients may only name the configured snapshot, alsacore never reads/writes a client chosen file
+
+STATIC const char *snapRequestPath(afb_req_t request) {
+    const char *path = snapPath();
+    const char *requested = afb_req_value(request, "path");
+
+    if (requested && strcmp(requested, path)) {
+        afb_req_fail_f(request, "snapshot-path", "path=%s refused, only ALSACORE_SNAPSHOT=%s is allowed", requested, path);
+        return NULL;
+    }
+    return path;
+}
+
+// number of bytes needed to store control values (0 when type is not supported)
+
+STATIC size_t snapValueSize(snd_ctl_elem_type_t type, unsigned int count) {
+    switch (type) {
+        case SND_CTL_ELEM_TYPE_BOOLEAN:
+        case SND_CTL_ELEM_TYPE_INTEGER:
+        case SND_CTL_ELEM_TYPE_ENUMERATED:
+        case SND_CTL_ELEM_TYPE_INTEGER64:
+            return count * sizeof (int64_t);
+        case SND_CTL_ELEM_TYPE_BYTES:
+            return SNAPSHOT_ALIGN(count);
+        default:
+            return 0;
+    }
+}
+
+STATIC void snapValueEncode(snd_ctl_elem_value_t *elemValue, snd_ctl_elem_type_t type, unsigned int count, void *payload) {
+    int64_t *values = (int64_t*) payload;
+
+    for (unsigned int idx = 0; idx < count; idx++) {
+        switch (type) {
+            case SND_CTL_ELEM_TYPE_BOOLEAN:
+                values[idx] = snd_ctl_elem_value_get_boolean(elemValue, idx);
+                break;
+            case SND_CTL_ELEM_TYPE_INTEGER:
+                values[idx] = snd_ctl_elem_value_get_integer(elemValue, idx);
+                break;
+            case SND_CTL_ELEM_TYPE_ENUMERATED:
+                values[idx] = snd_ctl_elem_value_get_enumerated(elemValue, idx);
+                break;
+            case SND_CTL_ELEM_TYPE_INTEGER64:
+                values[idx] = snd_ctl_elem_value_get_integer64(elemValue, idx);
+                break;
+            case SND_CTL_ELEM_TYPE_BYTES:
+                ((unsigned char*) payload)[idx] = snd_ctl_elem_value_get_byte(elemValue, idx);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+STATIC void snapValueDecode(snd_ctl_elem_value_t *elemValue, snd_ctl_elem_type_t type, unsigned int count, const void *payload) {
+    const int64_t *values = (const int64_t*) payload;
+
+    for (unsigned int idx = 0; idx < count; idx++) {
+        switch (type) {
+            case SND_CTL_ELEM_TYPE_BOOLEAN:
+                snd_ctl_elem_value_set_boolean(elemValue, idx, (long) values[idx]);
+                break;
+            case SND_CTL_ELEM_TYPE_INTEGER:
+                snd_ctl_elem_value_set_integer(elemValue, idx, (long) values[idx]);
+                break;
+            case SND_CTL_ELEM_TYPE_ENUMERATED:
+                snd_ctl_elem_value_set_enumerated(elemValue, idx, (unsigned int) values[idx]);
+                break;
+            case SND_CTL_ELEM_TYPE_INTEGER64:
+                snd_ctl_elem_value_set_integer64(elemValue, idx, values[idx]);
+                break;
+            case SND_CTL_ELEM_TYPE_BYTES:
+                snd_ctl_elem_value_set_byte(elemValue, idx, ((const unsigned char*) payload)[idx]);
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+// reserve a zeroed block at buffer end and return its offset (buffer may move)
+
+STATIC size_t snapBufferAppend(snapBufferT *buffer, size_t len) {
+    size_t offset = buffer->used;
+
+    len = SNAPSHOT_ALIGN(len);
+    if (buffer->used + len > buffer->size) {
+        buffer->size = (buffer->used + len) * 2;
+        buffer->data = realloc(buffer->data, buffer->size);
+    }
+    memset(&buffer->data[offset], 0, len);
+    buffer->used += len;
+    return offset;
+}
+
+// append every readable+writable control of one card to snapshot buffer
+
+STATIC int snapSaveCard(snapBufferT *buffer, int cardId) {
+    char devid[32];
+    snd_ctl_t *ctlDev = NULL;
+    snd_ctl_card_info_t *cardinfo;
+    snd_ctl_elem_id_t *elemId;
+    snd_ctl_elem_value_t *elemValue;
+    ctlCatalogT *catalog = NULL;
+    size_t cardOffset;
+    uint32_t ctls = 0;
+    int err;
+
+    snprintf(devid, sizeof (devid), "hw:%i", cardId);
+    if ((err = snd_ctl_open(&ctlDev, devid, SND_CTL_READONLY)) < 0) {
+        AFB_WARNING("snapSaveCard: devid=%s open error=%s", devid, snd_strerror(err));
+        goto OnErrorExit;
+    }
+
+    snd_ctl_card_info_alloca(&cardinfo);
+    if ((err = snd_ctl_card_info(ctlDev, cardinfo)) < 0) goto OnErrorExit;
+
+    catalog = alsaCatalogBuild(ctlDev, 0);
+    if (!catalog) goto OnErrorExit;
+
+    cardOffset = snapBufferAppend(buffer, sizeof (snapCardT));
+    snapCardT *card = (snapCardT*) &buffer->data[cardOffset];
+    strncpy(card->id, snd_ctl_card_info_get_id(cardinfo), sizeof (card->id) - 1);
+    strncpy(card->driver, snd_ctl_card_info_get_driver(cardinfo), sizeof (card->driver) - 1);
+
+    snd_ctl_elem_id_alloca(&elemId);
+    snd_ctl_elem_value_alloca(&elemValue);
+
+    for (unsigned int idx = 0; idx < catalog->count; idx++) {
+        ctlEntryT *ctl = &catalog->ctls[idx];
+        size_t size = snapValueSize(ctl->type, ctl->count);
+
+        // volatile controls are driven by hardware and have no state to restore
+        if (!(ctl->acl & CTL_ACL_READ) || !(ctl->acl & CTL_ACL_WRITE) || (ctl->acl & CTL_ACL_VOLATILE) || !size) continue;
+
+        alsaCatalogSetId(ctl, elemId);
+        snd_ctl_elem_value_set_id(elemValue, elemId);
+        if (snd_ctl_elem_read(ctlDev, elemValue) < 0) continue;
+
+        size_t ctlOffset = snapBufferAppend(buffer, sizeof (snapCtlT) + size);
+        snapCtlT *record = (snapCtlT*) &buffer->data[ctlOffset];
+        strncpy(record->name, ctl->name, sizeof (record->name) - 1);
+        record->iface = ctl->iface;
+        record->device = ctl->device;
+        record->subdevice = ctl->subdevice;
+        record->index = ctl->index;
+        record->type = ctl->type;
+        record->count = ctl->count;
+        record->size = (uint32_t) size;
+        record->min = ctl->min;
+        record->max = ctl->max;
+        snapValueEncode(elemValue, ctl->type, ctl->count, &record[1]);
+        ctls++;
+    }
+
+    card = (snapCardT*) &buffer->data[cardOffset];
+    card->ctls = ctls;
+    card->size = (uint32_t) (buffer->used - cardOffset - sizeof (snapCardT));
+
+    alsaCatalogFree(catalog);
+    snd_ctl_close(ctlDev);
+    return (int) ctls;
+
+OnErrorExit:
+    alsaCatalogFree(catalog);
+    if (ctlDev) snd_ctl_close(ctlDev);
+    return -1;
+}
+
+// Restore one card section, runs in its own thread
+
+STATIC void *snapRestoreCard(void *handle) {
+    snapJobT *job = (snapJobT*) handle;
+    const snapCardT *card = job->card;
+    char devid[32], cardid[sizeof (card->id) + 1], driver[sizeof (card->driver) + 1];
+    snd_ctl_t *ctlDev = NULL;
+    snd_ctl_card_info_t *cardinfo;
+    snd_ctl_elem_id_t *elemId;
+    snd_ctl_elem_value_t *elemValue;
+    ctlCatalogT *catalog = NULL;
+    unsigned int hint = 0;
+    void *current = NULL;
+    size_t currentSize = 0;
+    int err;
+
+    uint64_t start = snapNow();
+    job->status = -1;
+
+    // card id is not NULL terminated when using the full 16 bytes
+    memcpy(cardid, card->id, sizeof (card->id));
+    cardid[sizeof (card->id)] = '\0';
+    memcpy(driver, card->driver, sizeof (card->driver));
+    driver[sizeof (card->driver)] = '\0';
+
+    job->cardId = snd_card_get_index(cardid);
+    if (job->cardId < 0) {
+        AFB_NOTICE("snapRestoreCard: card=%s not present", cardid);
+        goto OnErrorExit;
+    }
+
+    snprintf(devid, sizeof (devid), "hw:%i", job->cardId);
+    if ((err = snd_ctl_open(&ctlDev, devid, 0)) < 0) {
+        AFB_WARNING("snapRestoreCard: devid=%s open error=%s", devid, snd_strerror(err));
+        goto OnErrorExit;
+    }
+
+    snd_ctl_card_info_alloca(&cardinfo);
+    if (snd_ctl_card_info(ctlDev, cardinfo) < 0) goto OnErrorExit;
+    if (strcmp(driver, snd_ctl_card_info_get_driver(cardinfo))) {
+        AFB_WARNING("snapRestoreCard: card=%s driver changed [%s]!=[%s] ignored", cardid, driver, snd_ctl_card_info_get_driver(cardinfo));
+        goto OnErrorExit;
+    }
+
+    catalog = alsaCatalogBuild(ctlDev, 0);
+    if (!catalog) goto OnErrorExit;
+
+    snd_ctl_elem_id_alloca(&elemId);
+    snd_ctl_elem_value_alloca(&elemValue);
+
+    // records were checked against file size before thread launch
+    const char *record = (const char*) &card[1];
+    for (uint32_t idx = 0; idx < card->ctls; idx++) {
+        const snapCtlT *snapCtl = (const snapCtlT*) record;
+        const void *payload = &snapCtl[1];
+        char name[CTL_NAME_MAXLEN + 1];
+
+        record += sizeof (snapCtlT) + snapCtl->size;
+        memcpy(name, snapCtl->name, CTL_NAME_MAXLEN);
+        name[CTL_NAME_MAXLEN] = '\0';
+
+        // skip any control which does not exist anymore or changed its metadata
+        ctlEntryT *ctl = alsaCatalogSearch(catalog, snapCtl->iface, name, snapCtl->index, snapCtl->device, snapCtl->subdevice, &hint);
+        if (!ctl || !(ctl->acl & CTL_ACL_WRITE) || ctl->type != snapCtl->type || ctl->count != snapCtl->count
+                || ctl->min != snapCtl->min || ctl->max != snapCtl->max || snapValueSize(ctl->type, ctl->count) != snapCtl->size) {
+            AFB_DEBUG("snapRestoreCard: card=%s ctl=%s metadata changed ignored", cardid, name);
+            job->skipped++;
+            continue;
+        }
+
+        alsaCatalogSetId(ctl, elemId);
+        snd_ctl_elem_value_set_id(elemValue, elemId);
+        if (snd_ctl_elem_read(ctlDev, elemValue) < 0) {
+            job->skipped++;
+            continue;
+        }
+
+        // only write controls whose current value differs from snapshot
+        if (snapCtl->size > currentSize) {
+            currentSize = snapCtl->size;
+            current = realloc(current, currentSize);
+        }
+        memset(current, 0, snapCtl->size);
+        snapValueEncode(elemValue, ctl->type, ctl->count, current);
+        if (!memcmp(current, payload, snapCtl->size)) {
+            job->unchanged++;
+            continue;
+        }
+
+        snapValueDecode(elemValue, ctl->type, ctl->count, payload);
+        if ((err = snd_ctl_elem_write(ctlDev, elemValue)) < 0) {
+            AFB_NOTICE("snapRestoreCard: card=%s ctl=%s write error=%s", cardid, name, snd_strerror(err));
+            job->skipped++;
+            continue;
+        }
+        job->written++;
+    }
+
+    job->status = 0;
+
+OnErrorExit:
+    free(current);
+    alsaCatalogFree(catalog);
+    if (ctlDev) snd_ctl_close(ctlDev);
+    job->usec = snapNow() - start;
+    return NULL;
+}
+
+// check every card section fits within mapped file before handing them to worker threads
+
+STATIC int snapCheckCards(const char *data, size_t size, const snapCardT **cards, int count) {
+    size_t offset = sizeof (snapHeaderT);
+
+    for (int idx = 0; idx < count; idx++) {
+        if (offset + sizeof (snapCardT) > size) goto OnErrorExit;
+        const snapCardT *card = (const snapCardT*) &data[offset];
+        offset += sizeof (snapCardT);
+
+        size_t end = offset + card->size;
+        if (end > size) goto OnErrorExit;
+
+        size_t record = offset;
+        for (uint32_t jdx = 0; jdx < card->ctls; jdx++) {
+            if (record + sizeof (snapCtlT) > end) goto OnErrorExit;
+            const snapCtlT *snapCtl = (const snapCtlT*) &data[record];
+            if (snapCtl->size != SNAPSHOT_ALIGN(snapCtl->size)) goto OnErrorExit;
+            if (snapValueSize(snapCtl->type, snapCtl->count) != snapCtl->size) goto OnErrorExit;
+            record += sizeof (snapCtlT) + snapCtl->size;
+            if (record > end) goto OnErrorExit;
+        }
+
+        cards[idx] = card;
+        offset = end;
+    }
+    return 0;
+
+OnErrorExit:
+    return -1;
+}
+
+// Restore every card present in snapshot file, one thread per card
+
+STATIC json_object *snapRestoreFile(const char *path) {
+    int fd = -1;
+    struct stat fstatus;
+    void *data = MAP_FAILED;
+    json_object *responseJ = NULL;
+    uint64_t start = snapNow();
+
+    fd = open(path, O_RDONLY);
+    if (fd < 0 || fstat(fd, &fstatus) < 0) {
+        AFB_NOTICE("snapRestoreFile: path=%s cannot open error=%s", path, strerror(errno));
+        goto OnErrorExit;
+    }
+
+    if ((size_t) fstatus.st_size < sizeof (snapHeaderT)) goto OnInvalidExit;
+
+    data = mmap(NULL, (size_t) fstatus.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        AFB_WARNING("snapRestoreFile: path=%s mmap error=%s", path, strerror(errno));
+        goto OnErrorExit;
+    }
+
+    const snapHeaderT *header = (const snapHeaderT*) data;
+    if (header->magic != SNAPSHOT_MAGIC || header->version != SNAPSHOT_VERSION || header->size != (uint32_t) fstatus.st_size) goto OnInvalidExit;
+
+    // card count sizes stack arrays and restore threads, never trust more than the system can hold
+    if (header->cards > MAX_SND_CARD) goto OnInvalidExit;
+
+    const snapCardT **cards = alloca(sizeof (snapCardT*) * (header->cards + 1));
+    if (snapCheckCards(data, (size_t) fstatus.st_size, cards, header->cards) < 0) goto OnInvalidExit;
+
+    snapJobT *jobs = alloca(sizeof (snapJobT) * (header->cards + 1));
+    memset(jobs, 0, sizeof (snapJobT) * (header->cards + 1));
+    for (int idx = 0; idx < header->cards; idx++) {
+        jobs[idx].card = cards[idx];
+        if (pthread_create(&jobs[idx].tid, NULL, snapRestoreCard, &jobs[idx]) == 0) jobs[idx].joinable = 1;
+        else snapRestoreCard(&jobs[idx]); // no thread left, restore this card from current context
+    }
+
+    responseJ = json_object_new_array();
+    for (int idx = 0; idx < header->cards; idx++) {
+        if (jobs[idx].joinable) pthread_join(jobs[idx].tid, NULL);
+
+        json_object *cardJ = json_object_new_object();
+        json_object_object_add(cardJ, "card", json_object_new_string_len(cards[idx]->id, (int) strnlen(cards[idx]->id, sizeof (cards[idx]->id))));
+        json_object_object_add(cardJ, "status", json_object_new_int(jobs[idx].status));
+        json_object_object_add(cardJ, "written", json_object_new_int(jobs[idx].written));
+        json_object_object_add(cardJ, "unchanged", json_object_new_int(jobs[idx].unchanged));
+        json_object_object_add(cardJ, "skipped", json_object_new_int(jobs[idx].skipped));
+        json_object_object_add(cardJ, "usec", json_object_new_int64((int64_t) jobs[idx].usec));
+        json_object_array_add(responseJ, cardJ);
+
+        AFB_NOTICE("snapRestoreFile: card=%.16s written=%d unchanged=%d skipped=%d in %lluus", cards[idx]->id
+                , jobs[idx].written, jobs[idx].unchanged, jobs[idx].skipped, (unsigned long long) jobs[idx].usec);
+    }
+
+    AFB_NOTICE("snapRestoreFile: path=%s cards=%d restored in %lluus", path, header->cards, (unsigned long long) (snapNow() - start));
+    munmap(data, (size_t) fstatus.st_size);
+    close(fd);
+    return responseJ;
+
+OnInvalidExit:
+    AFB_WARNING("snapRestoreFile: path=%s invalid or unsupported snapshot version", path);
+OnErrorExit:
+    if (data != MAP_FAILED) munmap(data, (size_t) fstatus.st_size);
+    if (fd >= 0) close(fd);
+    return NULL;
+}
+
+// Save state of every present sound card into snapshot file
+
+PUBLIC void alsaSnapshotSave(afb_req_t request) {
+    snapBufferT buffer = {NULL, 0, 0};
+    char *tmpPath = NULL;
+    FILE *file = NULL;
+    int card = -1, cards = 0, ctls = 0, count;
+
+    const char *path = snapRequestPath(request);
+    if (!path) return;
+
+    snapBufferAppend(&buffer, sizeof (snapHeaderT));
+    while (snd_card_next(&card) == 0 && card >= 0) {
+        count = snapSaveCard(&buffer, card);
+        if (count < 0) continue;
+        ctls += count;
+        cards++;
+    }
+
+    snapHeaderT *header = (snapHeaderT*) buffer.data;
+    header->magic = SNAPSHOT_MAGIC;
+    header->version = SNAPSHOT_VERSION;
+    header->cards = (uint16_t) cards;
+    header->size = (uint32_t) buffer.used;
+
+    // write into a temporary file and rename it, to never leave a truncated snapshot
+    if (asprintf(&tmpPath, "%s.tmp", path) < 0) {
+        tmpPath = NULL;
+        afb_req_fail_f(request, "snapshot-alloc", "path=%s fail to allocate tmp name", path);
+        goto OnErrorExit;
+    }
+
+    file = fopen(tmpPath, "w");
+    if (!file || fwrite(buffer.data, buffer.used, 1, file) != 1) {
+        afb_req_fail_f(request, "snapshot-write", "path=%s write error=%s", tmpPath, strerror(errno));
+        goto OnErrorExit;
+    }
+
+    if (fclose(file) != 0 || rename(tmpPath, path) < 0) {
+        file = NULL;
+        afb_req_fail_f(request, "snapshot-rename", "path=%s rename error=%s", path, strerror(errno));
+        unlink(tmpPath);
+        goto OnErrorExit;
+    }
+    file = NULL;
+
+    json_object *responseJ = json_object_new_object();
+    json_object_object_add(responseJ, "path", json_object_new_string(path));
+    json_object_object_add(responseJ, "cards", json_object_new_int(cards));
+    json_object_object_add(responseJ, "ctls", json_object_new_int(ctls));
+    json_object_object_add(responseJ, "size", json_object_new_int((int) buffer.used));
+    afb_req_success(request, responseJ, NULL);
+
+OnErrorExit:
+    if (file) {
+        fclose(file);
+        unlink(tmpPath);
+    }
+    free(tmpPath);
+    free(buffer.data);
+    return;
+}
+
+PUBLIC void alsaSnapshotRestore(afb_req_t request) {
+
+    const char *path = snapRequestPath(request);
+    if (!path) return;
+
+    json_object *responseJ = snapRestoreFile(path);
+    if (!responseJ) {
+        afb_req_fail_f(request, "snapshot-invalid", "path=%s missing or invalid snapshot", path);
+        return;
+    }
+
+    afb_req_success(request, responseJ, NULL);
+}
+
+// Called at binding init, a missing snapshot is not an error
+
+PUBLIC int alsaSnapshotInit(void) {
+    const char *path = snapPath();
+
+    if (access(path, R_OK) < 0) {
+        AFB_NOTICE("alsaSnapshotInit: no mixer snapshot path=%s", path);
+        return 0;
+    }
+
+    json_object *responseJ = snapRestoreFile(path);
+    if (!responseJ) return -1;
+
+    json_object_put(responseJ);
+    return 0;
+}
@@ -0,0 +1,280 @@
+/*
+ * AlsaTlvWrite -- chunked TLV upload (DSP coefficients) on TLV writable/commandable controls
+ * Copyright (C) 2015,2016,2017, Fulup Ar Foll fulup@iot.bzh
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Payload (base64 "data" or file "path", a plain file name inside ALSACORE_TLVDIR) is split in chunks of at most "chunk" bytes, each one being
+ * sent as a {type, length, bytes} TLV with snd_ctl_elem_tlv_write (or _command). Chunk is clamped to
+ * what the kernel accepts in one TLV ioctl and, for BYTES controls, to the control element count. With
+ * raw=true payload is a sequence of TLV containers, each one is sent as is in its own write and has to
+ * fit the same limit. Upload runs on a worker thread which replies to request.
+ */
+
+#define _GNU_SOURCE  // needed for vasprintf
+
+#include <pthread.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "Alsa-ApiHat.h"
+
+typedef struct {
+    afb_req_t request;
+    char *devid;
+    unsigned int numid;
+    char *name;
+    int command;
+    int raw;
+    unsigned int type;
+    size_t chunk;
+    unsigned char *payload;
+    size_t size;
+} tlvJobT;
+
+STATIC void tlvJobFree(tlvJobT *job) {
+    free(job->devid);
+    free(job->name);
+    free(job->payload);
+    free(job);
+}
+
+STATIC const char *tlvDir(void) {
+    const char *dir = getenv("ALSACORE_TLVDIR");
+    if (dir) return dir;
+    return ALSA_TLV_DIR;
+}
+
+// clients only name a file of the configured directory, alsacore never reads a client chosen path
+STATIC ssize_t tlvReadFile(const char *name, unsigned char **data) {
+    char path[CONTROL_MAXPATH_LEN];
+    FILE *file;
+    long size;
+
+    *data = NULL;
+    if (!name[0] || strchr(name, '/') || !strcmp(name, ".") || !strcmp(name, "..")) return -1;
+    if (snprintf(path, sizeof (path), "%s/%s", tlvDir(), name) >= (int) sizeof (path)) return -1;
+
+    file = fopen(path, "r");
+    if (!file) return -1;
+
+    if (fseek(file, 0, SEEK_END) < 0 || (size = ftell(file)) < 0 || size > ALSA_TLV_MAX_SIZE || fseek(file, 0, SEEK_SET) < 0) goto OnErrorExit;
+
+    *data = malloc((size_t) size + 1);
+    if (!*data || fread(*data, 1, (size_t) size, file) != (size_t) size) goto OnErrorExit;
+
+    fclose(file);
+    return (ssize_t) size;
+
+OnErrorExit:
+    free(*data);
+    *data = NULL;
+    fclose(file);
+    return -1;
+}
+
+// max TLV value bytes in one write: kernel ioctl limit, BYTES controls (ASoC bytes_tlv) report their size in count
+STATIC size_t tlvChunkLimit(snd_ctl_elem_info_t *elemInfo) {
+    size_t limit = ALSA_TLV_KERNEL_MAX - 2 * sizeof (unsigned int);
+    unsigned int count = snd_ctl_elem_info_get_count(elemInfo);
+
+    if (snd_ctl_elem_info_get_type(elemInfo) == SND_CTL_ELEM_TYPE_BYTES && count > 0 && count < limit) limit = count;
+    return limit;
+}
+
+STATIC int tlvWriteOne(snd_ctl_t *ctlDev, snd_ctl_elem_id_t *elemId, int command, const unsigned int *tlv) {
+    if (command) return snd_ctl_elem_tlv_command(ctlDev, elemId, tlv);
+    return snd_ctl_elem_tlv_write(ctlDev, elemId, tlv);
+}
+
+STATIC void *tlvWriteThread(void *arg) {
+    tlvJobT *job = arg;
+    snd_ctl_t *ctlDev = NULL;
+    snd_ctl_elem_info_t *elemInfo;
+    snd_ctl_elem_id_t *elemId;
+    unsigned int *tlv = NULL;
+    unsigned int header[2];
+    struct timespec start, stop;
+    size_t limit, length;
+    int err, chunks = 0;
+
+    err = snd_ctl_open(&ctlDev, job->devid, 0);
+    if (err < 0) {
+        ctlDev = NULL;
+        afb_req_fail_f(job->request, "devid-unknown", "SndCard devid=[%s] Not Found err=%s", job->devid, snd_strerror(err));
+        goto OnExit;
+    }
+
+    snd_ctl_elem_info_alloca(&elemInfo);
+    if (job->numid) snd_ctl_elem_info_set_numid(elemInfo, job->numid);
+    else {
+        snd_ctl_elem_info_set_interface(elemInfo, SND_CTL_ELEM_IFACE_MIXER);
+        snd_ctl_elem_info_set_name(elemInfo, job->name);
+    }
+    if ((err = snd_ctl_elem_info(ctlDev, elemInfo)) < 0) {
+        afb_req_fail_f(job->request, "ctl-unknown", "devid=[%s] ctl=[%d/%s] not found err=%s", job->devid, job->numid, job->name ? job->name : "", snd_strerror(err));
+        goto OnExit;
+    }
+
+    if (job->command ? !snd_ctl_elem_info_is_tlv_commandable(elemInfo) : !snd_ctl_elem_info_is_tlv_writable(elemInfo)) {
+        afb_req_fail_f(job->request, "ctl-not-tlv", "devid=[%s] numid=%d is not TLV %s", job->devid, snd_ctl_elem_info_get_numid(elemInfo), job->command ? "commandable" : "writable");
+        goto OnExit;
+    }
+
+    snd_ctl_elem_id_alloca(&elemId);
+    snd_ctl_elem_info_get_id(elemInfo, elemId);
+
+    limit = tlvChunkLimit(elemInfo);
+    if (job->chunk > limit) job->chunk = limit;
+
+    tlv = malloc(2 * sizeof (unsigned int) + ((limit + 3) & ~(size_t) 3));
+    if (!tlv) {
+        afb_req_fail_f(job->request, "out-of-memory", "devid=[%s] fail to allocate TLV buffer size=%zu", job->devid, limit);
+        goto OnExit;
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    err = 0;
+    if (job->raw) {
+        // each container keeps its own type/length header, only word alignment is needed
+        for (size_t offset = 0; offset < job->size; offset += 2 * sizeof (unsigned int) + ((length + 3) & ~(size_t) 3)) {
+            if (job->size - offset < sizeof (header)) {
+                afb_req_fail_f(job->request, "tlv-invalid", "devid=[%s] raw payload offset=%zu shorter than a TLV header", job->devid, offset);
+                goto OnExit;
+            }
+            memcpy(header, job->payload + offset, sizeof (header));
+            length = header[1];
+            if (length > job->size - offset - sizeof (header)) {
+                afb_req_fail_f(job->request, "tlv-invalid", "devid=[%s] raw TLV offset=%zu length=%zu overflows payload size=%zu", job->devid, offset, length, job->size);
+                goto OnExit;
+            }
+            if (length > limit) {
+                afb_req_fail_f(job->request, "tlv-too-large", "devid=[%s] raw TLV offset=%zu length=%zu above control limit=%zu", job->devid, offset, length, limit);
+                goto OnExit;
+            }
+
+            if (length % sizeof (unsigned int)) tlv[2 + length / sizeof (unsigned int)] = 0;
+            memcpy(tlv, job->payload + offset, sizeof (header) + length);
+
+            err = tlvWriteOne(ctlDev, elemId, job->command, tlv);
+            if (err < 0) break;
+            chunks++;
+        }
+    } else {
+        for (size_t offset = 0; offset < job->size; offset += job->chunk) {
+            length = job->size - offset < job->chunk ? job->size - offset : job->chunk;
+
+            tlv[0] = job->type;
+            tlv[1] = (unsigned int) length;
+            if (length % sizeof (unsigned int)) tlv[2 + length / sizeof (unsigned int)] = 0;
+            memcpy(&tlv[2], job->payload + offset, length);
+
+            err = tlvWriteOne(ctlDev, elemId, job->command, tlv);
+            if (err < 0) break;
+            chunks++;
+        }
+    }
+    clock_gettime(CLOCK_MONOTONIC, &stop);
+
+    if (err < 0) {
+        afb_req_fail_f(job->request, "tlv-write", "devid=[%s] numid=%d chunk=%d/%zu err=%s", job->devid, snd_ctl_elem_info_get_numid(elemInfo), chunks, job->chunk, snd_strerror(err));
+        goto OnExit;
+    }
+
+    // cached catalog holds TLVs
+    alsaCardCacheInvalidate(alsaCardIndex(job->devid));
+
+    long usec = (stop.tv_sec - start.tv_sec) * 1000000L + (stop.tv_nsec - start.tv_nsec) / 1000L;
+    json_object *responseJ = json_object_new_object();
+    json_object_object_add(responseJ, "numid", json_object_new_int((int) snd_ctl_elem_info_get_numid(elemInfo)));
+    json_object_object_add(responseJ, "bytes", json_object_new_int64((int64_t) job->size));
+    json_object_object_add(responseJ, "chunks", json_object_new_int(chunks));
+    if (!job->raw) json_object_object_add(responseJ, "chunk", json_object_new_int64((int64_t) job->chunk));
+    json_object_object_add(responseJ, "usec", json_object_new_int64(usec));
+    // bytes per ms is kB/s
+    json_object_object_add(responseJ, "kBps", json_object_new_double(usec > 0 ? (double) job->size * 1000.0 / (double) usec : 0.0));
+    afb_req_success(job->request, responseJ, NULL);
+
+OnExit:
+    free(tlv);
+    if (ctlDev) snd_ctl_close(ctlDev);
+    afb_req_unref(job->request);
+    tlvJobFree(job);
+    return NULL;
+}
+
+// Upload a large TLV payload: {"devid":"hw:0", "ctl":numid|"name":"xxx", "data":"base64"|"path":"file", "command":false, "raw":false, "type":0, "chunk":4096}
+
+PUBLIC void alsaTlvWrite(afb_req_t request) {
+    json_object *queryJ = afb_req_json(request), *tmpJ;
+    const char *devid, *data, *path;
+    tlvJobT *job = NULL;
+    ssize_t size;
+    pthread_t thread;
+
+    devid = afb_req_value(request, "devid");
+    if (!devid) {
+        afb_req_fail_f(request, "devid-missing", "devid MUST be defined for tlvwrite");
+        goto OnErrorExit;
+    }
+
+    job = calloc(1, sizeof (tlvJobT));
+    if (!job || !(job->devid = strdup(devid))) {
+        afb_req_fail_f(request, "out-of-memory", "devid=[%s] fail to allocate TLV upload", devid);
+        goto OnErrorExit;
+    }
+    job->chunk = ALSA_TLV_CHUNK_SIZE;
+
+    if (json_object_object_get_ex(queryJ, "ctl", &tmpJ)) job->numid = (unsigned int) json_object_get_int(tmpJ);
+    if (json_object_object_get_ex(queryJ, "name", &tmpJ)) job->name = strdup(json_object_get_string(tmpJ));
+    if (!job->numid && !job->name) {
+        afb_req_fail_f(request, "ctl-missing", "devid=[%s] ctl=numid or name=ctlname missing", devid);
+        goto OnErrorExit;
+    }
+
+    if (json_object_object_get_ex(queryJ, "command", &tmpJ)) job->command = json_object_get_boolean(tmpJ);
+    if (json_object_object_get_ex(queryJ, "raw", &tmpJ)) job->raw = json_object_get_boolean(tmpJ);
+    if (json_object_object_get_ex(queryJ, "type", &tmpJ)) job->type = (unsigned int) json_object_get_int(tmpJ);
+    if (json_object_object_get_ex(queryJ, "chunk", &tmpJ) && json_object_get_int(tmpJ) > 0) job->chunk = (size_t) json_object_get_int(tmpJ);
+    // control may lower it further once opened
+    if (job->chunk > ALSA_TLV_KERNEL_MAX - 2 * sizeof (unsigned int)) job->chunk = ALSA_TLV_KERNEL_MAX - 2 * sizeof (unsigned int);
+
+    data = afb_req_value(request, "data");
+    path = afb_req_value(request, "path");
+    if (data) size = alsaBase64Decode(data, &job->payload);
+    else if (path) size = tlvReadFile(path, &job->payload);
+    else {
+        afb_req_fail_f(request, "payload-missing", "devid=[%s] data=base64 or path=file missing", devid);
+        goto OnErrorExit;
+    }
+
+    if (size <= 0 || size > ALSA_TLV_MAX_SIZE) {
+        if (data) afb_req_fail_f(request, "payload-invalid", "devid=[%s] data=[base64] invalid or empty payload (max=%d)", devid, ALSA_TLV_MAX_SIZE);
+        else afb_req_fail_f(request, "payload-invalid", "devid=[%s] path=[%s] should name a non empty file (max=%d) in ALSACORE_TLVDIR=%s", devid, path, ALSA_TLV_MAX_SIZE, tlvDir());
+        goto OnErrorExit;
+    }
+    job->size = (size_t) size;
+
+    job->request = afb_req_addref(request);
+    if (pthread_create(&thread, NULL, tlvWriteThread, job) != 0) {
+        afb_req_unref(job->request);
+        afb_req_fail_f(request, "thread-create", "devid=[%s] fail to start TLV upload", devid);
+        goto OnErrorExit;
+    }
+    pthread_detach(thread);
+    return;
+
+OnErrorExit:
+    if (job) tlvJobFree(job);
+    return;
+}
@@ -38,25 +38,221 @@
 #include <alsa/asoundlib.h>
 #include <alsa/asoundlib.h>
 #include <alsa/use-case.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
 
 #include "Alsa-ApiHat.h"
 
+typedef struct ucmWaiterS {
+    afb_req_t request;
+    void (*callback)(afb_req_t request);
+    struct ucmWaiterS *next;
+} ucmWaiterT;
+
+// Manager open running on a worker thread, requests wait on it and are replayed when done
+typedef struct ucmOpenJobS {
+    int cardId;
+    char *cardName;
+    int cancelled;
+    int err;
+    snd_use_case_mgr_t *ucm;
+    json_object *treeJ;
+    ucmWaiterT *waiters;
+    struct ucmOpenJobS *next;
+} ucmOpenJobT;
+
 typedef struct {
     snd_use_case_mgr_t *ucm;
     int cardId;
     char *cardName;
+    ucmOpenJobT *job; // set while manager is opening
+    unsigned long lastUse; // LRU stamp
+    json_object *treeJ; // verb/dev/mod/tq tree, fixed until reload/close
+    json_object *valuesJ; // resolved "label/mod/verb" values (null when undefined), fixed until set/reset
+    json_object *stateJ; // current verb/devices/modifiers, refreshed after set/reset
 } ucmHandleT;
 
 static ucmHandleT ucmHandles[MAX_SND_CARD];
+static pthread_mutex_t ucmHandlesLock = PTHREAD_MUTEX_INITIALIZER;
+static ucmOpenJobT *ucmOpenDone = NULL;
+static int ucmOpenFd = -1;
+static int ucmMaxOpen = ALSA_UCM_MAX_OPEN;
+static int ucmPrewarm = ALSA_PREWARM_UCM;
+static unsigned long ucmUseTick = 0;
+static afb_event_t ucmChangedEvt;
+
+STATIC json_object *ucmBuildTree(snd_use_case_mgr_t *ucmHandle);
+STATIC json_object *ucmStateGet(ucmHandleT *ucmHandle);
+STATIC void ucmStateChanged(ucmHandleT *ucmHandle, json_object *newStateJ);
+
+// Load UCM tree from card cache or build it from manager (return a reference)
+
+STATIC json_object *ucmTreeLoad(snd_use_case_mgr_t *ucm, int cardId) {
+    json_object *treeJ = alsaCardUcmTreeGet(cardId);
+    if (treeJ) return treeJ;
+
+    treeJ = ucmBuildTree(ucm);
+    if (treeJ) alsaCardUcmTreeSet(cardId, treeJ);
+    return treeJ;
+}
+
+// Values depend on current verb/dev/mod context and should be dropped when it changes
+
+STATIC void ucmValuesFlush(ucmHandleT *ucmHandle) {
+    if (ucmHandle->valuesJ) json_object_put(ucmHandle->valuesJ);
+    ucmHandle->valuesJ = NULL;
+}
+
+// Release every resource attached to an handle slot
+
+STATIC void ucmHandleRelease(ucmHandleT *ucmHandle) {
+    if (ucmHandle->ucm) snd_use_case_mgr_close(ucmHandle->ucm);
+    if (ucmHandle->treeJ) json_object_put(ucmHandle->treeJ);
+    ucmValuesFlush(ucmHandle);
+    if (ucmHandle->stateJ) json_object_put(ucmHandle->stateJ);
+    free(ucmHandle->cardName);
+    ucmHandle->ucm = NULL;
+    ucmHandle->treeJ = NULL;
+    ucmHandle->stateJ = NULL;
+    ucmHandle->cardName = NULL;
+}
+
+// Reserve a slot for cardId, closing least recently used manager over ucmMaxOpen (caller holds ucmHandlesLock).
+// Note: closing a manager does not run its disable sequences, sound card keeps its current state.
+
+STATIC int ucmSlotReserve(int cardId, const char *cardName) {
+    int idx, idxFree = -1, idxOld = -1, used = 0;
+
+    for (idx = 0; idx < MAX_SND_CARD; idx++) {
+        if (ucmHandles[idx].ucm || ucmHandles[idx].job) {
+            used++;
+            if (ucmHandles[idx].ucm && (idxOld < 0 || ucmHandles[idx].lastUse < ucmHandles[idxOld].lastUse)) idxOld = idx;
+        } else if (idxFree == -1) idxFree = idx;
+    }
+
+    if (used >= ucmMaxOpen || idxFree < 0) {
+        if (idxOld < 0) return -1;
+        AFB_NOTICE("ucmSlotReserve: max=%d open UCM reached, closing hw:%d name=[%s]", ucmMaxOpen, ucmHandles[idxOld].cardId, ucmHandles[idxOld].cardName);
+        ucmHandleRelease(&ucmHandles[idxOld]);
+        idxFree = idxOld;
+    }
+
+    ucmHandles[idxFree].cardId = cardId;
+    ucmHandles[idxFree].job = calloc(1, sizeof (ucmOpenJobT));
+    ucmHandles[idxFree].job->cardId = cardId;
+    ucmHandles[idxFree].job->cardName = strdup(cardName);
+    return idxFree;
+}
+
+// Parse UCM profile (slow), then hand job back to mainloop
+
+STATIC void ucmOpenRun(ucmOpenJobT *job) {
+    uint64_t one = 1;
+    int err;
+
+    err = snd_use_case_mgr_open(&job->ucm, job->cardName);
+    if (err) {
+        AFB_INFO("ucmOpenRun: hw:%d name=[%s] No UCM Profile err=%s", job->cardId, job->cardName, snd_strerror(err));
+        job->ucm = NULL;
+        job->err = err;
+    } else {
+        job->treeJ = ucmTreeLoad(job->ucm, job->cardId);
+    }
+
+    pthread_mutex_lock(&ucmHandlesLock);
+    job->next = ucmOpenDone;
+    ucmOpenDone = job;
+    pthread_mutex_unlock(&ucmHandlesLock);
+
+    if (ucmOpenFd >= 0 && write(ucmOpenFd, &one, sizeof (one)) < 0) AFB_DEBUG("ucmOpenRun: eventfd write error");
+}
+
+STATIC void *ucmOpenThread(void *arg) {
+    ucmOpenRun((ucmOpenJobT*) arg);
+    return NULL;
+}
+
+STATIC void ucmOpenDispatch(void);
 
-// Cache opened UCM handles
+STATIC void ucmOpenStart(ucmOpenJobT *job) {
+    pthread_t thread;
 
-STATIC int alsaUseCaseOpen(afb_req_t request, queryValuesT *queryValues, int allowNewMgr) {
+    // without eventfd or thread, open inline and complete immediately
+    if (ucmOpenFd < 0 || pthread_create(&thread, NULL, ucmOpenThread, job) != 0) {
+        ucmOpenRun(job);
+        ucmOpenDispatch();
+        return;
+    }
+    pthread_detach(thread);
+}
+
+// Attach opened managers to their slot and replay waiting requests (mainloop only)
+
+STATIC void ucmOpenDispatch(void) {
+    ucmOpenJobT *jobs, *job, *nextJob;
+
+    pthread_mutex_lock(&ucmHandlesLock);
+    jobs = ucmOpenDone;
+    ucmOpenDone = NULL;
+    for (job = jobs; job; job = job->next) {
+        for (int idx = 0; idx < MAX_SND_CARD; idx++) {
+            if (ucmHandles[idx].job != job) continue;
+
+            ucmHandles[idx].job = NULL;
+            if (job->err) break;
+
+            ucmHandles[idx].ucm = job->ucm;
+            ucmHandles[idx].cardName = job->cardName;
+            ucmHandles[idx].treeJ = job->treeJ;
+            ucmHandles[idx].lastUse = ++ucmUseTick;
+            job->ucm = NULL;
+            job->cardName = NULL;
+            job->treeJ = NULL;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ucmHandlesLock);
+
+    for (job = jobs; job; job = nextJob) {
+        nextJob = job->next;
+
+        // cancelled jobs (card removed) still own their manager
+        if (job->ucm) snd_use_case_mgr_close(job->ucm);
+        if (job->treeJ) json_object_put(job->treeJ);
+
+        while (job->waiters) {
+            ucmWaiterT *waiter = job->waiters;
+            job->waiters = waiter->next;
+
+            if (job->err) afb_req_fail_f(waiter->request, "ucm-open", "SndCard hw:%d No UCM Profile err=%s", job->cardId, snd_strerror(job->err));
+            else if (job->cancelled) afb_req_fail_f(waiter->request, "ucm-open", "SndCard hw:%d removed while opening UCM", job->cardId);
+            else waiter->callback(waiter->request);
+
+            afb_req_unref(waiter->request);
+            free(waiter);
+        }
+        free(job->cardName);
+        free(job);
+    }
+}
+
+STATIC int ucmOpenCB(sd_event_source* src, int fd, uint32_t revents, void* userData) {
+    uint64_t count;
+
+    if (read(fd, &count, sizeof (count)) < 0) AFB_DEBUG("ucmOpenCB: eventfd read error");
+    ucmOpenDispatch();
+    return 0;
+}
+
+// Return opened UCM handle index. When manager is not opened yet, request is queued and replayed
+// through callback once background open completes (return -1 without replying to request).
+
+STATIC int alsaUseCaseOpen(afb_req_t request, queryValuesT *queryValues, int allowNewMgr, void (*callback)(afb_req_t request)) {
     snd_ctl_t *ctlDev=NULL;
     snd_ctl_card_info_t *cardinfo;
-    snd_use_case_mgr_t *ucmHandle;
-    const char *cardName;
-    int cardId, idx, idxFree = -1, err;
+    ucmOpenJobT *job = NULL;
+    ucmWaiterT *waiter, **link;
+    int cardId, idx, err, start = 0;
 
     // open control interface for devid
     err = snd_ctl_open(&ctlDev, queryValues->devid, SND_CTL_READONLY);
@@ -72,37 +268,50 @@ STATIC int alsaUseCaseOpen(afb_req_t request, queryValuesT *queryValues, int all
         goto OnErrorExit;
     }
 
-    // search for an existing subscription and mark 1st free slot
+    // search for an existing or opening manager
     cardId = snd_ctl_card_info_get_card(cardinfo);
+    pthread_mutex_lock(&ucmHandlesLock);
     for (idx = 0; idx < MAX_SND_CARD; idx++) {
-        if (ucmHandles[idx].ucm != NULL) {
-            if (ucmHandles[idx].cardId == cardId) goto OnSuccessExit;
-        } else if (idxFree == -1) idxFree = idx;
+        if ((ucmHandles[idx].ucm || ucmHandles[idx].job) && ucmHandles[idx].cardId == cardId) break;
     };
 
-    if (!allowNewMgr) {
-        afb_req_fail_f(request, "ucm-nomgr", "SndCard devid=[%s] no exiting UCM manager session", queryValues->devid);
-        goto OnErrorExit;
+    if (idx < MAX_SND_CARD && ucmHandles[idx].ucm) {
+        ucmHandles[idx].lastUse = ++ucmUseTick;
+        pthread_mutex_unlock(&ucmHandlesLock);
+        goto OnSuccessExit;
     }
 
-    if (idxFree < 0 && idx == MAX_SND_CARD) {
-        afb_req_fail_f(request, "ucm-toomany", "SndCard devid=[%s] too many open UCM Max=%d", queryValues->devid, MAX_SND_CARD);
-        goto OnErrorExit;
-    }
+    if (idx == MAX_SND_CARD) {
+        if (!allowNewMgr) {
+            pthread_mutex_unlock(&ucmHandlesLock);
+            afb_req_fail_f(request, "ucm-nomgr", "SndCard devid=[%s] no exiting UCM manager session", queryValues->devid);
+            goto OnErrorExit;
+        }
 
-    idx = idxFree;
-    cardName = snd_ctl_card_info_get_name(cardinfo);
-    err = snd_use_case_mgr_open(&ucmHandle, cardName);
-    if (err) {
-        afb_req_fail_f(request, "ucm-open", "SndCard devid=[%s] name=[%s] No UCM Profile err=%s", queryValues->devid, cardName, snd_strerror(err));
-        goto OnErrorExit;
+        idx = ucmSlotReserve(cardId, snd_ctl_card_info_get_name(cardinfo));
+        if (idx < 0) {
+            pthread_mutex_unlock(&ucmHandlesLock);
+            afb_req_fail_f(request, "ucm-toomany", "SndCard devid=[%s] too many opening UCM Max=%d", queryValues->devid, ucmMaxOpen);
+            goto OnErrorExit;
+        }
+        start = 1;
     }
-    ucmHandles[idx].ucm = ucmHandle;
-    ucmHandles[idx].cardId = cardId;
-    ucmHandles[idx].cardName = strdup(cardName);
+
+    // request waits for manager open
+    job = ucmHandles[idx].job;
+    waiter = calloc(1, sizeof (ucmWaiterT));
+    waiter->request = afb_req_addref(request);
+    waiter->callback = callback;
+    for (link = &job->waiters; *link; link = &(*link)->next);
+    *link = waiter;
+    pthread_mutex_unlock(&ucmHandlesLock);
+
+    snd_ctl_close(ctlDev);
+    if (start) ucmOpenStart(job);
+    return -1;
 
 OnSuccessExit:
-    if (ctlDev) snd_ctl_close(ctlDev);
+    snd_ctl_close(ctlDev);
     return idx;
 
 OnErrorExit:
@@ -110,27 +319,15 @@ OnErrorExit:
     return -1;
 }
 
-PUBLIC void alsaUseCaseQuery(afb_req_t request) {
-    int verbCount, ucmIdx;
+// Build verbs/devices/modifiers/tqs tree from UCM profile
+
+STATIC json_object *ucmBuildTree(snd_use_case_mgr_t *ucmHandle) {
+    int verbCount;
     const char **verbList;
-    snd_use_case_mgr_t *ucmHandle;
-    queryValuesT queryValues;
     json_object *ucmJs;
-    const char *cardName;
-
-    json_object *queryJ = alsaCheckQuery(request, &queryValues);
-    if (!queryJ) goto OnErrorExit;
-
-    ucmIdx = alsaUseCaseOpen(request, &queryValues, TRUE);
-    if (ucmIdx < 0) goto OnErrorExit;
-    ucmHandle = ucmHandles [ucmIdx].ucm;
-    cardName = ucmHandles [ucmIdx].cardName;
 
     verbCount = snd_use_case_get_list(ucmHandle, "_verbs", &verbList);
-    if (verbCount < 0) {
-        afb_req_fail_f(request, "ucm-list", "SndCard devid=[%s] name=[%s] No UCM Verbs", queryValues.devid, cardName);
-        goto OnErrorExit;
-    }
+    if (verbCount < 0) goto OnErrorExit;
 
     ucmJs = json_object_new_array();
     for (int idx = 0; idx < verbCount; idx += 2) {
@@ -195,15 +392,156 @@ PUBLIC void alsaUseCaseQuery(afb_req_t request) {
         json_object_array_add(ucmJs, ucmJ);
     }
 
-    afb_req_success(request, ucmJs, NULL);
     snd_use_case_free_list(verbList, verbCount);
+    return ucmJs;
+
+OnErrorExit:
+    return NULL;
+}
+
+// Open UCM manager in background ahead of 1st request (init prewarm and hotplug)
+
+PUBLIC int alsaUseCasePreload(int cardId) {
+    char *cardName = NULL;
+    int idx, err;
+
+    if (!ucmPrewarm) return 0;
+    if ((err = snd_card_get_name(cardId, &cardName)) < 0) goto OnErrorExit;
+
+    pthread_mutex_lock(&ucmHandlesLock);
+    for (idx = 0; idx < MAX_SND_CARD; idx++) {
+        if ((ucmHandles[idx].ucm || ucmHandles[idx].job) && ucmHandles[idx].cardId == cardId) break;
+    }
+    if (idx == MAX_SND_CARD) {
+        idx = ucmSlotReserve(cardId, cardName);
+        if (idx < 0) {
+            pthread_mutex_unlock(&ucmHandlesLock);
+            goto OnErrorExit;
+        }
+        pthread_mutex_unlock(&ucmHandlesLock);
+        ucmOpenStart(ucmHandles[idx].job);
+    } else {
+        pthread_mutex_unlock(&ucmHandlesLock);
+    }
+
+    free(cardName);
+    return 0;
+
+OnErrorExit:
+    free(cardName);
+    return -1;
+}
+
+// Close UCM manager of a removed card (an opening manager is closed when its job completes)
+
+PUBLIC void alsaUseCaseDropCard(int cardId) {
+    pthread_mutex_lock(&ucmHandlesLock);
+    for (int idx = 0; idx < MAX_SND_CARD; idx++) {
+        if (ucmHandles[idx].cardId != cardId) continue;
+
+        if (ucmHandles[idx].job) {
+            ucmHandles[idx].job->cancelled = 1;
+            ucmHandles[idx].job = NULL;
+        }
+        if (ucmHandles[idx].ucm) ucmHandleRelease(&ucmHandles[idx]);
+    }
+    pthread_mutex_unlock(&ucmHandlesLock);
+}
+
+PUBLIC int alsaUseCaseInit(void) {
+    sd_event_source *src;
+    const char *value;
+    int err;
+
+    ucmChangedEvt = afb_daemon_make_event("ucm-changed");
+
+    value = getenv("ALSACORE_PREWARM_UCM");
+    if (value) ucmPrewarm = atoi(value);
+
+    value = getenv("ALSACORE_UCM_MAX");
+    if (value) ucmMaxOpen = atoi(value);
+    if (ucmMaxOpen < 1 || ucmMaxOpen > MAX_SND_CARD) ucmMaxOpen = MAX_SND_CARD;
+
+    ucmOpenFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (ucmOpenFd < 0) goto OnErrorExit;
+
+    err = sd_event_add_io(afb_daemon_get_event_loop(), &src, ucmOpenFd, EPOLLIN, ucmOpenCB, NULL);
+    if (err < 0) {
+        close(ucmOpenFd);
+        ucmOpenFd = -1;
+        goto OnErrorExit;
+    }
+    return 0;
+
+OnErrorExit:
+    AFB_WARNING("alsaUseCaseInit: no eventfd, UCM managers are opened inline");
+    return -1;
+}
+
+PUBLIC void alsaUseCaseQuery(afb_req_t request) {
+    int ucmIdx, cardId, err;
+    queryValuesT queryValues;
+    json_object *ucmJs = NULL, *tmpJ;
+
+    json_object *queryJ = alsaCheckQuery(request, &queryValues);
+    if (!queryJ) goto OnErrorExit;
+
+    // reload force UCM profile parsing and tree rebuild
+    if (json_object_object_get_ex(queryJ, "reload", &tmpJ) && json_object_get_boolean(tmpJ)) {
+        ucmIdx = alsaUseCaseOpen(request, &queryValues, TRUE, alsaUseCaseQuery);
+        if (ucmIdx < 0) goto OnErrorExit;
+
+        err = snd_use_case_mgr_reload(ucmHandles[ucmIdx].ucm);
+        if (err) {
+            afb_req_fail_f(request, "ucm-reload", "SndCard devid=[%s] name=[%s] fail to reload UCM err=%s", queryValues.devid, ucmHandles[ucmIdx].cardName, snd_strerror(err));
+            goto OnErrorExit;
+        }
+
+        ucmJs = ucmBuildTree(ucmHandles[ucmIdx].ucm);
+        ucmValuesFlush(&ucmHandles[ucmIdx]);
+        // reload resets manager (no verb, no device), cached state and subscribers must follow
+        ucmStateChanged(&ucmHandles[ucmIdx], ucmStateGet(&ucmHandles[ucmIdx]));
+        pthread_mutex_lock(&ucmHandlesLock);
+        if (ucmHandles[ucmIdx].treeJ) json_object_put(ucmHandles[ucmIdx].treeJ);
+        ucmHandles[ucmIdx].treeJ = ucmJs ? json_object_get(ucmJs) : NULL;
+        pthread_mutex_unlock(&ucmHandlesLock);
+        alsaCardUcmTreeSet(ucmHandles[ucmIdx].cardId, ucmJs);
+        goto OnTreeExit;
+    }
+
+    // tree is attached to open manager, then to card cache
+    cardId = alsaCardIndex(queryValues.devid);
+    pthread_mutex_lock(&ucmHandlesLock);
+    for (int idx = 0; idx < MAX_SND_CARD && cardId >= 0; idx++) {
+        if (ucmHandles[idx].ucm && ucmHandles[idx].cardId == cardId && ucmHandles[idx].treeJ) {
+            ucmJs = json_object_get(ucmHandles[idx].treeJ);
+            break;
+        }
+    }
+    pthread_mutex_unlock(&ucmHandlesLock);
+    if (!ucmJs) ucmJs = alsaCardUcmTreeGet(cardId);
+    if (ucmJs) {
+        afb_req_success(request, ucmJs, NULL);
+        return;
+    }
+
+    ucmIdx = alsaUseCaseOpen(request, &queryValues, TRUE, alsaUseCaseQuery);
+    if (ucmIdx < 0) goto OnErrorExit;
+    if (ucmHandles[ucmIdx].treeJ) ucmJs = json_object_get(ucmHandles[ucmIdx].treeJ);
+
+OnTreeExit:
+    if (!ucmJs) {
+        afb_req_fail_f(request, "ucm-list", "SndCard devid=[%s] name=[%s] No UCM Verbs", queryValues.devid, ucmHandles[ucmIdx].cardName);
+        goto OnErrorExit;
+    }
+    afb_req_success(request, ucmJs, NULL);
 
 OnErrorExit:
     return;
 }
 
 STATIC json_object *ucmGetValue(ucmHandleT *ucmHandle, const char *verb, const char *mod, const char *label) {
-    char identifier[80];
+    char identifier[128];
     char *value;
     int err;
     json_object *jValue;
@@ -218,21 +556,86 @@ STATIC json_object *ucmGetValue(ucmHandleT *ucmHandle, const char *verb, const c
     }
 
     snprintf(identifier, sizeof (identifier), "%s/%s/%s", label, mod, verb);
+
+    // undefined values are cached as json null
+    if (!ucmHandle->valuesJ) ucmHandle->valuesJ = json_object_new_object();
+    if (json_object_object_get_ex(ucmHandle->valuesJ, identifier, &jValue)) {
+        return jValue ? json_object_get(jValue) : NULL;
+    }
+
     err = snd_use_case_get(ucmHandle->ucm, identifier, (const char**) &value); // Note: value casting is a known "FEATURE" of AlsaUCM API
     if (err) {
         AFB_DEBUG("ucmGetValue cardname=[%s] identifier=[%s] error=%s", ucmHandle->cardName, identifier, snd_strerror(err));
+        json_object_object_add(ucmHandle->valuesJ, identifier, NULL);
         goto OnErrorExit;
     }
 
     // copy value into json object and free string
     jValue = json_object_new_string(value);
     free(value);
+    json_object_object_add(ucmHandle->valuesJ, identifier, json_object_get(jValue));
     return (jValue);
 
 OnErrorExit:
     return (NULL);
 }
 
+// Resolve labels for one verb/dev/mod context, undefined labels are skipped
+
+STATIC json_object *ucmGetLabels(ucmHandleT *ucmHandle, const char *verb, const char *mod, json_object *jLabels, int labelCount) {
+    json_object *valuesJ = json_object_new_object();
+
+    for (int idx = 0; idx < labelCount; idx++) {
+        const char *label = json_object_get_string(json_object_array_get_idx(jLabels, idx));
+        json_object *jValue = ucmGetValue(ucmHandle, verb, mod, label);
+        if (jValue) json_object_object_add(valuesJ, label, jValue);
+    }
+    return valuesJ;
+}
+
+// Resolve labels for every verb, device and modifier of UCM tree (or of one verb when set)
+
+STATIC json_object *ucmGetBulk(ucmHandleT *ucmHandle, const char *onlyVerb, json_object *jLabels, int labelCount) {
+    json_object *responseJ, *verbJ, *tmpJ, *listJ;
+
+    if (!ucmHandle->treeJ) return NULL;
+
+    responseJ = json_object_new_object();
+    for (int idx = 0; idx < (int) json_object_array_length(ucmHandle->treeJ); idx++) {
+        json_object *ucmJ = json_object_array_get_idx(ucmHandle->treeJ, idx);
+
+        json_object_object_get_ex(ucmJ, "verb", &tmpJ);
+        const char *verb = json_object_get_string(tmpJ);
+        if (onlyVerb && strcmp(verb, onlyVerb)) continue;
+
+        verbJ = json_object_new_object();
+        json_object_object_add(verbJ, "values", ucmGetLabels(ucmHandle, verb, NULL, jLabels, labelCount));
+
+        if (json_object_object_get_ex(ucmJ, "devices", &listJ)) {
+            json_object *devsJ = json_object_new_object();
+            for (int jdx = 0; jdx < (int) json_object_array_length(listJ); jdx++) {
+                json_object_object_get_ex(json_object_array_get_idx(listJ, jdx), "dev", &tmpJ);
+                const char *dev = json_object_get_string(tmpJ);
+                json_object_object_add(devsJ, dev, ucmGetLabels(ucmHandle, verb, dev, jLabels, labelCount));
+            }
+            json_object_object_add(verbJ, "devices", devsJ);
+        }
+
+        if (json_object_object_get_ex(ucmJ, "modifiers", &listJ)) {
+            json_object *modsJ = json_object_new_object();
+            for (int jdx = 0; jdx < (int) json_object_array_length(listJ); jdx++) {
+                json_object_object_get_ex(json_object_array_get_idx(listJ, jdx), "mod", &tmpJ);
+                const char *mod = json_object_get_string(tmpJ);
+                json_object_object_add(modsJ, mod, ucmGetLabels(ucmHandle, verb, mod, jLabels, labelCount));
+            }
+            json_object_object_add(verbJ, "modifiers", modsJ);
+        }
+
+        json_object_object_add(responseJ, verb, verbJ);
+    }
+    return responseJ;
+}
+
 PUBLIC void alsaUseCaseGet(afb_req_t request) {
     int ucmIdx, labelCount;
     queryValuesT queryValues;
@@ -244,7 +647,7 @@ PUBLIC void alsaUseCaseGet(afb_req_t request) {
     if (!queryJ) goto OnErrorExit;
     ;
 
-    ucmIdx = alsaUseCaseOpen(request, &queryValues, TRUE);
+    ucmIdx = alsaUseCaseOpen(request, &queryValues, TRUE, alsaUseCaseGet);
     if (ucmIdx < 0) goto OnErrorExit;
 
     const char *cardName = ucmHandles[ucmIdx].cardName;
@@ -293,6 +696,19 @@ PUBLIC void alsaUseCaseGet(afb_req_t request) {
             goto OnErrorExit;
     }
 
+    // bulk resolves labels for every verb/dev/mod in one request
+    json_object *bulkJ;
+    if (json_object_object_get_ex(queryJ, "bulk", &bulkJ) && json_object_get_boolean(bulkJ)) {
+        json_object_put(jResponse);
+        jResponse = ucmGetBulk(&ucmHandles[ucmIdx], verb, jLabels, labelCount);
+        if (!jResponse) {
+            afb_req_fail_f(request, "ucmget-bulk", "SndCard devid=[%s] name=[%s] No UCM Verbs", queryValues.devid, cardName);
+            goto OnErrorExit;
+        }
+        afb_req_success(request, jResponse, NULL);
+        goto OnErrorExit;
+    }
+
     for (int idx = 0; idx < labelCount; idx++) {
         json_object *jValue, *jLabel;
         const char *label;
@@ -318,6 +734,206 @@ OnErrorExit:
     return;
 }
 
+// Return current verb, enabled devices and modifiers as tracked by UCM manager
+
+STATIC json_object *ucmStateGet(ucmHandleT *ucmHandle) {
+    json_object *stateJ = json_object_new_object();
+    json_object *devsJ = json_object_new_array();
+    json_object *modsJ = json_object_new_array();
+    const char *verb, **list;
+    int count;
+
+    if (snd_use_case_get(ucmHandle->ucm, "_verb", &verb) == 0 && verb) {
+        json_object_object_add(stateJ, "verb", json_object_new_string(verb));
+        free((char*) verb);
+    } else {
+        json_object_object_add(stateJ, "verb", NULL);
+    }
+
+    count = snd_use_case_get_list(ucmHandle->ucm, "_enadevs", &list);
+    if (count > 0) {
+        for (int idx = 0; idx < count; idx++) json_object_array_add(devsJ, json_object_new_string(list[idx]));
+        snd_use_case_free_list(list, count);
+    }
+
+    count = snd_use_case_get_list(ucmHandle->ucm, "_enamods", &list);
+    if (count > 0) {
+        for (int idx = 0; idx < count; idx++) json_object_array_add(modsJ, json_object_new_string(list[idx]));
+        snd_use_case_free_list(list, count);
+    }
+
+    json_object_object_add(stateJ, "devices", devsJ);
+    json_object_object_add(stateJ, "modifiers", modsJ);
+    return stateJ;
+}
+
+// Return cached state (a reference), read from manager on 1st call
+
+STATIC json_object *ucmStateCurrent(ucmHandleT *ucmHandle) {
+    if (!ucmHandle->stateJ) ucmHandle->stateJ = ucmStateGet(ucmHandle);
+    return json_object_get(ucmHandle->stateJ);
+}
+
+// Replace cached state and push ucm-changed with old/new state when it differs (newStateJ is stolen, NULL when closed)
+
+STATIC void ucmStateChanged(ucmHandleT *ucmHandle, json_object *newStateJ) {
+    json_object *oldStateJ = ucmHandle->stateJ;
+    json_object *eventJ;
+
+    ucmHandle->stateJ = newStateJ;
+    if (oldStateJ && newStateJ && !strcmp(json_object_to_json_string(oldStateJ), json_object_to_json_string(newStateJ))) goto OnExit;
+    if (!afb_event_is_valid(ucmChangedEvt)) goto OnExit;
+
+    eventJ = json_object_new_object();
+    json_object_object_add(eventJ, "cardid", json_object_new_int(ucmHandle->cardId));
+    if (ucmHandle->cardName) json_object_object_add(eventJ, "name", json_object_new_string(ucmHandle->cardName));
+    json_object_object_add(eventJ, "old", oldStateJ ? json_object_get(oldStateJ) : NULL);
+    json_object_object_add(eventJ, "new", newStateJ ? json_object_get(newStateJ) : NULL);
+    afb_event_push(ucmChangedEvt, eventJ);
+
+OnExit:
+    if (oldStateJ) json_object_put(oldStateJ);
+}
+
+STATIC int ucmListHas(json_object *listJ, const char *name) {
+    for (int idx = 0; listJ && idx < (int) json_object_array_length(listJ); idx++) {
+        if (!strcmp(json_object_get_string(json_object_array_get_idx(listJ, idx)), name)) return 1;
+    }
+    return 0;
+}
+
+STATIC void ucmPlanAdd(json_object *planJ, const char *identifier, const char *value) {
+    json_object *stepJ = json_object_new_object();
+    json_object_object_add(stepJ, "id", json_object_new_string(identifier));
+    json_object_object_add(stepJ, "value", json_object_new_string(value));
+    json_object_array_add(planJ, stepJ);
+}
+
+// Compute minimal _verb/_dismod/_disdev/_swdev/_enadev/_enamod sequence from current to target state.
+// Changing verb already dismantles every device and modifier, otherwise only differences are applied,
+// modifiers being disabled first and enabled last as they depend on devices.
+
+STATIC json_object *ucmStatePlan(json_object *currentJ, json_object *targetJ) {
+    json_object *planJ = json_object_new_array();
+    json_object *curVerbJ, *curDevsJ, *curModsJ, *verbJ, *devsJ = NULL, *modsJ = NULL;
+    const char *curVerb, *verb;
+    char identifier[128];
+
+    json_object_object_get_ex(currentJ, "verb", &curVerbJ);
+    json_object_object_get_ex(currentJ, "devices", &curDevsJ);
+    json_object_object_get_ex(currentJ, "modifiers", &curModsJ);
+    curVerb = curVerbJ ? json_object_get_string(curVerbJ) : NULL;
+
+    // missing verb keeps current one, missing device/modifier list means none
+    verb = json_object_object_get_ex(targetJ, "verb", &verbJ) && verbJ ? json_object_get_string(verbJ) : curVerb;
+    json_object_object_get_ex(targetJ, "devices", &devsJ);
+    json_object_object_get_ex(targetJ, "modifiers", &modsJ);
+
+    if (!verb) {
+        json_object_put(planJ);
+        return NULL;
+    }
+
+    if (!curVerb || strcmp(curVerb, verb)) {
+        ucmPlanAdd(planJ, "_verb", verb);
+        curDevsJ = NULL;
+        curModsJ = NULL;
+    }
+
+    for (int idx = 0; curModsJ && idx < (int) json_object_array_length(curModsJ); idx++) {
+        const char *mod = json_object_get_string(json_object_array_get_idx(curModsJ, idx));
+        if (!ucmListHas(modsJ, mod)) ucmPlanAdd(planJ, "_dismod", mod);
+    }
+
+    // pair removed devices with added ones to use switch (transition) sequences
+    int addIdx = 0, addCount = devsJ ? (int) json_object_array_length(devsJ) : 0;
+    for (int idx = 0; curDevsJ && idx < (int) json_object_array_length(curDevsJ); idx++) {
+        const char *oldDev = json_object_get_string(json_object_array_get_idx(curDevsJ, idx));
+        const char *newDev = NULL;
+
+        if (ucmListHas(devsJ, oldDev)) continue;
+
+        for (; addIdx < addCount && !newDev; addIdx++) {
+            const char *dev = json_object_get_string(json_object_array_get_idx(devsJ, addIdx));
+            if (!ucmListHas(curDevsJ, dev)) newDev = dev;
+        }
+
+        if (newDev) {
+            snprintf(identifier, sizeof (identifier), "_swdev/%s", oldDev);
+            ucmPlanAdd(planJ, identifier, newDev);
+        } else {
+            ucmPlanAdd(planJ, "_disdev", oldDev);
+        }
+    }
+    for (; addIdx < addCount; addIdx++) {
+        const char *dev = json_object_get_string(json_object_array_get_idx(devsJ, addIdx));
+        if (!ucmListHas(curDevsJ, dev)) ucmPlanAdd(planJ, "_enadev", dev);
+    }
+
+    for (int idx = 0; modsJ && idx < (int) json_object_array_length(modsJ); idx++) {
+        const char *mod = json_object_get_string(json_object_array_get_idx(modsJ, idx));
+        if (!ucmListHas(curModsJ, mod)) ucmPlanAdd(planJ, "_enamod", mod);
+    }
+
+    return planJ;
+}
+
+// Move UCM manager to target state with minimal transitions (dryrun only returns the plan)
+
+STATIC void ucmSetState(afb_req_t request, queryValuesT *queryValues, int ucmIdx, const char *state, int dryrun) {
+    ucmHandleT *ucmHandle = &ucmHandles[ucmIdx];
+    json_object *targetJ, *currentJ = NULL, *planJ = NULL, *responseJ;
+    int err;
+
+    targetJ = json_tokener_parse(state);
+    if (!targetJ || !json_object_is_type(targetJ, json_type_object)) {
+        afb_req_fail_f(request, "ucmset-state", "state=%s not a valid {verb,devices,modifiers} json object", state);
+        goto OnErrorExit;
+    }
+
+    currentJ = ucmStateCurrent(ucmHandle);
+    planJ = ucmStatePlan(currentJ, targetJ);
+    if (!planJ) {
+        afb_req_fail_f(request, "ucmset-state", "SndCard devid=[%s] name=[%s] no current verb and no target verb", queryValues->devid, ucmHandle->cardName);
+        goto OnErrorExit;
+    }
+
+    responseJ = json_object_new_object();
+    json_object_object_add(responseJ, "plan", json_object_get(planJ));
+    if (dryrun) {
+        json_object_object_add(responseJ, "dryrun", json_object_new_boolean(1));
+        afb_req_success(request, responseJ, NULL);
+        goto OnErrorExit;
+    }
+
+    if (json_object_array_length(planJ) > 0) ucmValuesFlush(ucmHandle);
+
+    for (int idx = 0; idx < (int) json_object_array_length(planJ); idx++) {
+        json_object *stepJ = json_object_array_get_idx(planJ, idx), *idJ, *valueJ;
+        json_object_object_get_ex(stepJ, "id", &idJ);
+        json_object_object_get_ex(stepJ, "value", &valueJ);
+
+        err = snd_use_case_set(ucmHandle->ucm, json_object_get_string(idJ), json_object_get_string(valueJ));
+        if (err) {
+            ucmStateChanged(ucmHandle, ucmStateGet(ucmHandle));
+            afb_req_fail_f(request, "ucmset-state", "SndCard devid=[%s] name=[%s] step=%d %s=[%s] err=%s plan=%s", queryValues->devid, ucmHandle->cardName,
+                    idx, json_object_get_string(idJ), json_object_get_string(valueJ), snd_strerror(err), json_object_get_string(planJ));
+            json_object_put(responseJ);
+            goto OnErrorExit;
+        }
+    }
+
+    ucmStateChanged(ucmHandle, ucmStateGet(ucmHandle));
+    json_object_object_add(responseJ, "state", json_object_get(ucmHandle->stateJ));
+    afb_req_success(request, responseJ, NULL);
+
+OnErrorExit:
+    if (targetJ) json_object_put(targetJ);
+    if (currentJ) json_object_put(currentJ);
+    if (planJ) json_object_put(planJ);
+    return;
+}
+
 PUBLIC void alsaUseCaseSet(afb_req_t request) {
     int err, ucmIdx;
     queryValuesT queryValues;
@@ -327,12 +943,24 @@ PUBLIC void alsaUseCaseSet(afb_req_t request) {
     if (!queryJ) goto OnErrorExit;
 
 
-    ucmIdx = alsaUseCaseOpen(request, &queryValues, TRUE);
+    ucmIdx = alsaUseCaseOpen(request, &queryValues, TRUE, alsaUseCaseSet);
     if (ucmIdx < 0) goto OnErrorExit;
 
     snd_use_case_mgr_t *ucmMgr = ucmHandles[ucmIdx].ucm;
     const char *cardName = ucmHandles[ucmIdx].cardName;
 
+    // full target state is reached through a minimal transition plan
+    const char *state = afb_req_value(request, "state");
+    if (state) {
+        json_object *dryrunJ;
+        int dryrun = json_object_object_get_ex(queryJ, "dryrun", &dryrunJ) && json_object_get_boolean(dryrunJ);
+        ucmSetState(request, &queryValues, ucmIdx, state, dryrun);
+        goto OnErrorExit;
+    }
+
+    // even a failing set may have changed context
+    ucmValuesFlush(&ucmHandles[ucmIdx]);
+
     const char *verb = afb_req_value(request, "verb");
     const char *mod = afb_req_value(request, "mod");
     const char *dev = afb_req_value(request, "dev");
@@ -342,7 +970,7 @@ PUBLIC void alsaUseCaseSet(afb_req_t request) {
         err = snd_use_case_set(ucmMgr, "_verb", verb);
         if (err) {
             afb_req_fail_f(request, "ucmset-verb", "SndCard devid=[%s] name=[%s] Invalid UCM verb=[%s] err=%s", queryValues.devid, cardName, verb, snd_strerror(err));
-            goto OnErrorExit;
+            goto OnFailExit;
         }
     }
 
@@ -350,7 +978,7 @@ PUBLIC void alsaUseCaseSet(afb_req_t request) {
         err = snd_use_case_set(ucmMgr, "_enadev", dev);
         if (err) {
             afb_req_fail_f(request, "ucmset-dev", "SndCard devid=[%s] name=[%s] Invalid UCMverb=[%s] dev=%s err=%s", queryValues.devid, cardName, verb, dev, snd_strerror(err));
-            goto OnErrorExit;
+            goto OnFailExit;
         }
     }
 
@@ -358,10 +986,12 @@ PUBLIC void alsaUseCaseSet(afb_req_t request) {
         err = snd_use_case_set(ucmMgr, "_enamod", mod);
         if (err) {
             afb_req_fail_f(request, "ucmset-mod", "SndCard devid=[%s] name=[%s] Invalid UCM verb=[%s] mod=[%s] err=%s", queryValues.devid, cardName, verb, mod, snd_strerror(err));
-            goto OnErrorExit;
+            goto OnFailExit;
         }
     }
 
+    ucmStateChanged(&ucmHandles[ucmIdx], ucmStateGet(&ucmHandles[ucmIdx]));
+
     // label are requested transfert request to get
     if (afb_req_value(request, "value")) return alsaUseCaseGet(request);
 
@@ -378,6 +1008,11 @@ PUBLIC void alsaUseCaseSet(afb_req_t request) {
         if (jValue) json_object_object_add(jResponse, "CapturePCM", jValue);
     }
     afb_req_success(request, jResponse, NULL);
+    return;
+
+OnFailExit:
+    // partial set may still have changed state
+    ucmStateChanged(&ucmHandles[ucmIdx], ucmStateGet(&ucmHandles[ucmIdx]));
 
 OnErrorExit:
     return;
@@ -390,14 +1025,16 @@ PUBLIC void alsaUseCaseReset(afb_req_t request) {
     json_object *queryJ = alsaCheckQuery(request, &queryValues);
     if (!queryJ) goto OnErrorExit;
 
-    ucmIdx = alsaUseCaseOpen(request, &queryValues, FALSE);
+    ucmIdx = alsaUseCaseOpen(request, &queryValues, FALSE, alsaUseCaseReset);
     if (ucmIdx < 0) goto OnErrorExit;
 
+    ucmValuesFlush(&ucmHandles[ucmIdx]);
     err = snd_use_case_mgr_reset(ucmHandles[ucmIdx].ucm);
     if (err) {
         afb_req_fail_f(request, "ucmreset-fail", "devid=%s Card Name=%s", queryValues.devid, ucmHandles[ucmIdx].cardName);
         goto OnErrorExit;
     }
+    ucmStateChanged(&ucmHandles[ucmIdx], ucmStateGet(&ucmHandles[ucmIdx]));
 
     afb_req_success(request, NULL, NULL);
 
@@ -412,22 +1049,55 @@ PUBLIC void alsaUseCaseClose(afb_req_t request) {
     json_object *queryJ = alsaCheckQuery(request, &queryValues);
     if (!queryJ) goto OnErrorExit;
 
-    ucmIdx = alsaUseCaseOpen(request, &queryValues, FALSE);
+    ucmIdx = alsaUseCaseOpen(request, &queryValues, FALSE, alsaUseCaseClose);
     if (ucmIdx < 0) goto OnErrorExit;
 
+    ucmStateChanged(&ucmHandles[ucmIdx], NULL);
+
+    // manager is freed even when close fails, slot is released in both cases
+    pthread_mutex_lock(&ucmHandlesLock);
     err = snd_use_case_mgr_close(ucmHandles[ucmIdx].ucm);
+    ucmHandles[ucmIdx].ucm = NULL;
+    ucmHandleRelease(&ucmHandles[ucmIdx]);
+    pthread_mutex_unlock(&ucmHandlesLock);
+
     if (err) {
-        afb_req_fail_f(request, "ucmreset-close", "devid=%s Card Name=%s", queryValues.devid, ucmHandles[ucmIdx].cardName);
+        afb_req_fail_f(request, "ucmreset-close", "devid=%s err=%s", queryValues.devid, snd_strerror(err));
         goto OnErrorExit;
     }
 
-    // do not forget to release sound card name string
-    free(ucmHandles[ucmIdx].cardName);
-
     afb_req_success(request, NULL, NULL);
 
 OnErrorExit:
     return;
 }
 
+// Return current verb/devices/modifiers of card UCM manager, optionally subscribe to ucm-changed
+
+PUBLIC void alsaUseCaseState(afb_req_t request) {
+    int ucmIdx;
+    queryValuesT queryValues;
+    json_object *responseJ, *tmpJ;
+
+    json_object *queryJ = alsaCheckQuery(request, &queryValues);
+    if (!queryJ) goto OnErrorExit;
+
+    ucmIdx = alsaUseCaseOpen(request, &queryValues, TRUE, alsaUseCaseState);
+    if (ucmIdx < 0) goto OnErrorExit;
+
+    if (json_object_object_get_ex(queryJ, "subscribe", &tmpJ) && json_object_get_boolean(tmpJ)) {
+        if (afb_req_subscribe(request, ucmChangedEvt) != 0) {
+            afb_req_fail_f(request, "register-eventname", "Cannot subscribe ucm-changed event [invalid channel]");
+            goto OnErrorExit;
+        }
+    }
+
+    responseJ = json_object_new_object();
+    json_object_object_add(responseJ, "cardid", json_object_new_int(ucmHandles[ucmIdx].cardId));
+    json_object_object_add(responseJ, "name", json_object_new_string(ucmHandles[ucmIdx].cardName));
+    json_object_object_add(responseJ, "state", ucmStateCurrent(&ucmHandles[ucmIdx]));
+    afb_req_success(request, responseJ, NULL);
 
+OnErrorExit:
+    return;
+}
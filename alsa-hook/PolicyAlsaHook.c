@@ -31,302 +31,201 @@
 #define _GNU_SOURCE
 #include <stdio.h>
 #include <alloca.h>
+#include <errno.h>
+#include <time.h>
 
-#include <alsa/asoundlib.h>
-#include <alsa/conf.h>
-#include <alsa/pcm.h>
-
-#include <systemd/sd-event.h>
-#include <json-c/json.h>
-
-#include "afb/afb-wsj1.h"
-#include "afb/afb-ws-client.h"
-#include "afb/afb-proto-ws.h"
-
-#include <pthread.h>
-#include <semaphore.h>
+#include "PolicyAlsaHook.h"
 
 #define PLUGIN_ENTRY_POINT AlsaInstallHook
     // Fulup Note: What ever you may find on Internet you should use
     // SND_CONFIG_DLSYM_VERSION_HOOK and not SND_CONFIG_DLSYM_VERSION_HOOK
     SND_DLSYM_BUILD_VERSION(PLUGIN_ENTRY_POINT, SND_PCM_DLSYM_VERSION)
 
-// this should be more than enough
-#define MAX_API_CALL 10
-#define MAX_EVT_CALL 10
-
-// timeout in ms
-#define REQUEST_DEFAULT_TIMEOUT 500
-#ifndef MAINLOOP_WATCHDOG
-#define MAINLOOP_WATCHDOG 100000
-#endif
-
 // closing message is added to query when PCM is closed
 #define CLOSING_MSG ",\"source\":-1}"
 
-// Currently not implemented
-#define UNUSED_ARG(x) UNUSED_ ## x __attribute__((__unused__))
 #define  MAGIC_HOOK 22562935
 
-typedef struct {
-    char *apiverb;
-    json_object *queryJ;
-    sd_event_source *evtSource;
-    char *callIdTag;
-    void *afbClient;
-} afbRequestT;
-
-typedef struct {
-    char *search;
-    char *value;
-    long ivalue;
-    int signal;
-} afbEventT;
-
-typedef struct {
-    long magic;
-    char *name;
-    char *uid;
-    snd_pcm_t *pcm;
-    char *uri;
-    struct afb_proto_ws *pws;
-    sd_event *sdLoop;
-    int verbose;
-    int synchronous;
-    sem_t semaphore;
-    long timeout;
-    int count;
-    int errcount;
-    afbRequestT **request;
-    afbRequestT **release;
-    afbEventT **event;
-    pthread_t tid;
-    json_object * streamIdJ;
-} afbClientT;
-
-
-static void *LoopInThread(void *handle) {
-    afbClientT *afbClient = (afbClientT*) handle;
-    int count=0;
-    int watchdog= MAINLOOP_WATCHDOG *1000;
-
-    /* loop until end */
-    for (;;) {
-
-        if (afbClient->verbose) printf("ON-MAINLOOP Session=%s ping=%d\n", afbClient->uid, count++);
-        int  res = sd_event_run(afbClient->sdLoop, watchdog);
-
-        if ( res < 0 )
-        {
-            printf("ERROR in LoopInThread \"%i\" Break ON-MAINLOOP errno=%s.\n", res, strerror(errno));
-            break;
-        }
-    }
-    pthread_exit(0);
-}
-
-// lost connect with the AudioDaemon
-static void OnHangupCB(void *handle) {
-
-    afbClientT *afbClient = (afbClientT*) handle;
-    SNDERR("(Hoops) Lost Connection to %s", afbClient->uri);
-
-    // try to close PCM when impossible terminate client
-    int err = snd_pcm_close (afbClient->pcm);
-    if (err) exit(1);
-}
-
 typedef enum {
     HOOK_INSTALL,
     HOOK_CLOSE,
 } hookActionT;
 
-void OnEventCB(void *handle, const char *event, int evtid, struct json_object *dataJ) {
-    afbClientT *afbClient = (afbClientT*) handle;
-    afbEventT **afbEvent = afbClient->event;
-    json_object *tmpJ;
-    int signal=0, index;
+static void AlsaHookClean (afbClientT *afbClient);
+
+void HookOnEvent(afbClientT *afbClient, const char *event, json_object *dataJ) {
+
+    // PCM closing, application thread owns it
+    if (afbClient->magic != MAGIC_HOOK || afbClient->closing) goto OnErrorExit;
 
     // if no event handler just ignore events
-    if (!afbEvent) goto OnErrorExit;
+    if (!afbClient->event) goto OnErrorExit;
 
-    if (afbClient->verbose) printf("ON-EVENT processing signal event=%s search=%s session=%s\n", event, json_object_get_string(dataJ), afbClient->uid);
+    if (afbClient->verbose) printf("ON-EVENT processing event=%s search=%s session=%s\n", event, json_object_get_string(dataJ), afbClient->uid);
 
-    // loop on event/signal mapping table
-    for (index=0; afbEvent[index]!= NULL; index++) {
-        int done;
+    // hashed search=value lookup, matching entries act directly on PCM
+    HookActionDispatch(afbClient, event, dataJ);
+    return;
 
-        done = json_object_object_get_ex(dataJ,afbEvent[index]->search, &tmpJ);
-        if (done) {
+OnErrorExit:
+    if (afbClient->verbose) SNDERR("ON-EVENT Fail/Ignored %s(%s)\n", event, json_object_get_string(dataJ));
+    return;
+}
 
-            if (afbEvent[index]->value) {
-                // search value is a string
-                if (json_object_get_type(tmpJ) != json_type_string) goto OnErrorExit;
-                const char *value=json_object_get_string(tmpJ);
-                if (!strcmp(afbEvent[index]->value, value)) signal=afbEvent[index]->signal;
+// install decision known (all granted, one failed or deadline), wake opener once (loop lock held)
+static void AlsaHookWake(afbClientT *afbClient) {
+    if (afbClient->woken) return;
+    afbClient->woken = 1;
 
-            } else {
+    if (afbClient->timer) sd_event_source_unref(afbClient->timer);
+    afbClient->timer = NULL;
+    sem_post (&afbClient->semaphore);
+}
 
-                // search value is an integer
-                if (json_object_get_type(tmpJ) != json_type_int) goto OnErrorExit;
-                int ivalue=json_object_get_int(tmpJ);
-                if (ivalue == afbEvent[index]->ivalue) signal=afbEvent[index]->signal;
-            }
-            break;
-       }
+// Return a new reference on request query (stream_id added when known)
+static json_object *AlsaHookQuery(afbClientT *afbClient, const afbRequestT *afbRequest) {
+    json_object *queryJ;
+
+    // if steamId is set then add it to api query
+    if (!afbClient->streamIdJ) return json_object_get(afbRequest->queryJ);
+
+    queryJ=json_object_new_object();
+    json_object_object_foreach(afbRequest->queryJ, key, obj) {
+        json_object_object_add(queryJ, key, json_object_get(obj));
     }
-    if (signal) {
-        if (afbClient->verbose) printf("ON-EVENT self-signal search=%s signal=%d\n", afbEvent[index]->search, afbEvent[index]->signal);
-        if (afbEvent[index]->signal) kill (getpid(), afbEvent[index]->signal);
+    json_object_object_add(queryJ,"stream_id",json_object_get(afbClient->streamIdJ));
+    return queryJ;
+}
+
+// Send one install call on shared connection (loop lock held)
+static int AlsaHookSend(afbClientT *afbClient, int idx) {
+    afbCallT *afbCall = &afbClient->calls[idx];
+    const afbRequestT *afbRequest = afbCall->request;
+    json_object *queryJ;
+    int err;
+
+    // create a unique tag for request
+    if (!afbCall->callIdTag && asprintf(&afbCall->callIdTag, "%d:%s", idx, afbRequest->apiverb) < 0) {
+        afbCall->callIdTag = NULL;
+        return -1;
     }
 
-    return;
+    queryJ = AlsaHookQuery(afbClient, afbRequest);
+    if (afbClient->verbose)  printf("CALL-REQUEST verb=%s query=%s tag=%s session=%s\n", afbRequest->apiverb, json_object_get_string(queryJ), afbCall->callIdTag, afbClient->uid);
+    err = HookConnCall(afbClient->conn, afbRequest->apiverb, queryJ, afbClient->uid, afbCall);
+    json_object_put(queryJ);
+    if (err < 0) {
+        fprintf(stderr, "LaunchCallRequest: Fail ws-client=%s verb=%s session=%s\n", afbClient->uri, afbRequest->apiverb, afbClient->uid);
+        return -1;
+    }
 
-OnErrorExit:
-    if (afbClient->verbose) SNDERR("ON-EVENT Fail/Ignored %s(%s)\n", event, json_object_get_string(dataJ));
-    return;
+    afbCall->state = CALL_PENDING;
+    afbClient->pending++;
+    return 0;
 }
 
-static void OnSuccessCB(void* UNUSED_ARG(ctx) , void* handle, json_object* responseJ, const char* info) {
-
-    afbRequestT *afbRequest= (afbRequestT*)handle;
-    afbClientT *afbClient=(afbClientT*)afbRequest->afbClient;
+static void OnSuccessCB(afbCallT *afbCall, json_object* responseJ, const char* info) {
+    afbClientT *afbClient=afbCall->afbClient;
+    json_object *tmpJ;
 
-    if (afbClient->verbose) printf("OnSuccessCB callid='%s' response='%s' info='%s'\n", afbRequest->callIdTag, json_object_get_string(responseJ), info);
+    if (afbClient->verbose) printf("OnSuccessCB callid='%s' response='%s' info='%s'\n", afbCall->callIdTag, json_object_get_string(responseJ), info);
 
     // as pulse does not close PCM even timeout=0 session is not enough and we have to handle stream_id manually
-    if (json_object_object_get_ex(responseJ, "stream_id", &afbClient->streamIdJ) && afbClient->verbose) {
-        json_object_get(afbClient->streamIdJ);
-        printf("OnSuccessCB session store stream_id='%s'\n", json_object_get_string(afbClient->streamIdJ));
+    if (json_object_object_get_ex(responseJ, "stream_id", &tmpJ)) {
+        if (afbClient->streamIdJ) json_object_put(afbClient->streamIdJ);
+        afbClient->streamIdJ = json_object_get(tmpJ);
+        if (afbClient->verbose) printf("OnSuccessCB session store stream_id='%s'\n", json_object_get_string(afbClient->streamIdJ));
+    }
+
+    // policy may grant a lease, committed once install fully succeeded (a leased open only refreshes stream_id)
+    if (afbClient->lease && !afbClient->leased && json_object_object_get_ex(responseJ, "lease", &tmpJ) && json_object_is_type(tmpJ, json_type_object)) {
+        if (afbClient->leaseJ) json_object_put(afbClient->leaseJ);
+        afbClient->leaseJ = json_object_get(tmpJ);
     }
 
-    // Cancel timeout for this request
-    sd_event_source_unref(afbRequest->evtSource);
-    free(afbRequest->callIdTag);
+    afbCall->state = CALL_DONE;
+    afbClient->waiting--;
+
+    // synchronous mode chains next request from here (it may need stream_id from this reply)
+    if (afbClient->synchronous && afbClient->waiting > 0 && (!afbClient->woken || afbClient->leased)) {
+        if (AlsaHookSend(afbClient, afbClient->callCount - afbClient->waiting) < 0 && !afbClient->leased) {
+            afbClient->errcount++;
+            AlsaHookWake(afbClient);
+        }
+        return;
+    }
 
     // When not more waiting call release semaphore
-    afbClient->count--;
-    if (afbClient->synchronous) {
-        if (afbClient->verbose) printf("OnSuccessCB One Request Done\n");
-        sem_post (&afbClient->semaphore);
-    } else if (afbClient->count == 0) {
+    if (afbClient->waiting == 0) {
         if (afbClient->verbose) printf("OnSuccessCB No More Waiting Request\n");
-        sem_post (&afbClient->semaphore);
+        AlsaHookWake(afbClient);
     }
 }
 
-static void OnFailureCB(void* UNUSED_ARG(ctx), void* handle, const char *status, const char *info) {
+static void OnFailureCB(afbCallT *afbCall, const char *status, const char *info) {
+    afbClientT *afbClient=afbCall->afbClient;
 
-    afbRequestT *afbRequest= (afbRequestT*)handle;
-    afbClientT *afbClient=(afbClientT*)afbRequest->afbClient;
+    if (afbClient->verbose) printf("OnFailureCB callid='%s' status='%s' info='%s'\n", afbCall->callIdTag, status, info);
 
-    if (afbClient->verbose) printf("OnFailureCB callid='%s' status='%s' info='%s'\n", afbRequest->callIdTag, status, info);
-
-    // Cancel timeout for this request
-    sd_event_source_unref(afbRequest->evtSource);
-    free(afbRequest->callIdTag);
+    afbCall->state = CALL_FAILED;
+    afbClient->waiting--;
 
+    // leased open already granted, agent only missed the notification
+    if (afbClient->leased) {
+        SNDERR("Leased open notification fail pcm=%s status=%s", afbClient->name, status);
+        return;
+    }
     afbClient->errcount++;
-    sem_post (&afbClient->semaphore);
+    AlsaHookWake(afbClient);
 }
 
-#if defined(AFB_PROTO_WS_VERSION) && (AFB_PROTO_WS_VERSION >= 3)
-static void OnReplyCB(void* ctx, void* handle, json_object* responseJ, const char *error, const char *info) {
-    if (error)
-        OnFailureCB(ctx, handle, error, info);
-    else
-        OnSuccessCB(ctx , handle, responseJ, info);
-}
-#endif
-
-/* the callback interface for pws */
-static struct afb_proto_ws_client_itf itf = {
-#if defined(AFB_PROTO_WS_VERSION) && (AFB_PROTO_WS_VERSION >= 3)
-    .on_reply = OnReplyCB,
-#else
-    .on_reply_success = OnSuccessCB,
-    .on_reply_fail = OnFailureCB,
-    .on_subcall = NULL,
-#endif
-    .on_event_create = NULL,
-    .on_event_remove = NULL,
-    .on_event_subscribe = NULL,
-    .on_event_unsubscribe = NULL,
-    .on_event_push = OnEventCB,
-    .on_event_broadcast = NULL,
-};
-
-int OnTimeoutCB (sd_event_source* source, uint64_t timer, void* handle) {
-    afbClientT *afbClient= (afbClientT*)handle;
-
-    SNDERR("\nON-TIMEOUT Call Request Fail session=%s\n", afbClient->uid );
-
-    // Close PCM and release waiting client
-    afbClient->errcount=1;
-    sem_post (&afbClient->semaphore);
+// reply from shared connection (loop thread, loop lock held)
+void HookOnReply(void *handle, json_object *responseJ, const char *error, const char *info) {
+    afbCallT *afbCall= (afbCallT*)handle;
+    afbClientT *afbClient=afbCall->afbClient;
 
-    return 0;
-}
+    afbClient->pending--;
 
-// Call AGL binder asynchronously by with a timeout
-static int CallWithTimeout(afbClientT *afbClient, afbRequestT *afbRequest, int count) {
-    uint64_t usec;
-    json_object *queryJ;
-    int err;
+    // PCM already closed, last late reply frees client
+    if (afbClient->magic != MAGIC_HOOK) {
+        if (afbClient->pending == 0) AlsaHookClean(afbClient);
+        return;
+    }
 
-    // create a unique tag for request
-    if(asprintf(&afbRequest->callIdTag, "%d:%s", count, afbRequest->apiverb) < 0) {
-        printf("Couldn't allocate request call unique id tag string\n");
-        goto OnErrorExit;
+    // late reply: install already decided (deadline or earlier failure), or call not in flight
+    if (afbCall->state != CALL_PENDING || (afbClient->woken && !afbClient->leased)) {
+        if (afbClient->verbose) printf("HookOnReply ignore late reply callid='%s' state=%d error=%s\n", afbCall->callIdTag, afbCall->state, error ? error : "none");
+        if (afbCall->state == CALL_PENDING) afbCall->state = error ? CALL_FAILED : CALL_DONE;
+        return;
     }
 
-    // create a timer with ~250us accuracy
-    sd_event_now(afbClient->sdLoop, CLOCK_MONOTONIC, &usec);
-    sd_event_add_time(afbClient->sdLoop, &afbRequest->evtSource, CLOCK_MONOTONIC, usec+afbClient->timeout*1000, 250, OnTimeoutCB, afbClient);
+    if (error)
+        OnFailureCB(afbCall, error, info);
+    else
+        OnSuccessCB(afbCall, responseJ, info);
+}
 
-    // if steamId is set then add it to api query
-    if (!afbClient->streamIdJ) {
-       queryJ=afbRequest->queryJ;
-    } else {
-       queryJ=json_object_new_object();
-       json_object_object_foreach(afbRequest->queryJ, key, obj) {
-         json_object_object_add(queryJ, key, obj);
-       }
-        json_object_object_add(queryJ,"stream_id",afbClient->streamIdJ);
-    }
+// one deadline for the whole install sequence
+static int OnTimeoutCB (sd_event_source* UNUSED_ARG(source), uint64_t UNUSED_ARG(timer), void* handle) {
+    afbClientT *afbClient= (afbClientT*)handle;
 
-    // release action is optional
-    if (afbRequest->apiverb) {
-        if (afbClient->verbose)  printf("CALL-REQUEST verb=%s query=%s tag=%s session=%s\n", afbRequest->apiverb, json_object_get_string(queryJ), afbRequest->callIdTag, afbClient->uid);
-        err = afb_proto_ws_client_call(afbClient->pws, afbRequest->apiverb, queryJ, afbClient->uid, afbRequest
-#if defined(AFB_PROTO_WS_VERSION) && (AFB_PROTO_WS_VERSION >= 3)
-			, NULL
-#endif
-		);
-        if (err < 0 ) goto OnErrorExit;
-    }
+    sd_event_source_unref(afbClient->timer);
+    afbClient->timer = NULL;
+    if (afbClient->magic != MAGIC_HOOK || afbClient->woken) return 0;
+    // nothing sent yet: opener is still connecting and counts the failure itself
+    if (afbClient->pending > 0) HookConnFailed(afbClient->conn);
 
-    // save client handle in request
-    afbRequest->afbClient = afbClient;
-    afbClient->count ++;
+    SNDERR("\nON-TIMEOUT Call Request Fail session=%s waiting=%d/%d\n", afbClient->uid, afbClient->waiting, afbClient->callCount);
 
-    // in synchronous mode we wait for CB to return
-    if (afbClient->synchronous) {
-        sem_wait(&afbClient->semaphore);
-        if (afbClient->errcount) {
-            printf("CALL-REQUEST FAILED afbClient->errcount=%d session=%s \n", afbClient->errcount,afbClient->uid);
-            goto OnErrorExit;
-        }
-    }
+    // Close PCM and release waiting client
+    afbClient->errcount=1;
+    AlsaHookWake(afbClient);
 
     return 0;
-
-OnErrorExit:
-    fprintf(stderr, "LaunchCallRequest: Fail ws-client=%s query=%s&%s\n", afbClient->uri, afbRequest->apiverb, json_object_get_string(afbRequest->queryJ));
-    return 1;
 }
 
 static int LaunchCallRequest(afbClientT *afbClient, hookActionT action) {
+    uint64_t usec;
     int err, idx;
 
     // each callback on error add one to error count.
@@ -341,41 +240,67 @@ static int LaunchCallRequest(afbClientT *afbClient, hookActionT action) {
                fprintf(stderr, "LaunchCallRequest: Fail Semaphore Init: %s\n", afbClient->uri);
             }
 
-            // Create a main loop
-            err = sd_event_new(&afbClient->sdLoop);
-            if (err < 0) {
-                fprintf(stderr, "LaunchCallRequest: Connection to default event loop failed: %s\n", strerror(-err));
-                goto OnErrorExit;
-            }
-
-            // start a thread with a mainloop to monitor Audio-Agent
-            err = pthread_create(&afbClient->tid, NULL, &LoopInThread, afbClient);
-            if (err) goto OnErrorExit;
-
-            afbClient->pws = afb_ws_client_connect_api(afbClient->sdLoop, afbClient->uri, &itf, afbClient);
-            if (afbClient->pws == NULL) {
+            // attach to the process wide Audio-Agent connection (created on first PCM)
+            afbClient->conn = HookConnGet(afbClient->uri, afbClient);
+            if (!afbClient->conn) {
                 fprintf(stderr, "LaunchCallRequest: Connection to %s failed\n", afbClient->uri);
                 goto OnErrorExit;
             }
             if (afbClient->verbose) printf ("LaunchCallRequest:optional HOOK_OPEN uri=%s\n", afbClient->uri);
 
-            // register hanghup callback
-            afb_proto_ws_on_hangup(afbClient->pws, OnHangupCB);
-
-
             // If no request exit now
             if (!afbClient->release) {
                 fprintf(stderr, "LaunchCallRequest: HOOK_INSTALL:fatal mandatory request call missing in asoundrc\n");
                 goto OnErrorExit;;
             }
 
-            // send call request to audio-agent asynchronously (respond with thread mainloop context)
-            for (idx = 0; afbClient->request[idx] != NULL; idx++) {
-                err = CallWithTimeout(afbClient, afbClient->request[idx], idx);
-                if (err) goto OnErrorExit;
+            // agent unreachable: answer at once with configured fail-open/closed decision
+            HookLoopLock();
+            int breaker = HookConnBreakerOpen(afbClient->conn);
+            HookLoopUnlock();
+            if (breaker) {
+                fprintf(stderr, "LaunchCallRequest: agent %s unreachable (breaker open) %s pcm=%s\n", afbClient->uri, afbClient->failopen ? "grant" : "deny", afbClient->name);
+                if (!afbClient->failopen) afbClient->errcount = 1;
+                afbClient->leased = 1;
+                break;
             }
-            // launch counter to keep track of waiting request call
-            afbClient->count=idx;
+
+            // a valid lease grants the PCM without waiting, install calls still notify the agent and
+            // return this open own stream_id (no deadline, a close before reply releases without it)
+            if (afbClient->lease && HookLeaseCheck(afbClient->name, afbClient->role)) {
+                if (afbClient->verbose) printf("HOOK_INSTALL lease hit pcm=%s role=%s\n", afbClient->name, afbClient->role ? afbClient->role : "");
+                afbClient->leased = 1;
+                HookLoopLock();
+                afbClient->woken = 1;
+                afbClient->waiting = afbClient->callCount;
+                for (idx = 0; idx < (afbClient->synchronous ? 1 : afbClient->callCount); idx++) {
+                    if (AlsaHookSend(afbClient, idx) < 0) break;
+                }
+                HookLoopUnlock();
+                break;
+            }
+
+            // nothing to ask for
+            if (afbClient->callCount == 0) {
+                afbClient->leased = 1;
+                break;
+            }
+
+            // all requests pipelined (or chained from reply in synchronous mode) against one deadline
+            HookLoopLock();
+            afbClient->waiting = afbClient->callCount;
+            sd_event_now(HookLoopGet(), CLOCK_MONOTONIC, &usec);
+            sd_event_add_time(HookLoopGet(), &afbClient->timer, CLOCK_MONOTONIC, usec+afbClient->timeout*1000, 250, OnTimeoutCB, afbClient);
+
+            for (idx = 0; idx < (afbClient->synchronous ? 1 : afbClient->callCount); idx++) {
+                err = AlsaHookSend(afbClient, idx);
+                if (err) {
+                    afbClient->errcount++;
+                    AlsaHookWake(afbClient);
+                    break;
+                }
+            }
+            HookLoopUnlock();
             break;
         }
 
@@ -387,13 +312,15 @@ static int LaunchCallRequest(afbClientT *afbClient, hookActionT action) {
                 break;
             }
 
-            // send call request to audio-agent asynchronously (respond with thread mainloop context)
-            for (idx = 0; afbClient->release[idx] != NULL; idx++) {
-                err = CallWithTimeout(afbClient, afbClient->release[idx], idx);
-                if (err) goto OnErrorExit;
+            // fire and forget: queued on shared connection, sent in order once close returned
+            HookLoopLock();
+            for (idx = 0; idx < afbClient->config->releaseCount; idx++) {
+                const afbRequestT *afbRelease = afbClient->release[idx];
+                if (!afbRelease->apiverb) continue;
+                if (afbClient->verbose)  printf("POST-RELEASE verb=%s session=%s\n", afbRelease->apiverb, afbClient->uid);
+                HookConnPost(afbClient->conn, afbRelease->apiverb, AlsaHookQuery(afbClient, afbRelease), afbClient->uid);
             }
-            // launch counter to keep track of waiting request call
-            afbClient->count=idx;
+            HookLoopUnlock();
             break;
         }
 
@@ -408,374 +335,272 @@ OnErrorExit:
     return 1;
 }
 
+// loop lock held (AlsaHookRelease or late reply), compiled config is shared and stays cached
 static void AlsaHookClean (afbClientT *afbClient)
 {
     free(afbClient->uid);
     free(afbClient->name);
-    free(afbClient->uri);
-    if (afbClient->event) {
-        afbEventT **afbEvent=afbClient->event;
-        for (int index=0; afbEvent[index]!= NULL; index++) {
-            free(afbEvent[index]->search);
-            free(afbEvent[index]->value);
-        }
-        free(afbEvent);
-    }
-    if (afbClient->request) {
-        afbRequestT **afbRequest=afbClient->request;
-        for (int index=0; afbRequest[index]!= NULL; index++) {
-            free(afbRequest[index]->apiverb);
-            json_object_put(afbRequest[index]->queryJ);
-        }
-        free(afbRequest);
-    }
-    if (afbClient->release) {
-        afbRequestT **afbRelease=afbClient->release;
-        for (int index=0; afbRelease[index]!= NULL; index++) {
-            free(afbRelease[index]->apiverb);
-            json_object_put(afbRelease[index]->queryJ);
-        }
-        free(afbRelease);
+    if (afbClient->leaseJ) json_object_put(afbClient->leaseJ);
+    if (afbClient->calls) {
+        for (int index=0; index < afbClient->callCount; index++) free(afbClient->calls[index].callIdTag);
+        free(afbClient->calls);
     }
+    if (afbClient->timer) sd_event_source_unref(afbClient->timer);
+    HookActionClean(afbClient);
+    HookStatsClean(afbClient);
     afbClient->magic=0;
 
-    // free systemd loop
-    if (afbClient->sdLoop) sd_event_unref(afbClient->sdLoop);
     if (afbClient->streamIdJ) json_object_put(afbClient->streamIdJ);
-    // close binder websocket
-    //ISSUE for Jose
-    //if (afbClient->pws) afb_proto_ws_unref(afbClient->pws);
+    sem_destroy(&afbClient->semaphore);
     free(afbClient);
 }
 
+// detach client from shared connection, free it now or on last pending (timed out) reply
+static void AlsaHookRelease (afbClientT *afbClient)
+{
+    HookConnRelease(afbClient->conn, afbClient);
+    HookConnRelease(afbClient->statsConn, NULL);
+
+    HookLoopLock();
+    afbClient->magic=0;
+    if (afbClient->pending == 0) AlsaHookClean(afbClient);
+    HookLoopUnlock();
+}
+
 static int AlsaCloseHook(snd_pcm_hook_t *hook) {
 
     afbClientT *afbClient = (afbClientT*) snd_pcm_hook_get_private (hook);
     //hook is already close
     if (!afbClient || afbClient->magic != MAGIC_HOOK ) {
-        if (afbClient->verbose) printf("AlsaCloseHook Ignored, invalid afbClient\n");
+        if (afbClient && afbClient->verbose) printf("AlsaCloseHook Ignored, invalid afbClient\n");
         return 0;
     }
-    // launch call request and create a waiting mainloop thread
+    // stop event actions before application thread tears PCM down
+    HookLoopLock();
+    afbClient->closing = 1;
+    HookActionClean(afbClient);
+    HookLoopUnlock();
+
+    // queue release calls, close never waits for audio-agent
+    uint64_t start = HookStatsNow();
     int err = LaunchCallRequest(afbClient, HOOK_CLOSE);
-    if (err < 0) {
-        fprintf (stderr, "Error on PCM Release Call\n");
-        goto OnErrorExit;
+    afbClient->releaseUsec = HookStatsNow() - start;
+
+    if (afbClient->config->telemetry) {
+        HookLoopLock();
+        HookStatsClose(afbClient);
+        HookLoopUnlock();
     }
 
-    // wait for all call request to return
-    if (afbClient->errcount) {
-        fprintf (stderr, "AlsaCloseHook: Notice exit before audio-4a response\n");
+    if (err) {
+        fprintf (stderr, "Error on PCM Release Call\n");
         goto OnErrorExit;
     }
 
-    // request main loop to terminate without signal
-    if (afbClient->verbose) printf("AlsaCloseHook: Start pthread_cancel request\n");
-    int s = pthread_cancel(afbClient->tid);
-    if (s != 0)
-       printf("AlsaCloseHook: ERROR on pthread_cancel err %d\n",s);
-
-    /* Join with thread to see what its exit status was */
-    void *res;
-    s = pthread_join(afbClient->tid, &res);
-    if (s != 0)
-        printf("AlsaCloseHook: ERROR on pthread_join err %d\n",s);
+    // shared loop and connection stay alive for other/next PCMs
+    if (afbClient->verbose) fprintf(stdout, "\nAlsaHook Close Success PCM=%s URI=%s\n", snd_pcm_name(afbClient->pcm), afbClient->uri);
 
-    if (res == PTHREAD_CANCELED) {
-        if (afbClient->verbose) fprintf(stdout, "\nAlsaHook Close Success PCM=%s URI=%s\n", snd_pcm_name(afbClient->pcm), afbClient->uri);
-    } else {
-        printf("AlsaCloseHook: EventLoop thread failed to canceled (shouldn't happen!)\n");
-    }
-
-    AlsaHookClean(afbClient);
     snd_pcm_hook_set_private(hook,NULL);
+    AlsaHookRelease(afbClient);
     return 0;
 
 OnErrorExit:
     fprintf(stderr, "\nAlsaPcmHook Plugin Close Fail PCM=%s\n", snd_pcm_name(afbClient->pcm));
+    snd_pcm_hook_set_private(hook,NULL);
+    AlsaHookRelease(afbClient);
     return 0;
 }
 
-// Get an asoundrc compound and return it as a JSON object
-static json_object* AlsaGetJson (snd_config_t *ctlconfig, const char *id, const char*label) {
-
-    json_object *queryJ;
-    snd_config_type_t ctype;
-    char* query;
-
-    // each control is a sting that contain a json object
-    ctype = snd_config_get_type(ctlconfig);
-    snd_config_get_string(ctlconfig,  (const char**) &query);
-    if (ctype != SND_CONFIG_TYPE_STRING) {
-        SNDERR("Invalid signal number for %s value=%s", label, query);
-        goto OnErrorExit;
-    }
+// install fully granted, keep policy lease for next opens of this pcm/role
+static void AlsaHookGranted(afbClientT *afbClient) {
+    int err;
 
-    // cleanup string for json_tokener
-    for (int idx = 0; query[idx] != '\0'; idx++) {
-        if (query[idx] == '\'') query[idx] = '"';
-    }
-    queryJ = json_tokener_parse(query);
-    if (!queryJ) {
-        SNDERR("Not a valid Json object control='%s' query='%s'", id, query);
-        goto OnErrorExit;
+    if (afbClient->leaseJ) {
+        HookLoopLock();
+        err = HookLeaseGrant(afbClient->name, afbClient->role, afbClient->leaseJ);
+        HookLoopUnlock();
+        if (afbClient->verbose && !err) printf("AlsaHook lease stored pcm=%s lease=%s\n", afbClient->name, json_object_get_string(afbClient->leaseJ));
     }
 
-    return queryJ;
-
-OnErrorExit:
-    return NULL;
+    if (afbClient->verbose) fprintf(stdout, "\nAlsaHook Install Success PCM=%s URI=%s\n", afbClient->name, afbClient->uri);
 }
 
-static int AlsaGetActions (snd_config_t *node, afbRequestT **afbRequest, const char*id) {
-    const char *callConf, *apiverb;
-    snd_config_type_t ctype;
-    snd_config_iterator_t currentCall, follow;
-    int callCount=0;
-
-    ctype = snd_config_get_type(node);
-    if (ctype != SND_CONFIG_TYPE_COMPOUND) {
-        snd_config_get_string(node, &callConf);
-        SNDERR("Invalid compound type for %s", callConf);
-        goto OnErrorExit;
-    }
-
-
-    // loop on each call
-    snd_config_for_each(currentCall, follow, node) {
-        snd_config_t *ctlconfig = snd_config_iterator_entry(currentCall);
-
-        // ignore empty line
-        if (snd_config_get_id(ctlconfig, &apiverb) < 0) continue;
-
-        // allocate an empty call request
-        afbRequest[callCount] = calloc(1, sizeof (afbRequestT));
-        afbRequest[callCount]->apiverb=strdup(apiverb);
-        afbRequest[callCount]->queryJ= AlsaGetJson(ctlconfig, id, apiverb);
-        if (!afbRequest[callCount]->queryJ) goto OnErrorExit;
+// async mode: stream cannot start before hw_params, hold it here until policy decision
+static int AlsaHwParamsHook(snd_pcm_hook_t *hook) {
+    afbClientT *afbClient = (afbClientT*) snd_pcm_hook_get_private (hook);
 
-        // move to next call if any
-        callCount ++;
-        if (callCount == MAX_EVT_CALL) {
-            SNDERR("Too Many call MAX_EVT_CALL=%d", MAX_EVT_CALL);
-            goto OnErrorExit;
+    if (!afbClient || afbClient->magic != MAGIC_HOOK) return 0;
+
+    if (!afbClient->decided) {
+        uint64_t start = HookStatsNow();
+        if (afbClient->verbose) printf("AlsaHwParamsHook: waiting policy decision pcm=%s\n", afbClient->name);
+        while (sem_clockwait(&afbClient->semaphore, CLOCK_MONOTONIC, &afbClient->deadline) < 0) {
+            if (errno == EINTR) continue;
+            SNDERR("AlsaHwParamsHook: no policy decision before deadline pcm=%s", afbClient->name);
+            HookLoopLock();
+            afbClient->errcount = 1;
+            HookLoopUnlock();
+            break;
         }
-        afbRequest[callCount]=NULL; // afbEvent array is NULL terminated
+        afbClient->decided = 1;
+        afbClient->installUsec += HookStatsNow() - start;
+        if (!afbClient->errcount) AlsaHookGranted(afbClient);
     }
 
-    return 0;
+    if (!afbClient->errcount) return 0;
 
-OnErrorExit:
-    return 1;
-}
-
-static int AlsaGetEvents (snd_config_t *node, afbEventT **afbEvent, const char*id) {
-
-    const char *confEvents, *evtpattern;
-    snd_config_type_t ctype;
-    snd_config_iterator_t currentEvt, follow;
-    snd_config_t *itemConf;
-    int callCount=0;
-    int err;
-
-    ctype = snd_config_get_type(node);
-    if (ctype != SND_CONFIG_TYPE_COMPOUND) {
-        snd_config_get_string(node, &confEvents);
-        SNDERR("Invalid compound type for %s", confEvents);
-        goto OnErrorExit;
+    if (afbClient->deny == HOOK_DENY_IGNORE) {
+        fprintf (stderr, "PCM Authorisation Deny ignored pcm=%s\n", afbClient->name);
+        return 0;
     }
 
-    // loop on each call
-    snd_config_for_each(currentEvt, follow, node) {
-        snd_config_t *ctlconfig = snd_config_iterator_entry(currentEvt);
-
-        // ignore empty line
-        if (snd_config_get_id(ctlconfig, &evtpattern) < 0) continue;
-
-        // allocate an empty call request
-        afbEvent[callCount] = calloc(1, sizeof (afbEventT));
-
-        // extract signal num from config label
-        for (int idx=0; evtpattern[idx] != '\0'; idx++) {
-            if (evtpattern[idx]=='-' && evtpattern[idx+1] != '\0') {
-                int done= sscanf (&evtpattern[idx+1], "%d",&afbEvent[callCount]->signal);
-                if (done != 1) {
-                    SNDERR("Invalid Signal '%s' definition should be something like Sig-xx", evtpattern);
-                    goto OnErrorExit;
-                }
-                break;
-            }
-        }
-
-        // extract signal key value search pattern
-        ctype = snd_config_get_type(ctlconfig);
-        if (ctype != SND_CONFIG_TYPE_COMPOUND) {
-            snd_config_get_string(ctlconfig, &confEvents);
-            SNDERR("Invalid event search pattern for %s value=%s", evtpattern, confEvents);
-            goto OnErrorExit;
-        }
+    fprintf (stderr, "PCM Authorisation Deny from AAAA Controller (AGL Advanced Audio Agent)\n");
+    return -EACCES;
+}
 
-        // pattern should have a search
-        err = snd_config_search(ctlconfig, "search", &itemConf);
-        if (!err) {
-            const char *search;
-            if (snd_config_get_string(itemConf, &search) < 0) {
-                SNDERR("Invalid event/signal 'search' should be a string %s", confEvents);
-                goto OnErrorExit;
-            }
-            afbEvent[callCount]->search=strdup(search);
-        } else {
-            SNDERR("Missing 'search' from event/signal 'search' from signal definition %s", confEvents);
-            goto OnErrorExit;
-        }
+// telemetry: sample stream status between hw_params and hw_free
+static int AlsaStatsParamsHook(snd_pcm_hook_t *hook) {
+    afbClientT *afbClient = (afbClientT*) snd_pcm_hook_get_private (hook);
 
-        // pattern should have a value
-        err = snd_config_search(ctlconfig, "value", &itemConf);
-        if (!err) {
-            const char *value;
-            switch (snd_config_get_type(itemConf)) {
-                case SND_CONFIG_TYPE_INTEGER:
-                    snd_config_get_integer(itemConf, &afbEvent[callCount]->ivalue);
-                    break;
+    if (!afbClient || afbClient->magic != MAGIC_HOOK) return 0;
+    HookLoopLock();
+    HookStatsStart(afbClient);
+    HookLoopUnlock();
+    return 0;
+}
 
-                case  SND_CONFIG_TYPE_STRING:
-                    snd_config_get_string(itemConf, &value);
-                    afbEvent[callCount]->value=strdup(value);
-                    break;
-                default:
-                    SNDERR("Invalid event/signal 'value' should be a string %s", confEvents);
-                    goto OnErrorExit;
-            }
-        } else {
-            SNDERR("Missing 'value' from event/signal 'value' from signal definition %s", confEvents);
-            goto OnErrorExit;
-        }
+static int AlsaStatsFreeHook(snd_pcm_hook_t *hook) {
+    afbClientT *afbClient = (afbClientT*) snd_pcm_hook_get_private (hook);
 
-        // move to next call if any
-        callCount ++;
-        if (callCount == MAX_EVT_CALL) {
-            SNDERR("Too Many call MAX_EVT_CALL=%d", MAX_EVT_CALL);
-            goto OnErrorExit;
-        }
-        afbEvent[callCount]=NULL; // afbEvent array is NULL terminated
-    }
+    if (!afbClient || afbClient->magic != MAGIC_HOOK) return 0;
+    HookLoopLock();
+    HookStatsStop(afbClient);
+    HookLoopUnlock();
     return 0;
-
-OnErrorExit:
-    return 1;
 }
 
 // Function call when Plugin PCM is OPEN
 int PLUGIN_ENTRY_POINT (snd_pcm_t *pcm, snd_config_t *conf) {
-    snd_pcm_hook_t *h_close = NULL;
-    snd_config_iterator_t it, next;
+    snd_pcm_hook_t *h_close = NULL, *h_hwparams = NULL, *h_statsparams = NULL, *h_statsfree = NULL;
+    const hookConfigT *config;
     afbClientT *afbClient = calloc(1,sizeof (afbClientT));
-    int err;
+    uint64_t start;
+    int err, status = 0;
 
     // start populating client handle
     afbClient->pcm = pcm;
     afbClient->name= strdup(snd_pcm_name(pcm));
-    afbClient->verbose = 0;
     if(asprintf(&afbClient->uid, "hook:%s:%d", afbClient->name, getpid()) < 0) {
         SNDERR("Couldn't allocate client uid string");
         goto OnErrorExit;
     }
-    // Get PCM arguments from asoundrc
 
     printf("HookEntry handle=0x%p pcm=%s\n", afbClient, afbClient->name);
-    snd_config_for_each(it, next, conf) {
-        snd_config_t *node = snd_config_iterator_entry(it);
-        const char *id;
-
-        // ignore comment en empty lines
-        if (snd_config_get_id(node, &id) < 0) continue;
-        if (strcmp(id, "comment") == 0 || strcmp(id, "hint") == 0) continue;
-
-        if (strcmp(id, "uri") == 0) {
-            const char *uri;
-            if (snd_config_get_string(node, &uri) < 0) {
-                SNDERR("Invalid String for %s", id);
-                goto OnErrorExit;
-            }
-            afbClient->uri=strdup(uri);
-            continue;
-        }
-
-        if (strcmp(id, "verbose") == 0) {
-            afbClient->verbose= snd_config_get_bool(node);
-            if (afbClient->verbose < 0) {
-                SNDERR("Invalid Boolean for %s", id);
-                goto OnErrorExit;
-            }
-            continue;
-        }
 
-        if (strcmp(id, "synchronous") == 0) {
-            afbClient->synchronous= snd_config_get_bool(node);
-            if (afbClient->synchronous < 0) {
-                SNDERR("Invalid Boolean for %s", id);
-                goto OnErrorExit;
-            }
-            continue;
-        }
+    // Get PCM arguments from asoundrc (compiled once per distinct hook_args)
+    config = HookConfigGet(conf);
+    if (!config) goto OnErrorExit;
+
+    afbClient->config = config;
+    afbClient->uri = config->uri;
+    afbClient->role = config->role;
+    afbClient->verbose = config->verbose;
+    afbClient->synchronous = config->synchronous;
+    afbClient->timeout = config->timeout;
+    afbClient->lease = config->lease;
+    afbClient->failopen = config->failopen;
+    afbClient->async = config->async;
+    afbClient->deny = config->deny;
+    afbClient->request = config->request;
+    afbClient->release = config->release;
+    afbClient->event = config->event;
+
+    // batch mode sends the whole request list as a single call
+    if (config->batch) {
+        afbClient->callCount = 1;
+        afbClient->calls = calloc(1, sizeof (afbCallT));
+        afbClient->calls[0].request = config->batch;
+    } else {
+        afbClient->callCount = config->requestCount;
+        afbClient->calls = calloc((size_t) config->requestCount + 1, sizeof (afbCallT));
+        for (int idx = 0; idx < config->requestCount; idx++) afbClient->calls[idx].request = config->request[idx];
+    }
+    for (int idx = 0; idx < afbClient->callCount; idx++) afbClient->calls[idx].afbClient = afbClient;
 
-        if (strcmp(id, "timeout") == 0) {
-            if (snd_config_get_integer(node, &afbClient->timeout) < 0) {
-                SNDERR("Invalid timeout Integer %s", id);
-                goto OnErrorExit;
-            }
-            continue;
-        }
+    if (afbClient->verbose) fprintf(stdout, "\nAlsaHook Install Start PCM=%s URI=%s\n", snd_pcm_name(afbClient->pcm), afbClient->uri);
 
-        if (strcmp(id, "request") == 0) {
-            afbClient->request =  malloc(MAX_API_CALL * sizeof(afbRequestT*));;
-            int err= AlsaGetActions(node, afbClient->request , id);
-            if (err) goto OnErrorExit;
-            continue;
-        }
+    err = snd_pcm_hook_add(&h_close, afbClient->pcm, SND_PCM_HOOK_TYPE_CLOSE, AlsaCloseHook, afbClient);
+    if (err < 0) goto OnErrorExit;
 
-        if (strcmp(id, "release") == 0) {
-            afbClient->release =  malloc(MAX_API_CALL * sizeof(afbRequestT*));;
-            int err= AlsaGetActions(node, afbClient->release, id);
-            if (err) goto OnErrorExit;
-            continue;
+    // async open: requests are pipelined with application setup, decision is collected at hw_params
+    if (afbClient->async) {
+        clock_gettime(CLOCK_MONOTONIC, &afbClient->deadline);
+        afbClient->deadline.tv_sec += afbClient->timeout / 1000;
+        afbClient->deadline.tv_nsec += (afbClient->timeout % 1000) * 1000000;
+        if (afbClient->deadline.tv_nsec >= 1000000000) {
+            afbClient->deadline.tv_sec++;
+            afbClient->deadline.tv_nsec -= 1000000000;
         }
 
-        if (strcmp(id, "events") == 0) {
-            afbClient->event=  malloc(MAX_API_CALL * sizeof(afbRequestT*));;
-            int err= AlsaGetEvents(node, afbClient->event, id);
-            if (err) goto OnErrorExit;
-            continue;
-        }
+        err = snd_pcm_hook_add(&h_hwparams, afbClient->pcm, SND_PCM_HOOK_TYPE_HW_PARAMS, AlsaHwParamsHook, afbClient);
+        if (err < 0) goto OnErrorExit;
     }
 
-    if (afbClient->verbose) fprintf(stdout, "\nAlsaHook Install Start PCM=%s URI=%s\n", snd_pcm_name(afbClient->pcm), afbClient->uri);
+    // registered after async gate, a denied hw_params never starts sampling
+    if (config->telemetry) {
+        err = snd_pcm_hook_add(&h_statsparams, afbClient->pcm, SND_PCM_HOOK_TYPE_HW_PARAMS, AlsaStatsParamsHook, afbClient);
+        if (err < 0) goto OnErrorExit;
+        err = snd_pcm_hook_add(&h_statsfree, afbClient->pcm, SND_PCM_HOOK_TYPE_HW_FREE, AlsaStatsFreeHook, afbClient);
+        if (err < 0) goto OnErrorExit;
+        afbClient->statsConn = HookConnGet(config->telemetryUri, NULL);
+    }
 
-    err = snd_pcm_hook_add(&h_close, afbClient->pcm, SND_PCM_HOOK_TYPE_CLOSE, AlsaCloseHook, afbClient);
-    if (err < 0) goto OnErrorExit;
     afbClient->magic=MAGIC_HOOK;
     // launch call request and create a waiting mainloop thread
+    start = HookStatsNow();
     err = LaunchCallRequest(afbClient, HOOK_INSTALL);
-    if (err < 0) {
+    if (err) {
         fprintf (stderr, "PCM Fail to Get Authorisation\n");
         goto OnErrorExit;
     }
 
+    // lease or breaker already answered
+    if (afbClient->leased) afbClient->decided = 1;
+
+    if (afbClient->async && !afbClient->decided) {
+        afbClient->installUsec = HookStatsNow() - start;
+        if (afbClient->verbose) fprintf(stdout, "\nAlsaHook Install Pending PCM=%s URI=%s\n", afbClient->name, afbClient->uri);
+        return 0;
+    }
+
     // wait for all call request to return
-    if (!afbClient->synchronous) sem_wait(&afbClient->semaphore);
+    if (!afbClient->leased) sem_wait(&afbClient->semaphore);
+    afbClient->decided = 1;
+    afbClient->installUsec = HookStatsNow() - start;
     if (afbClient->errcount) {
+        // async denial is reported by hw_params hook with configured action
+        if (afbClient->async) return 0;
         fprintf (stderr, "PCM Authorisation Deny from AAAA Controller (AGL Advanced Audio Agent)\n");
+        // agent denial or fail-closed breaker: snd_pcm_open fails
+        status = -EACCES;
         goto OnErrorExit;
     }
 
-    if (afbClient->verbose) fprintf(stdout, "\nAlsaHook Install Success PCM=%s URI=%s\n", afbClient->name, afbClient->uri);
+    AlsaHookGranted(afbClient);
     return 0;
 
 OnErrorExit:
     fprintf(stderr, "\nAlsaPcmHook Plugin Policy Control Fail PCM=%s\n", afbClient->name);
+    if (h_statsfree)
+        snd_pcm_hook_remove(h_statsfree);
+    if (h_statsparams)
+        snd_pcm_hook_remove(h_statsparams);
+    if (h_hwparams)
+        snd_pcm_hook_remove(h_hwparams);
     if (h_close)
         snd_pcm_hook_remove(h_close);
+    if (afbClient->conn || afbClient->statsConn) AlsaHookRelease(afbClient);
 
-    return 0;
+    return status;
 }
 
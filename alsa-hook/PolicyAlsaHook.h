@@ -0,0 +1,208 @@
+/*
+ * Copyright (C) 2016 "IoT.bzh"
+ * Author Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef _POLICY_ALSA_HOOK_H
+#define _POLICY_ALSA_HOOK_H
+
+#include <alsa/asoundlib.h>
+#include <alsa/conf.h>
+#include <alsa/pcm.h>
+
+#include <systemd/sd-event.h>
+#include <json-c/json.h>
+
+#include "afb/afb-wsj1.h"
+#include "afb/afb-ws-client.h"
+#include "afb/afb-proto-ws.h"
+
+#include <pthread.h>
+#include <semaphore.h>
+
+// Currently not implemented
+#define UNUSED_ARG(x) UNUSED_ ## x __attribute__((__unused__))
+
+typedef struct hookConnS hookConnT;
+
+typedef struct afbClientS afbClientT;
+
+// compiled request/release call, shared read-only by every PCM using the same config
+typedef struct {
+    char *apiverb;
+    json_object *queryJ;
+} afbRequestT;
+
+typedef enum {
+    CALL_IDLE,
+    CALL_PENDING,
+    CALL_DONE,
+    CALL_FAILED,
+} afbCallStateT;
+
+// runtime state of one request call sent by a PCM
+typedef struct {
+    const afbRequestT *request;
+    afbCallStateT state;
+    char *callIdTag;
+    afbClientT *afbClient;
+} afbCallT;
+
+// action run on hooked PCM when an event matches (see PolicyHookAction.c)
+typedef enum {
+    HOOK_EVT_SIGNAL, // legacy self-signal to application
+    HOOK_EVT_PAUSE,
+    HOOK_EVT_RESUME,
+    HOOK_EVT_DROP,
+    HOOK_EVT_VOLUME, // ramp softvol control to volume
+} hookEvtActionT;
+
+typedef struct afbEventS {
+    char *search;
+    char *value;
+    long ivalue;
+    int signal;
+    hookEvtActionT action;
+    long volume;              // percent, volume action only
+    long ramp;                // ms, volume action only
+    unsigned int hash;        // search=value hash
+    struct afbEventS *next;   // matcher bucket chain
+} afbEventT;
+
+// action taken on a policy denial received after an asynchronous open
+typedef enum {
+    HOOK_DENY_FAIL,   // hw_params fails with -EACCES
+    HOOK_DENY_IGNORE, // log and let stream play
+} hookDenyT;
+
+// hook_args compiled once per distinct config node (see PolicyHookConfig.c), never freed
+typedef struct hookConfigS {
+    char *key;             // node saved as text
+    const snd_config_t *node; // last node seen with this content (fast path)
+    unsigned int hash;     // structural hash of node
+    char *uri;
+    char *role;
+    int verbose;
+    int synchronous;
+    long timeout;
+    int lease;
+    int failopen;
+    int async;
+    hookDenyT deny;
+    int requestCount;
+    afbRequestT **request;
+    afbRequestT *batch;    // whole request list as one call ({"requests":[{"verb","query"}]})
+    int releaseCount;
+    afbRequestT **release;
+    int eventCount;
+    afbEventT **event;
+    afbEventT **matcher;   // events hashed on search=value, power of 2 buckets
+    unsigned int matcherSize;
+    char *control;         // softvol control name used by volume action
+    char *card;            // card holding control (default: PCM card or "default")
+    char *telemetry;       // verb receiving stream telemetry (NULL: disabled)
+    char *telemetryUri;    // binder exposing telemetry verb (mandatory with telemetry, not uri)
+    long telemetryPeriod;  // snd_pcm_status sampling period in ms
+    struct hookConfigS *next;
+} hookConfigT;
+
+struct afbClientS {
+    long magic;
+    char *name;
+    char *uid;
+    snd_pcm_t *pcm;
+    const hookConfigT *config;
+    const char *uri;
+    const char *role;
+    hookConnT *conn;
+    hookConnT *statsConn;  // telemetry connection (reference only, no events)
+    int verbose;
+    int synchronous;
+    sem_t semaphore;
+    long timeout;
+    int errcount;
+    int pending; // calls sent and not yet replied (loop lock)
+    afbRequestT **request;
+    afbRequestT **release;
+    afbEventT **event;
+    afbCallT *calls;       // one per install request (or single batch call)
+    int callCount;
+    int waiting;           // install calls not answered yet
+    int woken;             // opener already woken for this install
+    sd_event_source *timer; // install deadline
+    json_object * streamIdJ;
+    int lease;             // accept policy grant leases (default true)
+    int leased;            // install answered locally (valid lease, open breaker or no request), lease calls still sent
+    int failopen;          // grant (true) or deny (false, default) PCM while agent breaker is open
+    int async;             // open returns at once, hw_params waits for policy decision
+    int decided;           // async policy decision already collected
+    hookDenyT deny;        // async denial action
+    struct timespec deadline; // async decision deadline (CLOCK_MONOTONIC, wall clock steps do not move it)
+    int closing;           // PCM being closed, events ignored (loop lock)
+    snd_ctl_t *volCtl;     // volume action control, opened on first use
+    snd_ctl_elem_id_t *volId;
+    long volMin, volMax, volCurrent, volTarget, volStep;
+    unsigned int volCount;
+    sd_event_source *ramp; // volume ramp timer
+    uint64_t installUsec;  // time open/hw_params spent waiting on install
+    uint64_t releaseUsec;  // time close spent queuing release
+    sd_event_source *statsTimer; // telemetry sampling timer
+    json_object *statsJ;   // samples not yet posted
+    int statsCount;
+    int statsXrun;         // last sample was in xrun
+    uint64_t statsTrigger; // last trigger timestamp (us)
+    int xruns;
+    int starts;            // stream (re)starts seen
+    json_object *leaseJ;   // lease returned by install replies
+    struct afbClientS *nextConn; // clients sharing the same connection
+};
+
+// PolicyHookConn.c (caller holds loop lock for every sd_event or websocket operation)
+void HookLoopLock(void);
+void HookLoopUnlock(void);
+sd_event *HookLoopGet(void);
+hookConnT *HookConnGet(const char *uri, afbClientT *afbClient);
+void HookConnRelease(hookConnT *conn, afbClientT *afbClient);
+int HookConnCall(hookConnT *conn, const char *apiverb, json_object *queryJ, const char *uid, void *request);
+void HookConnPost(hookConnT *conn, const char *apiverb, json_object *queryJ, const char *uid);
+void HookConnFailed(hookConnT *conn);
+int HookConnBreakerOpen(hookConnT *conn);
+
+// PolicyHookConfig.c
+const hookConfigT *HookConfigGet(snd_config_t *conf);
+
+// PolicyHookAction.c (compile at config time, dispatch/clean with loop lock held)
+int HookActionCompile(hookConfigT *config);
+void HookActionDispatch(afbClientT *afbClient, const char *event, json_object *dataJ);
+void HookActionClean(afbClientT *afbClient);
+
+// PolicyHookStats.c (loop lock held except HookStatsNow)
+uint64_t HookStatsNow(void);
+void HookStatsStart(afbClientT *afbClient);
+void HookStatsStop(afbClientT *afbClient);
+void HookStatsClose(afbClientT *afbClient);
+void HookStatsClean(afbClientT *afbClient);
+
+// PolicyHookLease.c
+int HookLeaseCheck(const char *pcm, const char *role);
+int HookLeaseGrant(const char *pcm, const char *role, json_object *leaseJ);
+int HookLeaseRevoke(const char *pcm, const char *role);
+int HookLeaseOnEvent(json_object *dataJ);
+
+// PolicyAlsaHook.c (called from loop thread with loop lock held)
+void HookOnReply(void *request, json_object *responseJ, const char *error, const char *info);
+void HookOnEvent(afbClientT *afbClient, const char *event, json_object *dataJ);
+
+#endif /* _POLICY_ALSA_HOOK_H */
@@ -0,0 +1,262 @@
+/*
+ * Copyright (C) 2016 "IoT.bzh"
+ * Author Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Event actions: events {...} entries are compiled into a hash table keyed on search=value. Each key
+ * of a received event is looked up once and every matching entry runs its action directly on the
+ * hooked PCM from the loop thread: pause, resume, drop, ramped softvol volume, or the legacy
+ * self-signal. Actions never block the shared loop thread (hence no drain). Volume writes the softvol
+ * control of the hooked PCM, which applies it on next period.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <inttypes.h>
+#include <signal.h>
+
+#include "PolicyAlsaHook.h"
+
+// volume ramp tick in ms
+#define HOOK_RAMP_TICK 10
+
+static unsigned int ActionHash(const char *search, const char *value) {
+    unsigned int hash = 2166136261u;
+
+    for (const char *pt = search; *pt; pt++) hash = (hash ^ (unsigned char) *pt) * 16777619u;
+    hash = (hash ^ '=') * 16777619u;
+    for (const char *pt = value; *pt; pt++) hash = (hash ^ (unsigned char) *pt) * 16777619u;
+    return hash;
+}
+
+// Build config->matcher from config->event, return 1 on invalid event config
+int HookActionCompile(hookConfigT *config) {
+    char ivalue[24];
+    unsigned int size = 1;
+
+    while (size < (unsigned int) config->eventCount * 2) size <<= 1;
+    config->matcher = calloc(size, sizeof (afbEventT*));
+    config->matcherSize = size;
+
+    for (int idx = 0; idx < config->eventCount; idx++) {
+        afbEventT *evt = config->event[idx];
+
+        if (evt->action == HOOK_EVT_VOLUME && !config->control) {
+            SNDERR("Event %s=%s volume action requires a softvol 'control' in hook_args", evt->search, evt->value ? evt->value : "");
+            return 1;
+        }
+
+        if (!evt->value) snprintf(ivalue, sizeof (ivalue), "%ld", evt->ivalue);
+        evt->hash = ActionHash(evt->search, evt->value ? evt->value : ivalue);
+
+        // keep config order inside a bucket
+        afbEventT **link = &config->matcher[evt->hash & (size - 1)];
+        while (*link) link = &(*link)->next;
+        *link = evt;
+    }
+    return 0;
+}
+
+// Open softvol control on first volume action
+static int ActionVolumeOpen(afbClientT *afbClient) {
+    const hookConfigT *config = afbClient->config;
+    snd_ctl_elem_info_t *info;
+    snd_ctl_elem_value_t *value;
+    snd_pcm_info_t *pcmInfo;
+    char cardid[16];
+    const char *card = config->card;
+    int err;
+
+    // default to card behind hooked PCM
+    if (!card) {
+        snd_pcm_info_alloca(&pcmInfo);
+        if (snd_pcm_info(afbClient->pcm, pcmInfo) >= 0 && snd_pcm_info_get_card(pcmInfo) >= 0) {
+            snprintf(cardid, sizeof (cardid), "hw:%d", snd_pcm_info_get_card(pcmInfo));
+            card = cardid;
+        } else {
+            card = "default";
+        }
+    }
+
+    err = snd_ctl_open(&afbClient->volCtl, card, 0);
+    if (err < 0) {
+        SNDERR("ON-EVENT fail to open card=%s control=%s error=%s", card, config->control, snd_strerror(err));
+        goto OnErrorExit;
+    }
+
+    snd_ctl_elem_id_malloc(&afbClient->volId);
+    snd_ctl_elem_id_set_interface(afbClient->volId, SND_CTL_ELEM_IFACE_MIXER);
+    snd_ctl_elem_id_set_name(afbClient->volId, config->control);
+
+    snd_ctl_elem_info_alloca(&info);
+    snd_ctl_elem_info_set_id(info, afbClient->volId);
+    err = snd_ctl_elem_info(afbClient->volCtl, info);
+    if (err < 0 || snd_ctl_elem_info_get_type(info) != SND_CTL_ELEM_TYPE_INTEGER) {
+        SNDERR("ON-EVENT invalid integer control card=%s control=%s", card, config->control);
+        goto OnErrorExit;
+    }
+    afbClient->volMin = snd_ctl_elem_info_get_min(info);
+    afbClient->volMax = snd_ctl_elem_info_get_max(info);
+    afbClient->volCount = snd_ctl_elem_info_get_count(info);
+
+    // ramp starts from current control value
+    snd_ctl_elem_value_alloca(&value);
+    snd_ctl_elem_value_set_id(value, afbClient->volId);
+    err = snd_ctl_elem_read(afbClient->volCtl, value);
+    afbClient->volCurrent = (err < 0) ? afbClient->volMax : snd_ctl_elem_value_get_integer(value, 0);
+
+    if (afbClient->verbose) printf("ON-EVENT volume control card=%s control=%s range=%ld-%ld\n", card, config->control, afbClient->volMin, afbClient->volMax);
+    return 0;
+
+OnErrorExit:
+    HookActionClean(afbClient);
+    return -1;
+}
+
+static int ActionVolumeWrite(afbClientT *afbClient, long volume) {
+    snd_ctl_elem_value_t *value;
+
+    snd_ctl_elem_value_alloca(&value);
+    snd_ctl_elem_value_set_id(value, afbClient->volId);
+    for (unsigned int idx = 0; idx < afbClient->volCount; idx++) snd_ctl_elem_value_set_integer(value, idx, volume);
+    return snd_ctl_elem_write(afbClient->volCtl, value);
+}
+
+// one ramp step, return 1 when target reached
+static int ActionRampStep(afbClientT *afbClient) {
+    long next = afbClient->volCurrent + afbClient->volStep;
+
+    if ((afbClient->volStep > 0 && next > afbClient->volTarget) || (afbClient->volStep < 0 && next < afbClient->volTarget) || !afbClient->volStep)
+        next = afbClient->volTarget;
+
+    if (ActionVolumeWrite(afbClient, next) < 0) {
+        SNDERR("ON-EVENT fail to write volume control=%s", afbClient->config->control);
+        return 1;
+    }
+    afbClient->volCurrent = next;
+    return next == afbClient->volTarget;
+}
+
+static int OnRampCB(sd_event_source *source, uint64_t usec, void *handle) {
+    afbClientT *afbClient = (afbClientT*) handle;
+
+    if (!afbClient->closing && !ActionRampStep(afbClient)) {
+        sd_event_source_set_time(source, usec + HOOK_RAMP_TICK * 1000);
+        sd_event_source_set_enabled(source, SD_EVENT_ONESHOT);
+        return 0;
+    }
+
+    sd_event_source_unref(afbClient->ramp);
+    afbClient->ramp = NULL;
+    return 0;
+}
+
+static void ActionVolume(afbClientT *afbClient, afbEventT *evt) {
+    long steps = evt->ramp / HOOK_RAMP_TICK;
+    uint64_t usec;
+
+    if (!afbClient->volCtl && ActionVolumeOpen(afbClient) < 0) return;
+
+    afbClient->volTarget = afbClient->volMin + (afbClient->volMax - afbClient->volMin) * evt->volume / 100;
+    if (steps < 1) steps = 1;
+    afbClient->volStep = (afbClient->volTarget - afbClient->volCurrent) / steps;
+    if (!afbClient->volStep) afbClient->volStep = (afbClient->volTarget > afbClient->volCurrent) ? 1 : -1;
+
+    // first step now, following ones from loop timer (a running ramp just takes the new target)
+    if (ActionRampStep(afbClient) || afbClient->ramp) return;
+
+    sd_event_now(HookLoopGet(), CLOCK_MONOTONIC, &usec);
+    sd_event_add_time(HookLoopGet(), &afbClient->ramp, CLOCK_MONOTONIC, usec + HOOK_RAMP_TICK * 1000, 1000, OnRampCB, afbClient);
+}
+
+static void ActionRun(afbClientT *afbClient, afbEventT *evt) {
+    snd_pcm_t *pcm = afbClient->pcm;
+    snd_pcm_state_t state = snd_pcm_state(pcm);
+    int err = 0;
+
+    if (afbClient->verbose) printf("ON-EVENT action=%d search=%s pcm=%s state=%d\n", evt->action, evt->search, afbClient->name, state);
+
+    switch (evt->action) {
+        case HOOK_EVT_SIGNAL:
+            kill(getpid(), evt->signal);
+            break;
+
+        case HOOK_EVT_PAUSE:
+            if (state == SND_PCM_STATE_RUNNING) err = snd_pcm_pause(pcm, 1);
+            break;
+
+        case HOOK_EVT_RESUME:
+            if (state == SND_PCM_STATE_PAUSED) err = snd_pcm_pause(pcm, 0);
+            else if (state == SND_PCM_STATE_SUSPENDED) {
+                err = snd_pcm_resume(pcm);
+                if (err < 0) err = snd_pcm_prepare(pcm);
+            }
+            // after drop, stream restarts on next application write
+            else if (state == SND_PCM_STATE_SETUP) err = snd_pcm_prepare(pcm);
+            break;
+
+        case HOOK_EVT_DROP:
+            if (state != SND_PCM_STATE_OPEN && state != SND_PCM_STATE_SETUP) err = snd_pcm_drop(pcm);
+            break;
+
+        case HOOK_EVT_VOLUME:
+            ActionVolume(afbClient, evt);
+            break;
+    }
+
+    if (err < 0) SNDERR("ON-EVENT action=%d fail pcm=%s error=%s", evt->action, afbClient->name, snd_strerror(err));
+}
+
+// Run every event entry matching one of dataJ keys
+void HookActionDispatch(afbClientT *afbClient, const char *event, json_object *dataJ) {
+    const hookConfigT *config = afbClient->config;
+    char ivalue[24];
+    int count = 0;
+
+    if (!config->matcher || !json_object_is_type(dataJ, json_type_object)) goto OnErrorExit;
+
+    json_object_object_foreach(dataJ, key, valueJ) {
+        enum json_type type = json_object_get_type(valueJ);
+        const char *value;
+
+        if (type == json_type_string) value = json_object_get_string(valueJ);
+        else if (type == json_type_int) {
+            snprintf(ivalue, sizeof (ivalue), "%" PRId64, json_object_get_int64(valueJ));
+            value = ivalue;
+        } else continue;
+
+        unsigned int hash = ActionHash(key, value);
+        for (afbEventT *evt = config->matcher[hash & (config->matcherSize - 1)]; evt; evt = evt->next) {
+            if (evt->hash != hash || strcmp(evt->search, key)) continue;
+            if (evt->value ? (type != json_type_string || strcmp(evt->value, value)) : (type != json_type_int || json_object_get_int64(valueJ) != evt->ivalue)) continue;
+            ActionRun(afbClient, evt);
+            count++;
+        }
+    }
+    if (!count) goto OnErrorExit;
+    return;
+
+OnErrorExit:
+    if (afbClient->verbose) SNDERR("ON-EVENT Fail/Ignored %s(%s)\n", event, json_object_get_string(dataJ));
+}
+
+// release volume control and ramp timer
+void HookActionClean(afbClientT *afbClient) {
+    if (afbClient->ramp) sd_event_source_unref(afbClient->ramp);
+    afbClient->ramp = NULL;
+    if (afbClient->volCtl) snd_ctl_close(afbClient->volCtl);
+    afbClient->volCtl = NULL;
+    if (afbClient->volId) snd_ctl_elem_id_free(afbClient->volId);
+    afbClient->volId = NULL;
+}
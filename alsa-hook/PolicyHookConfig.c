@@ -0,0 +1,593 @@
+/*
+ * Copyright (C) 2016 "IoT.bzh"
+ * Author Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * hook_args are compiled once per distinct config node and kept in a process wide cache. An open
+ * only walks the node to hash its ids and values (no allocation): same node pointer and hash is a hit.
+ * Config tree may be reloaded or hook_args expanded into a fresh copy, so a new pointer is checked
+ * against the node saved as text before being adopted. Compiled configs are shared read-only by every
+ * PCM and never freed.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+
+#include "PolicyAlsaHook.h"
+
+// timeout in ms
+#define REQUEST_DEFAULT_TIMEOUT 500
+
+// telemetry sampling period in ms
+#define TELEMETRY_DEFAULT_PERIOD 1000
+
+static pthread_mutex_t configLock = PTHREAD_MUTEX_INITIALIZER;
+static hookConfigT *hookConfigs = NULL;
+
+// Get an asoundrc compound and return it as a JSON object
+static json_object* AlsaGetJson (snd_config_t *ctlconfig, const char *id, const char*label) {
+
+    json_object *queryJ;
+    snd_config_type_t ctype;
+    const char *value;
+    char* query;
+
+    // each control is a sting that contain a json object
+    ctype = snd_config_get_type(ctlconfig);
+    if (ctype != SND_CONFIG_TYPE_STRING || snd_config_get_string(ctlconfig, &value) < 0) {
+        SNDERR("Invalid json string for %s", label);
+        goto OnErrorExit;
+    }
+
+    // cleanup string for json_tokener (on a copy, config tree is not ours)
+    query = strdup(value);
+    for (int idx = 0; query[idx] != '\0'; idx++) {
+        if (query[idx] == '\'') query[idx] = '"';
+    }
+    queryJ = json_tokener_parse(query);
+    if (!queryJ) {
+        SNDERR("Not a valid Json object control='%s' query='%s'", id, query);
+        free(query);
+        goto OnErrorExit;
+    }
+
+    free(query);
+    return queryJ;
+
+OnErrorExit:
+    return NULL;
+}
+
+static int AlsaCountEntries (snd_config_t *node) {
+    snd_config_iterator_t current, follow;
+    const char *id;
+    int count=0;
+
+    snd_config_for_each(current, follow, node) {
+        if (snd_config_get_id(snd_config_iterator_entry(current), &id) >= 0) count++;
+    }
+    return count;
+}
+
+static int AlsaGetActions (snd_config_t *node, afbRequestT ***afbRequests, int *count, const char*id) {
+    const char *callConf, *apiverb;
+    snd_config_type_t ctype;
+    snd_config_iterator_t currentCall, follow;
+    afbRequestT **afbRequest;
+    int callCount=0;
+
+    ctype = snd_config_get_type(node);
+    if (ctype != SND_CONFIG_TYPE_COMPOUND) {
+        snd_config_get_string(node, &callConf);
+        SNDERR("Invalid compound type for %s", callConf);
+        goto OnErrorExit;
+    }
+
+    // array is NULL terminated
+    afbRequest = calloc((size_t) AlsaCountEntries(node) + 1, sizeof (afbRequestT*));
+    *afbRequests = afbRequest;
+
+    // loop on each call
+    snd_config_for_each(currentCall, follow, node) {
+        snd_config_t *ctlconfig = snd_config_iterator_entry(currentCall);
+
+        // ignore empty line
+        if (snd_config_get_id(ctlconfig, &apiverb) < 0) continue;
+
+        // allocate an empty call request
+        afbRequest[callCount] = calloc(1, sizeof (afbRequestT));
+        afbRequest[callCount]->apiverb=strdup(apiverb);
+        afbRequest[callCount]->queryJ= AlsaGetJson(ctlconfig, id, apiverb);
+        if (!afbRequest[callCount++]->queryJ) goto OnErrorExit;
+    }
+
+    *count = callCount;
+    return 0;
+
+OnErrorExit:
+    return 1;
+}
+
+static int AlsaGetEvents (snd_config_t *node, afbEventT ***afbEvents, int *count) {
+
+    const char *confEvents, *evtpattern;
+    snd_config_type_t ctype;
+    snd_config_iterator_t currentEvt, follow;
+    snd_config_t *itemConf;
+    afbEventT **afbEvent;
+    int callCount=0;
+    int err;
+
+    ctype = snd_config_get_type(node);
+    if (ctype != SND_CONFIG_TYPE_COMPOUND) {
+        snd_config_get_string(node, &confEvents);
+        SNDERR("Invalid compound type for %s", confEvents);
+        goto OnErrorExit;
+    }
+
+    // array is NULL terminated
+    afbEvent = calloc((size_t) AlsaCountEntries(node) + 1, sizeof (afbEventT*));
+    *afbEvents = afbEvent;
+
+    // loop on each call
+    snd_config_for_each(currentEvt, follow, node) {
+        snd_config_t *ctlconfig = snd_config_iterator_entry(currentEvt);
+
+        // ignore empty line
+        if (snd_config_get_id(ctlconfig, &evtpattern) < 0) continue;
+        confEvents = evtpattern;
+
+        // allocate an empty event matcher
+        afbEventT *evt = calloc(1, sizeof (afbEventT));
+        afbEvent[callCount++] = evt;
+
+        // extract signal num from config label
+        for (int idx=0; evtpattern[idx] != '\0'; idx++) {
+            if (evtpattern[idx]=='-' && evtpattern[idx+1] != '\0') {
+                int done= sscanf (&evtpattern[idx+1], "%d",&evt->signal);
+                if (done != 1) {
+                    SNDERR("Invalid Signal '%s' definition should be something like Sig-xx", evtpattern);
+                    goto OnErrorExit;
+                }
+                break;
+            }
+        }
+
+        // extract signal key value search pattern
+        ctype = snd_config_get_type(ctlconfig);
+        if (ctype != SND_CONFIG_TYPE_COMPOUND) {
+            snd_config_get_string(ctlconfig, &confEvents);
+            SNDERR("Invalid event search pattern for %s value=%s", evtpattern, confEvents);
+            goto OnErrorExit;
+        }
+
+        // pattern should have a search
+        err = snd_config_search(ctlconfig, "search", &itemConf);
+        if (!err) {
+            const char *search;
+            if (snd_config_get_string(itemConf, &search) < 0) {
+                SNDERR("Invalid event/signal 'search' should be a string %s", confEvents);
+                goto OnErrorExit;
+            }
+            evt->search=strdup(search);
+        } else {
+            SNDERR("Missing 'search' from event/signal 'search' from signal definition %s", confEvents);
+            goto OnErrorExit;
+        }
+
+        // pattern should have a value
+        err = snd_config_search(ctlconfig, "value", &itemConf);
+        if (!err) {
+            const char *value;
+            switch (snd_config_get_type(itemConf)) {
+                case SND_CONFIG_TYPE_INTEGER:
+                    snd_config_get_integer(itemConf, &evt->ivalue);
+                    break;
+
+                case  SND_CONFIG_TYPE_STRING:
+                    snd_config_get_string(itemConf, &value);
+                    evt->value=strdup(value);
+                    break;
+                default:
+                    SNDERR("Invalid event/signal 'value' should be a string %s", confEvents);
+                    goto OnErrorExit;
+            }
+        } else {
+            SNDERR("Missing 'value' from event/signal 'value' from signal definition %s", confEvents);
+            goto OnErrorExit;
+        }
+
+        // optional direct action on hooked PCM (default: self-signal)
+        err = snd_config_search(ctlconfig, "action", &itemConf);
+        if (!err) {
+            const char *action;
+            if (snd_config_get_string(itemConf, &action) < 0) {
+                SNDERR("Invalid event 'action' should be a string %s", evtpattern);
+                goto OnErrorExit;
+            }
+            if (!strcmp(action, "signal")) evt->action = HOOK_EVT_SIGNAL;
+            else if (!strcmp(action, "pause")) evt->action = HOOK_EVT_PAUSE;
+            else if (!strcmp(action, "resume")) evt->action = HOOK_EVT_RESUME;
+            else if (!strcmp(action, "drop")) evt->action = HOOK_EVT_DROP;
+            else if (!strcmp(action, "volume")) evt->action = HOOK_EVT_VOLUME;
+            else {
+                SNDERR("Invalid event action '%s' should be signal|pause|resume|drop|volume", action);
+                goto OnErrorExit;
+            }
+        }
+
+        if (evt->action == HOOK_EVT_SIGNAL && !evt->signal) {
+            SNDERR("Invalid event %s signal action requires a label like Sig-xx", evtpattern);
+            goto OnErrorExit;
+        }
+
+        if (evt->action == HOOK_EVT_VOLUME) {
+            err = snd_config_search(ctlconfig, "volume", &itemConf);
+            if (err || snd_config_get_integer(itemConf, &evt->volume) < 0 || evt->volume < 0 || evt->volume > 100) {
+                SNDERR("Invalid or missing event 'volume' should be an integer 0-100 %s", evtpattern);
+                goto OnErrorExit;
+            }
+            err = snd_config_search(ctlconfig, "ramp", &itemConf);
+            if (!err && (snd_config_get_integer(itemConf, &evt->ramp) < 0 || evt->ramp < 0)) {
+                SNDERR("Invalid event 'ramp' should be a positive integer (ms) %s", evtpattern);
+                goto OnErrorExit;
+            }
+        }
+    }
+
+    *count = callCount;
+    return 0;
+
+OnErrorExit:
+    return 1;
+}
+
+static void HookConfigFreeRequests(afbRequestT **afbRequest) {
+    if (!afbRequest) return;
+    for (int index=0; afbRequest[index]!= NULL; index++) {
+        free(afbRequest[index]->apiverb);
+        if (afbRequest[index]->queryJ) json_object_put(afbRequest[index]->queryJ);
+        free(afbRequest[index]);
+    }
+    free(afbRequest);
+}
+
+static void HookConfigFreeBatch(hookConfigT *config) {
+    if (!config->batch) return;
+    free(config->batch->apiverb);
+    if (config->batch->queryJ) json_object_put(config->batch->queryJ);
+    free(config->batch);
+    config->batch = NULL;
+}
+
+// only used when compile fails, cached configs are never freed
+static void HookConfigFree(hookConfigT *config) {
+    free(config->key);
+    free(config->uri);
+    free(config->role);
+    free(config->control);
+    free(config->card);
+    free(config->telemetry);
+    free(config->telemetryUri);
+    free(config->matcher);
+    HookConfigFreeRequests(config->request);
+    HookConfigFreeRequests(config->release);
+    HookConfigFreeBatch(config);
+    if (config->event) {
+        for (int index=0; config->event[index]!= NULL; index++) {
+            free(config->event[index]->search);
+            free(config->event[index]->value);
+            free(config->event[index]);
+        }
+        free(config->event);
+    }
+    free(config);
+}
+
+// Parse hook_args node, return NULL on invalid config
+static hookConfigT *HookConfigCompile(snd_config_t *conf) {
+    snd_config_iterator_t it, next;
+    hookConfigT *config = calloc(1, sizeof (hookConfigT));
+
+    config->lease = 1;
+    config->timeout = REQUEST_DEFAULT_TIMEOUT;
+    config->telemetryPeriod = TELEMETRY_DEFAULT_PERIOD;
+
+    snd_config_for_each(it, next, conf) {
+        snd_config_t *node = snd_config_iterator_entry(it);
+        const char *id;
+
+        // ignore comment en empty lines
+        if (snd_config_get_id(node, &id) < 0) continue;
+        if (strcmp(id, "comment") == 0 || strcmp(id, "hint") == 0) continue;
+
+        if (strcmp(id, "uri") == 0) {
+            const char *uri;
+            if (snd_config_get_string(node, &uri) < 0) {
+                SNDERR("Invalid String for %s", id);
+                goto OnErrorExit;
+            }
+            config->uri=strdup(uri);
+            continue;
+        }
+
+        if (strcmp(id, "verbose") == 0) {
+            config->verbose= snd_config_get_bool(node);
+            if (config->verbose < 0) {
+                SNDERR("Invalid Boolean for %s", id);
+                goto OnErrorExit;
+            }
+            continue;
+        }
+
+        if (strcmp(id, "synchronous") == 0) {
+            config->synchronous= snd_config_get_bool(node);
+            if (config->synchronous < 0) {
+                SNDERR("Invalid Boolean for %s", id);
+                goto OnErrorExit;
+            }
+            continue;
+        }
+
+        if (strcmp(id, "role") == 0) {
+            const char *role;
+            if (snd_config_get_string(node, &role) < 0) {
+                SNDERR("Invalid String for %s", id);
+                goto OnErrorExit;
+            }
+            config->role=strdup(role);
+            continue;
+        }
+
+        if (strcmp(id, "lease") == 0) {
+            config->lease= snd_config_get_bool(node);
+            if (config->lease < 0) {
+                SNDERR("Invalid Boolean for %s", id);
+                goto OnErrorExit;
+            }
+            continue;
+        }
+
+        if (strcmp(id, "failopen") == 0) {
+            config->failopen= snd_config_get_bool(node);
+            if (config->failopen < 0) {
+                SNDERR("Invalid Boolean for %s", id);
+                goto OnErrorExit;
+            }
+            continue;
+        }
+
+        if (strcmp(id, "async") == 0) {
+            config->async= snd_config_get_bool(node);
+            if (config->async < 0) {
+                SNDERR("Invalid Boolean for %s", id);
+                goto OnErrorExit;
+            }
+            continue;
+        }
+
+        if (strcmp(id, "deny") == 0) {
+            const char *deny;
+            if (snd_config_get_string(node, &deny) < 0) {
+                SNDERR("Invalid String for %s", id);
+                goto OnErrorExit;
+            }
+            if (!strcmp(deny, "fail")) config->deny = HOOK_DENY_FAIL;
+            else if (!strcmp(deny, "ignore")) config->deny = HOOK_DENY_IGNORE;
+            else {
+                SNDERR("Invalid deny action '%s' should be fail|ignore", deny);
+                goto OnErrorExit;
+            }
+            continue;
+        }
+
+        if (strcmp(id, "control") == 0) {
+            const char *control;
+            if (snd_config_get_string(node, &control) < 0) {
+                SNDERR("Invalid String for %s", id);
+                goto OnErrorExit;
+            }
+            config->control=strdup(control);
+            continue;
+        }
+
+        if (strcmp(id, "card") == 0) {
+            const char *card;
+            if (snd_config_get_string(node, &card) < 0) {
+                SNDERR("Invalid String for %s", id);
+                goto OnErrorExit;
+            }
+            config->card=strdup(card);
+            continue;
+        }
+
+        if (strcmp(id, "telemetry") == 0) {
+            const char *telemetry;
+            if (snd_config_get_string(node, &telemetry) < 0) {
+                SNDERR("Invalid String for %s", id);
+                goto OnErrorExit;
+            }
+            config->telemetry=strdup(telemetry);
+            continue;
+        }
+
+        if (strcmp(id, "telemetry_uri") == 0) {
+            const char *uri;
+            if (snd_config_get_string(node, &uri) < 0) {
+                SNDERR("Invalid String for %s", id);
+                goto OnErrorExit;
+            }
+            config->telemetryUri=strdup(uri);
+            continue;
+        }
+
+        if (strcmp(id, "telemetry_period") == 0) {
+            if (snd_config_get_integer(node, &config->telemetryPeriod) < 0 || config->telemetryPeriod <= 0) {
+                SNDERR("Invalid telemetry_period positive Integer %s", id);
+                goto OnErrorExit;
+            }
+            continue;
+        }
+
+        if (strcmp(id, "timeout") == 0) {
+            if (snd_config_get_integer(node, &config->timeout) < 0) {
+                SNDERR("Invalid timeout Integer %s", id);
+                goto OnErrorExit;
+            }
+            continue;
+        }
+
+        if (strcmp(id, "batch") == 0) {
+            const char *batch;
+            if (snd_config_get_string(node, &batch) < 0) {
+                SNDERR("Invalid String for %s", id);
+                goto OnErrorExit;
+            }
+            config->batch = calloc(1, sizeof (afbRequestT));
+            config->batch->apiverb=strdup(batch);
+            continue;
+        }
+
+        if (strcmp(id, "request") == 0) {
+            if (AlsaGetActions(node, &config->request, &config->requestCount, id)) goto OnErrorExit;
+            continue;
+        }
+
+        if (strcmp(id, "release") == 0) {
+            if (AlsaGetActions(node, &config->release, &config->releaseCount, id)) goto OnErrorExit;
+            continue;
+        }
+
+        if (strcmp(id, "events") == 0) {
+            if (AlsaGetEvents(node, &config->event, &config->eventCount)) goto OnErrorExit;
+            continue;
+        }
+    }
+
+    if (!config->uri) {
+        SNDERR("Missing mandatory 'uri' in hook_args");
+        goto OnErrorExit;
+    }
+
+    // telemetry has its own connection and post queue, never the policy agent one (samples would evict releases)
+    if (config->telemetry && (!config->telemetryUri || strcmp(config->telemetryUri, config->uri) == 0)) {
+        SNDERR("'telemetry' requires a 'telemetry_uri' other than 'uri' in hook_args");
+        goto OnErrorExit;
+    }
+
+    // events are matched through a hash table on search=value
+    if (config->event && HookActionCompile(config)) goto OnErrorExit;
+
+    // batch verb receives request list as {"requests":[{"verb":"xxx", "query":{...}}, ...]}
+    if (config->batch && config->requestCount > 0) {
+        json_object *requestsJ = json_object_new_array();
+        for (int idx = 0; idx < config->requestCount; idx++) {
+            json_object *callJ = json_object_new_object();
+            json_object_object_add(callJ, "verb", json_object_new_string(config->request[idx]->apiverb));
+            json_object_object_add(callJ, "query", json_object_get(config->request[idx]->queryJ));
+            json_object_array_add(requestsJ, callJ);
+        }
+        config->batch->queryJ = json_object_new_object();
+        json_object_object_add(config->batch->queryJ, "requests", requestsJ);
+    } else if (config->batch) {
+        // nothing to batch
+        HookConfigFreeBatch(config);
+    }
+
+    return config;
+
+OnErrorExit:
+    HookConfigFree(config);
+    return NULL;
+}
+
+static unsigned int ConfigHashBytes(unsigned int hash, const void *data, size_t len) {
+    for (size_t idx = 0; idx < len; idx++) hash = (hash ^ ((const unsigned char*) data)[idx]) * 16777619u;
+    return hash;
+}
+
+// FNV-1a over ids, types and values of node tree
+static unsigned int ConfigHash(snd_config_t *node, unsigned int hash) {
+    snd_config_iterator_t it, next;
+    snd_config_type_t ctype = snd_config_get_type(node);
+    const char *id, *str;
+    long value;
+    long long value64;
+    double real;
+
+    if (snd_config_get_id(node, &id) == 0 && id) hash = ConfigHashBytes(hash, id, strlen(id) + 1);
+    hash = ConfigHashBytes(hash, &ctype, sizeof (ctype));
+
+    switch (ctype) {
+        case SND_CONFIG_TYPE_INTEGER:
+            if (snd_config_get_integer(node, &value) == 0) hash = ConfigHashBytes(hash, &value, sizeof (value));
+            break;
+        case SND_CONFIG_TYPE_INTEGER64:
+            if (snd_config_get_integer64(node, &value64) == 0) hash = ConfigHashBytes(hash, &value64, sizeof (value64));
+            break;
+        case SND_CONFIG_TYPE_REAL:
+            if (snd_config_get_real(node, &real) == 0) hash = ConfigHashBytes(hash, &real, sizeof (real));
+            break;
+        case SND_CONFIG_TYPE_STRING:
+            if (snd_config_get_string(node, &str) == 0 && str) hash = ConfigHashBytes(hash, str, strlen(str) + 1);
+            break;
+        case SND_CONFIG_TYPE_COMPOUND:
+            snd_config_for_each(it, next, node) {
+                hash = ConfigHash(snd_config_iterator_entry(it), hash);
+            }
+            break;
+        default:
+            break;
+    }
+    return hash;
+}
+
+// Return compiled hook_args for conf, compiling it on first use (NULL on invalid config)
+const hookConfigT *HookConfigGet(snd_config_t *conf) {
+    snd_output_t *output = NULL;
+    hookConfigT *config;
+    unsigned int hash = ConfigHash(conf, 2166136261u);
+    char *text;
+    size_t len;
+
+    pthread_mutex_lock(&configLock);
+    for (config = hookConfigs; config; config = config->next) {
+        if (config->node == conf && config->hash == hash) goto OnExit;
+    }
+
+    // new node pointer (or changed content): compare saved text before adopting pointer
+    if (snd_output_buffer_open(&output) < 0) goto OnExit;
+    if (snd_config_save(conf, output) < 0) goto OnExit;
+    len = snd_output_buffer_string(output, &text);
+
+    for (config = hookConfigs; config; config = config->next) {
+        if (config->hash == hash && strlen(config->key) == len && !memcmp(config->key, text, len)) break;
+    }
+
+    if (!config) {
+        config = HookConfigCompile(conf);
+        if (config) {
+            config->key = strndup(text, len);
+            config->hash = hash;
+            config->next = hookConfigs;
+            hookConfigs = config;
+        }
+    }
+    if (config) config->node = conf;
+
+OnExit:
+    pthread_mutex_unlock(&configLock);
+    if (output) snd_output_close(output);
+    return config;
+}
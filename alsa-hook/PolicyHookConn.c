@@ -0,0 +1,734 @@
+/*
+ * Copyright (C) 2016 "IoT.bzh"
+ * Author Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Process wide connection manager: every hooked PCM of a process shares one event loop thread
+ * and one websocket per audio-agent uri. Connections are reference counted by hooked PCMs, kept
+ * open HOOK_CONN_LINGER ms after last close (short notification sounds reopen quickly) and
+ * transparently reconnected after a hangup. A per connection circuit breaker fails fast after
+ * HOOK_BREAKER_THRESHOLD consecutive failures (one per open, or per failed retry) and probes the agent in
+ * background until it answers; while it is open only the probe reconnects, on its backoff schedule.
+ * Release notifications are queued per connection and sent in order by the loop thread, pending ones
+ * being flushed at process exit on a still connected socket. Events are routed to the PCMs whose
+ * install call subscribed them.
+ *
+ * Loop thread, lingering connections and process caches (lease, config) outlive the PCM that loaded
+ * the hook, the module is therefore linked with -z nodelete so alsa-lib dlclose never unmaps it.
+ *
+ * sd_event is not thread safe: the loop thread only releases hookLock while polling its fd,
+ * application threads take the lock for any loop/websocket operation and wake the loop on unlock.
+ * The socket connect itself runs with hookLock released (HOOK_CONN_TIMEOUT bound), the lock is only
+ * taken back to publish the websocket, so a slow agent never stalls other PCMs of the process.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <poll.h>
+#include <errno.h>
+#include <stddef.h>
+#include <netdb.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "PolicyAlsaHook.h"
+
+// idle connection close delay in ms
+#ifndef HOOK_CONN_LINGER
+#define HOOK_CONN_LINGER 30000
+#endif
+
+// max time in ms for one socket connect (run without loop lock)
+#ifndef HOOK_CONN_TIMEOUT
+#define HOOK_CONN_TIMEOUT 1000
+#endif
+
+// delay between reconnection attempts in ms while PCMs are attached
+#ifndef HOOK_CONN_RETRY
+#define HOOK_CONN_RETRY 1000
+#endif
+
+// circuit breaker: consecutive failures before failing fast, then backoff window (ms) doubled up to max
+#ifndef HOOK_BREAKER_THRESHOLD
+#define HOOK_BREAKER_THRESHOLD 3
+#endif
+#ifndef HOOK_BREAKER_BACKOFF
+#define HOOK_BREAKER_BACKOFF 2000
+#endif
+#ifndef HOOK_BREAKER_BACKOFF_MAX
+#define HOOK_BREAKER_BACKOFF_MAX 30000
+#endif
+
+// max queued release notifications per connection (oldest dropped first)
+#ifndef HOOK_POST_MAX
+#define HOOK_POST_MAX 64
+#endif
+
+// background probe verb, any reply (even unknown-verb) proves agent is back
+#ifndef HOOK_BREAKER_PROBE
+#define HOOK_BREAKER_PROBE "ping"
+#endif
+
+// event id subscribed by one client install call
+typedef struct hookSubS {
+    int evtid;
+    afbClientT *afbClient;
+    struct hookSubS *next;
+} hookSubT;
+
+typedef struct hookPostS {
+    char *apiverb;
+    json_object *queryJ;
+    char *uid;
+    struct hookPostS *next;
+} hookPostT;
+
+struct hookConnS {
+    char *uri;
+    struct afb_proto_ws *pws;
+    int hangup;
+    int connecting;  // socket connect running without loop lock
+    int refcount;
+    afbClientT *clients;
+    hookSubT *subs;
+    sd_event_source *timer;
+    int failures;
+    uint64_t backoff;
+    uint64_t breakerUntil;
+    sd_event_source *probe;
+    hookPostT *postHead;
+    hookPostT *postTail;
+    int postCount;
+    sd_event_source *flush;
+    hookConnT *next;
+};
+
+static pthread_mutex_t hookLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t hookConnCond = PTHREAD_COND_INITIALIZER; // signaled when a connect ends
+static pthread_once_t hookLoopOnce = PTHREAD_ONCE_INIT;
+static pthread_t hookTid;
+static sd_event *hookLoop = NULL;
+static int hookWakeFd = -1;
+static hookConnT *hookConns = NULL;
+static char hookProbeTag; // reply closure for breaker probes
+static char hookPostTag;  // reply closure for fire-and-forget posts
+
+static int HookConnect(hookConnT *conn);
+static void HookConnArm(hookConnT *conn, long msec);
+
+void HookLoopLock(void) {
+    pthread_mutex_lock(&hookLock);
+}
+
+// new sources/timers are only taken into account once the loop wakes up
+void HookLoopUnlock(void) {
+    uint64_t one = 1;
+
+    pthread_mutex_unlock(&hookLock);
+    if (hookWakeFd >= 0 && hookLoop && !pthread_equal(pthread_self(), hookTid)) {
+        if (write(hookWakeFd, &one, sizeof (one)) < 0) fprintf(stderr, "HookLoopUnlock: wakeup fail errno=%s\n", strerror(errno));
+    }
+}
+
+static int HookWakeCB(sd_event_source* UNUSED_ARG(src), int fd, uint32_t UNUSED_ARG(revents), void* UNUSED_ARG(handle)) {
+    uint64_t count;
+    if (read(fd, &count, sizeof (count)) < 0) return 0;
+    return 0;
+}
+
+static void *HookLoopThread(void *UNUSED_ARG(handle)) {
+    struct pollfd pfd;
+    int res;
+
+    pfd.fd = sd_event_get_fd(hookLoop);
+    pfd.events = POLLIN;
+
+    /* loop until end */
+    for (;;) {
+        pthread_mutex_lock(&hookLock);
+        res = sd_event_prepare(hookLoop);
+        if (res == 0) {
+            // only the poll runs unlocked, sd_event state is processed under lock
+            pthread_mutex_unlock(&hookLock);
+            poll(&pfd, 1, -1);
+            pthread_mutex_lock(&hookLock);
+            res = sd_event_wait(hookLoop, 0);
+        }
+        if (res > 0) res = sd_event_dispatch(hookLoop);
+        pthread_mutex_unlock(&hookLock);
+
+        if (res < 0) {
+            printf("ERROR in HookLoopThread \"%i\" Break ON-MAINLOOP errno=%s.\n", res, strerror(-res));
+            break;
+        }
+    }
+    pthread_exit(0);
+}
+
+static void HookPostExit(void);
+
+static void HookLoopStart(void) {
+    sd_event *loop;
+    int err;
+
+    err = sd_event_new(&loop);
+    if (err < 0) {
+        fprintf(stderr, "HookLoopStart: Connection to default event loop failed: %s\n", strerror(-err));
+        return;
+    }
+
+    hookWakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (hookWakeFd < 0 || sd_event_add_io(loop, NULL, hookWakeFd, EPOLLIN, HookWakeCB, NULL) < 0) {
+        fprintf(stderr, "HookLoopStart: fail to create wakeup eventfd\n");
+        goto OnErrorExit;
+    }
+
+    hookLoop = loop;
+    err = pthread_create(&hookTid, NULL, &HookLoopThread, NULL);
+    if (err) {
+        hookLoop = NULL;
+        goto OnErrorExit;
+    }
+    atexit(HookPostExit);
+    return;
+
+OnErrorExit:
+    if (hookWakeFd >= 0) close(hookWakeFd);
+    hookWakeFd = -1;
+    sd_event_unref(loop);
+}
+
+// Return process event loop, thread is started on 1st call
+sd_event *HookLoopGet(void) {
+    pthread_once(&hookLoopOnce, HookLoopStart);
+    return hookLoop;
+}
+
+// lost connect with the AudioDaemon, websocket is recreated on next call or by retry timer
+static void OnHangupCB(void *handle) {
+    hookConnT *conn = (hookConnT*) handle;
+
+    SNDERR("(Hoops) Lost Connection to %s", conn->uri);
+    // one breaker failure per lost websocket (pending calls failed locally are not counted again)
+    if (!conn->hangup) HookConnFailed(conn);
+    conn->hangup = 1;
+}
+
+static void HookConnProbeArm(hookConnT *conn, uint64_t usec);
+static int HookPostFlushCB(sd_event_source* source, void* handle);
+
+// any reply from agent (success or error) closes the breaker
+static void HookConnAlive(hookConnT *conn) {
+    if (conn->failures >= HOOK_BREAKER_THRESHOLD) {
+        fprintf(stderr, "HookConn: agent %s answers again, breaker closed\n", conn->uri);
+        // posts held while breaker was open
+        if (conn->postHead && !conn->flush) sd_event_add_defer(hookLoop, &conn->flush, HookPostFlushCB, conn);
+    }
+    conn->failures = 0;
+    conn->backoff = 0;
+    if (conn->probe) sd_event_source_unref(conn->probe);
+    conn->probe = NULL;
+}
+
+// drop subscriptions matching evtid and/or client (-1/NULL match any)
+static void HookSubDrop(hookConnT *conn, int evtid, afbClientT *afbClient) {
+    hookSubT **link, *sub;
+
+    for (link = &conn->subs; (sub = *link);) {
+        if ((evtid < 0 || sub->evtid == evtid) && (!afbClient || sub->afbClient == afbClient)) {
+            *link = sub->next;
+            free(sub);
+            continue;
+        }
+        link = &sub->next;
+    }
+}
+
+// Return client of an install call still attached to conn (NULL for probe/post or released client)
+static afbClientT *HookSubClient(hookConnT *conn, void *request) {
+    afbClientT *afbClient;
+
+    if (!request || request == &hookProbeTag || request == &hookPostTag) return NULL;
+
+    for (afbClient = conn->clients; afbClient; afbClient = afbClient->nextConn) {
+        if (afbClient == ((afbCallT*) request)->afbClient) return afbClient;
+    }
+    return NULL;
+}
+
+// agent subscribed the session of one install call to evtid
+static void OnSubscribeCB(void *handle, void *request, const char *event, int evtid) {
+    hookConnT *conn = (hookConnT*) handle;
+    afbClientT *afbClient = HookSubClient(conn, request);
+    hookSubT *sub;
+
+    if (!afbClient) return;
+
+    for (sub = conn->subs; sub; sub = sub->next) {
+        if (sub->evtid == evtid && sub->afbClient == afbClient) return;
+    }
+
+    sub = calloc(1, sizeof (hookSubT));
+    sub->evtid = evtid;
+    sub->afbClient = afbClient;
+    sub->next = conn->subs;
+    conn->subs = sub;
+    if (afbClient->verbose) printf("ON-SUBSCRIBE event=%s id=%d session=%s\n", event, evtid, afbClient->uid);
+}
+
+static void OnUnsubscribeCB(void *handle, void *request, const char *UNUSED_ARG(event), int evtid) {
+    hookConnT *conn = (hookConnT*) handle;
+    afbClientT *afbClient = HookSubClient(conn, request);
+
+    if (afbClient) HookSubDrop(conn, evtid, afbClient);
+}
+
+static void OnEventRemoveCB(void *handle, const char *UNUSED_ARG(event), int evtid) {
+    HookSubDrop((hookConnT*) handle, evtid, NULL);
+}
+
+static void OnEventCB(void *handle, const char *event, int evtid, struct json_object *dataJ) {
+    hookConnT *conn = (hookConnT*) handle;
+
+    // lease revocation is process wide, applied even when no PCM is open
+    if (HookLeaseOnEvent(dataJ)) return;
+
+    for (hookSubT *sub = conn->subs; sub; sub = sub->next) {
+        if (sub->evtid == evtid) HookOnEvent(sub->afbClient, event, dataJ);
+    }
+}
+
+// on hangup afb_proto_ws fails pending calls locally, that is not an answer from the agent
+static void HookConnReplied(hookConnT *conn, const char *error) {
+    if (conn->hangup || (error && !strcmp(error, "disconnected"))) return;
+    HookConnAlive(conn);
+}
+
+#if defined(AFB_PROTO_WS_VERSION) && (AFB_PROTO_WS_VERSION >= 3)
+static void OnReplyCB(void* ctx, void* handle, json_object* responseJ, const char *error, const char *info) {
+    HookConnReplied((hookConnT*) ctx, error);
+    if (handle != &hookProbeTag && handle != &hookPostTag) HookOnReply(handle, responseJ, error, info);
+}
+#else
+static void OnSuccessCB(void* ctx , void* handle, json_object* responseJ, const char* info) {
+    HookConnReplied((hookConnT*) ctx, NULL);
+    if (handle != &hookProbeTag && handle != &hookPostTag) HookOnReply(handle, responseJ, NULL, info);
+}
+
+static void OnFailureCB(void* ctx, void* handle, const char *status, const char *info) {
+    HookConnReplied((hookConnT*) ctx, status);
+    if (handle != &hookProbeTag && handle != &hookPostTag) HookOnReply(handle, NULL, status, info);
+}
+#endif
+
+/* the callback interface for pws */
+static void OnBroadcastCB(void *UNUSED_ARG(handle), const char *UNUSED_ARG(event), struct json_object *dataJ) {
+    HookLeaseOnEvent(dataJ);
+}
+
+static struct afb_proto_ws_client_itf itf = {
+#if defined(AFB_PROTO_WS_VERSION) && (AFB_PROTO_WS_VERSION >= 3)
+    .on_reply = OnReplyCB,
+#else
+    .on_reply_success = OnSuccessCB,
+    .on_reply_fail = OnFailureCB,
+    .on_subcall = NULL,
+#endif
+    .on_event_create = NULL,
+    .on_event_remove = OnEventRemoveCB,
+    .on_event_subscribe = OnSubscribeCB,
+    .on_event_unsubscribe = OnUnsubscribeCB,
+    .on_event_push = OnEventCB,
+    .on_event_broadcast = OnBroadcastCB,
+};
+
+static void HookPostFree(hookPostT *post) {
+    free(post->apiverb);
+    free(post->uid);
+    json_object_put(post->queryJ);
+    free(post);
+}
+
+// send queued posts in order, stop on first failure (kept for next connect), without reconnect only on a live socket (loop lock held)
+static int HookPostDrain(hookConnT *conn, int reconnect) {
+    hookPostT *post;
+
+    while (conn->postHead) {
+        if (!reconnect && (!conn->pws || conn->hangup)) return -1;
+        if (HookConnect(conn) < 0) return -1;
+
+        // queue may have changed while connecting unlocked
+        post = conn->postHead;
+        if (!post) break;
+        if (afb_proto_ws_client_call(conn->pws, post->apiverb, post->queryJ, post->uid, &hookPostTag
+#if defined(AFB_PROTO_WS_VERSION) && (AFB_PROTO_WS_VERSION >= 3)
+                , NULL
+#endif
+                ) < 0) return -1;
+
+        conn->postHead = post->next;
+        if (!conn->postHead) conn->postTail = NULL;
+        conn->postCount--;
+        HookPostFree(post);
+    }
+    return 0;
+}
+
+static int HookPostFlushCB(sd_event_source* UNUSED_ARG(source), void* handle) {
+    hookConnT *conn = (hookConnT*) handle;
+
+    sd_event_source_unref(conn->flush);
+    conn->flush = NULL;
+
+    // breaker open: posts stay queued (bounded) until probe gets an answer
+    if (conn->failures >= HOOK_BREAKER_THRESHOLD) return 0;
+    if (HookPostDrain(conn, 1) < 0 && conn->refcount > 0 && !conn->timer) HookConnArm(conn, HOOK_CONN_RETRY);
+    return 0;
+}
+
+static void HookConnFree(hookConnT *conn) {
+    hookConnT **link;
+
+    // last chance for queued posts before closing connection
+    if (conn->postHead && HookPostDrain(conn, 0) < 0) fprintf(stderr, "HookConnFree: %d queued post(s) to %s lost\n", conn->postCount, conn->uri);
+    while (conn->postHead) {
+        hookPostT *post = conn->postHead;
+        conn->postHead = post->next;
+        HookPostFree(post);
+    }
+
+    for (link = &hookConns; *link && *link != conn; link = &(*link)->next);
+    if (*link) *link = conn->next;
+
+    HookSubDrop(conn, -1, NULL);
+    if (conn->timer) sd_event_source_unref(conn->timer);
+    if (conn->probe) sd_event_source_unref(conn->probe);
+    if (conn->flush) sd_event_source_unref(conn->flush);
+    if (conn->pws) afb_proto_ws_unref(conn->pws);
+    free(conn->uri);
+    free(conn);
+}
+
+// linger expired: close unused connection, otherwise retry a lost one
+static int HookConnTimerCB(sd_event_source* UNUSED_ARG(source), uint64_t UNUSED_ARG(timer), void* handle) {
+    hookConnT *conn = (hookConnT*) handle;
+    uint64_t usec;
+    int err;
+
+    sd_event_source_unref(conn->timer);
+    conn->timer = NULL;
+
+    if (conn->refcount == 0) {
+        HookConnFree(conn);
+        return 0;
+    }
+
+    // breaker open: probe owns reconnection with its own backoff
+    if (conn->failures >= HOOK_BREAKER_THRESHOLD) return 0;
+
+    err = HookConnect(conn);
+    if (err == 0 && HookPostDrain(conn, 1) == 0) return 0;
+    // an application thread connecting (-EBUSY) is not a failure, check again later
+    if (err < 0 && err != -EBUSY) HookConnFailed(conn);
+
+    // connect ran unlocked, a release may have armed linger timer meanwhile
+    if (conn->failures < HOOK_BREAKER_THRESHOLD && !conn->timer) {
+        sd_event_now(hookLoop, CLOCK_MONOTONIC, &usec);
+        sd_event_add_time(hookLoop, &conn->timer, CLOCK_MONOTONIC, usec + HOOK_CONN_RETRY * 1000, 1000, HookConnTimerCB, conn);
+    }
+    return 0;
+}
+
+static void HookConnArm(hookConnT *conn, long msec) {
+    uint64_t usec;
+
+    if (conn->timer) sd_event_source_unref(conn->timer);
+    conn->timer = NULL;
+
+    sd_event_now(hookLoop, CLOCK_MONOTONIC, &usec);
+    sd_event_add_time(hookLoop, &conn->timer, CLOCK_MONOTONIC, usec + (uint64_t) msec * 1000, 1000, HookConnTimerCB, conn);
+}
+
+// breaker probe: (re)connect and send a probe call until agent answers
+static int HookConnProbeCB(sd_event_source* UNUSED_ARG(source), uint64_t UNUSED_ARG(timer), void* handle) {
+    hookConnT *conn = (hookConnT*) handle;
+    uint64_t usec;
+
+    sd_event_source_unref(conn->probe);
+    conn->probe = NULL;
+    if (conn->failures < HOOK_BREAKER_THRESHOLD) return 0;
+
+    if (HookConnect(conn) == 0) {
+        json_object *probeJ = json_object_new_object();
+        afb_proto_ws_client_call(conn->pws, HOOK_BREAKER_PROBE, probeJ, "hook-probe", &hookProbeTag
+#if defined(AFB_PROTO_WS_VERSION) && (AFB_PROTO_WS_VERSION >= 3)
+                , NULL
+#endif
+                );
+        json_object_put(probeJ);
+    }
+
+    sd_event_now(hookLoop, CLOCK_MONOTONIC, &usec);
+    HookConnProbeArm(conn, usec + conn->backoff * 1000);
+    return 0;
+}
+
+static void HookConnProbeArm(hookConnT *conn, uint64_t usec) {
+    if (conn->probe) return;
+    sd_event_add_time(hookLoop, &conn->probe, CLOCK_MONOTONIC, usec, 1000, HookConnProbeCB, conn);
+}
+
+// Record a call failure (connect error, timeout or hangup), trip breaker after HOOK_BREAKER_THRESHOLD in a row (caller holds loop lock)
+void HookConnFailed(hookConnT *conn) {
+    uint64_t usec;
+
+    if (++conn->failures < HOOK_BREAKER_THRESHOLD) return;
+
+    if (conn->backoff == 0) {
+        conn->backoff = HOOK_BREAKER_BACKOFF;
+        fprintf(stderr, "HookConn: agent %s unreachable after %d failures, breaker open\n", conn->uri, conn->failures);
+    } else if (conn->backoff < HOOK_BREAKER_BACKOFF_MAX) {
+        conn->backoff = conn->backoff * 2 > HOOK_BREAKER_BACKOFF_MAX ? HOOK_BREAKER_BACKOFF_MAX : conn->backoff * 2;
+    }
+
+    sd_event_now(hookLoop, CLOCK_MONOTONIC, &usec);
+    conn->breakerUntil = usec + conn->backoff * 1000;
+    HookConnProbeArm(conn, conn->breakerUntil);
+}
+
+// Return 1 while breaker is open and calls should be answered locally (caller holds loop lock)
+int HookConnBreakerOpen(hookConnT *conn) {
+    uint64_t usec;
+
+    if (conn->failures < HOOK_BREAKER_THRESHOLD) return 0;
+
+    // once window expired, calls go through again (half-open) and next failure reopens it
+    sd_event_now(hookLoop, CLOCK_MONOTONIC, &usec);
+    return usec < conn->breakerUntil;
+}
+
+// Return a connected non blocking socket for "unix:/path", "unix:@abstract" or "tcp:host:port[/api]" (no lock held)
+static int HookSocketOpen(const char *uri) {
+    struct addrinfo hints, *addrs = NULL, *addr;
+    struct sockaddr_un unaddr;
+    struct pollfd pfd;
+    char host[128], *port, *api;
+    socklen_t len;
+    int fd = -1, err = 0;
+
+    if (!strncmp(uri, "unix:", 5)) {
+        const char *path = uri + 5;
+
+        memset(&unaddr, 0, sizeof (unaddr));
+        unaddr.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof (unaddr.sun_path)) goto OnErrorExit;
+        strcpy(unaddr.sun_path, path);
+        len = (socklen_t) (offsetof(struct sockaddr_un, sun_path) + strlen(path));
+        if (path[0] == '@') unaddr.sun_path[0] = '\0';
+        else len++;
+
+        // unix connect does not wait: full backlog fails with EAGAIN
+        fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0 || connect(fd, (struct sockaddr*) &unaddr, len) < 0) goto OnErrorExit;
+        return fd;
+    }
+
+    if (strncmp(uri, "tcp:", 4) || snprintf(host, sizeof (host), "%s", uri + 4) >= (int) sizeof (host)) goto OnErrorExit;
+    api = strchr(host, '/');
+    if (api) *api = '\0';
+    port = strrchr(host, ':');
+    if (!port) goto OnErrorExit;
+    *port++ = '\0';
+
+    memset(&hints, 0, sizeof (hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(host, port, &hints, &addrs)) goto OnErrorExit;
+
+    for (addr = addrs; addr; addr = addr->ai_next) {
+        fd = socket(addr->ai_family, addr->ai_socktype | SOCK_NONBLOCK | SOCK_CLOEXEC, addr->ai_protocol);
+        if (fd < 0) continue;
+        if (connect(fd, addr->ai_addr, addr->ai_addrlen) == 0) break;
+
+        if (errno == EINPROGRESS) {
+            pfd.fd = fd;
+            pfd.events = POLLOUT;
+            len = sizeof (err);
+            if (poll(&pfd, 1, HOOK_CONN_TIMEOUT) == 1 && getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) == 0 && !err) break;
+        }
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(addrs);
+    if (fd < 0) goto OnErrorExit;
+    return fd;
+
+OnErrorExit:
+    if (fd >= 0) close(fd);
+    return -1;
+}
+
+// (re)open websocket when missing or hung up, the socket connect runs with loop lock released (caller holds loop lock)
+// return -EBUSY on loop thread while an application thread is connecting (loop thread never waits on a connect)
+static int HookConnect(hookConnT *conn) {
+    int fd;
+
+    while (conn->connecting) {
+        if (pthread_equal(pthread_self(), hookTid)) return -EBUSY;
+        pthread_cond_wait(&hookConnCond, &hookLock);
+    }
+    if (conn->pws && !conn->hangup) return 0;
+
+    // conn cannot be freed meanwhile: callers hold a reference, or run on the loop thread which alone frees it
+    conn->connecting = 1;
+    pthread_mutex_unlock(&hookLock);
+    fd = HookSocketOpen(conn->uri);
+    pthread_mutex_lock(&hookLock);
+    conn->connecting = 0;
+    pthread_cond_broadcast(&hookConnCond);
+
+    if (fd < 0) {
+        fprintf(stderr, "HookConnect: Connection to %s failed\n", conn->uri);
+        return -1;
+    }
+
+    if (conn->pws) afb_proto_ws_unref(conn->pws);
+    conn->hangup = 0;
+
+    // event ids belong to previous websocket, sessions subscribe again on next install
+    HookSubDrop(conn, -1, NULL);
+
+    conn->pws = afb_proto_ws_create_client(hookLoop, fd, &itf, conn);
+    if (conn->pws == NULL) {
+        fprintf(stderr, "HookConnect: websocket creation on %s failed\n", conn->uri);
+        close(fd);
+        return -1;
+    }
+
+    // register hanghup callback
+    afb_proto_ws_on_hangup(conn->pws, OnHangupCB);
+    return 0;
+}
+
+// Return shared connection to uri with afbClient attached to its events (NULL when loop cannot start)
+// without afbClient only a reference is taken, websocket is opened by first post from loop thread
+hookConnT *HookConnGet(const char *uri, afbClientT *afbClient) {
+    hookConnT *conn;
+
+    if (!HookLoopGet()) return NULL;
+
+    HookLoopLock();
+    for (conn = hookConns; conn; conn = conn->next) {
+        if (!strcmp(conn->uri, uri)) break;
+    }
+
+    if (!conn) {
+        conn = calloc(1, sizeof (hookConnT));
+        conn->uri = strdup(uri);
+        conn->next = hookConns;
+        hookConns = conn;
+    }
+
+    // a lingering connection is reused as is
+    if (conn->timer) {
+        sd_event_source_unref(conn->timer);
+        conn->timer = NULL;
+    }
+
+    conn->refcount++;
+    if (!afbClient) {
+        HookLoopUnlock();
+        return conn;
+    }
+    afbClient->nextConn = conn->clients;
+    conn->clients = afbClient;
+
+    // failure is counted once by the install call, no blocking connect while breaker is open
+    if (!HookConnBreakerOpen(conn) && HookConnect(conn) < 0 && conn->failures < HOOK_BREAKER_THRESHOLD) HookConnArm(conn, HOOK_CONN_RETRY);
+    HookLoopUnlock();
+
+    return conn;
+}
+
+void HookConnRelease(hookConnT *conn, afbClientT *afbClient) {
+    afbClientT **link;
+
+    if (!conn) return;
+
+    HookLoopLock();
+    if (afbClient) {
+        for (link = &conn->clients; *link && *link != afbClient; link = &(*link)->nextConn);
+        if (*link) *link = afbClient->nextConn;
+        afbClient->nextConn = NULL;
+        HookSubDrop(conn, -1, afbClient);
+    }
+
+    if (--conn->refcount == 0) HookConnArm(conn, HOOK_CONN_LINGER);
+    HookLoopUnlock();
+}
+
+// Send one call on shared websocket, reconnecting first if needed (caller holds loop lock)
+// on loop thread (chained request) client state may change while unlocked, only a live socket is used
+int HookConnCall(hookConnT *conn, const char *apiverb, json_object *queryJ, const char *uid, void *request) {
+    int err;
+
+    if (pthread_equal(pthread_self(), hookTid) ? (!conn->pws || conn->hangup) : HookConnect(conn) < 0) {
+        HookConnFailed(conn);
+        return -1;
+    }
+
+    err = afb_proto_ws_client_call(conn->pws, apiverb, queryJ, uid, request
+#if defined(AFB_PROTO_WS_VERSION) && (AFB_PROTO_WS_VERSION >= 3)
+            , NULL
+#endif
+            );
+    return err;
+}
+
+// Queue a fire-and-forget call (queryJ reference is taken), delivered in order by loop thread (caller holds loop lock)
+void HookConnPost(hookConnT *conn, const char *apiverb, json_object *queryJ, const char *uid) {
+    hookPostT *post;
+
+    if (conn->postCount >= HOOK_POST_MAX) {
+        post = conn->postHead;
+        conn->postHead = post->next;
+        conn->postCount--;
+        fprintf(stderr, "HookConnPost: queue full for %s, drop verb=%s\n", conn->uri, post->apiverb);
+        HookPostFree(post);
+    }
+
+    post = calloc(1, sizeof (hookPostT));
+    post->apiverb = strdup(apiverb);
+    post->queryJ = queryJ;
+    post->uid = strdup(uid);
+
+    if (conn->postTail) conn->postTail->next = post;
+    else conn->postHead = post;
+    conn->postTail = post;
+    conn->postCount++;
+
+    if (!conn->flush) sd_event_add_defer(hookLoop, &conn->flush, HookPostFlushCB, conn);
+}
+
+// process exit: push queued posts on connections still up, never reconnect (exit must not block on a dead agent)
+static void HookPostExit(void) {
+    int locked = !pthread_equal(pthread_self(), hookTid);
+
+    if (locked) pthread_mutex_lock(&hookLock);
+    for (hookConnT *conn = hookConns; conn; conn = conn->next) {
+        if (conn->postHead && HookPostDrain(conn, 0) < 0) fprintf(stderr, "HookPostExit: %d queued post(s) to %s lost\n", conn->postCount, conn->uri);
+    }
+    if (locked) pthread_mutex_unlock(&hookLock);
+}
@@ -0,0 +1,166 @@
+/*
+ * Copyright (C) 2016 "IoT.bzh"
+ * Author Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Policy grant leases: an install reply may carry {"lease":{"ttl":ms, "scope":"pcm|role"}}. While the
+ * lease is valid, reopening the same PCM (scope=pcm) or any PCM with the same role (scope=role) skips
+ * the blocking install round trip: install calls are still sent in background so the agent sees every open
+ * and returns its own stream_id (a close before that reply releases without stream_id). Agent revokes leases with an event {"lease":"revoke", "role":"xxx"}
+ * (no role/pcm revokes every lease of the process), handled by the connection even when no PCM is open.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <time.h>
+
+#include "PolicyAlsaHook.h"
+
+typedef enum {
+    LEASE_SCOPE_PCM,
+    LEASE_SCOPE_ROLE,
+} leaseScopeT;
+
+typedef struct hookLeaseS {
+    char *pcm;
+    char *role;
+    leaseScopeT scope;
+    uint64_t expire;
+    struct hookLeaseS *next;
+} hookLeaseT;
+
+static pthread_mutex_t leaseLock = PTHREAD_MUTEX_INITIALIZER;
+static hookLeaseT *hookLeases = NULL;
+
+static uint64_t LeaseNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000 + (uint64_t) now.tv_nsec / 1000000;
+}
+
+static int LeaseStrEq(const char *s1, const char *s2) {
+    if (!s1 || !s2) return s1 == s2;
+    return !strcmp(s1, s2);
+}
+
+static void LeaseFree(hookLeaseT *lease) {
+    free(lease->pcm);
+    free(lease->role);
+    free(lease);
+}
+
+static int LeaseMatch(hookLeaseT *lease, const char *pcm, const char *role) {
+    if (lease->scope == LEASE_SCOPE_ROLE) return lease->role && LeaseStrEq(lease->role, role);
+    return LeaseStrEq(lease->pcm, pcm) && LeaseStrEq(lease->role, role);
+}
+
+// Return 1 when a valid lease covers pcm/role
+int HookLeaseCheck(const char *pcm, const char *role) {
+    uint64_t now = LeaseNow();
+    hookLeaseT **link, *lease;
+    int valid = 0;
+
+    pthread_mutex_lock(&leaseLock);
+    for (link = &hookLeases; (lease = *link);) {
+        // purge expired leases on the fly
+        if (lease->expire <= now) {
+            *link = lease->next;
+            LeaseFree(lease);
+            continue;
+        }
+        if (!valid && LeaseMatch(lease, pcm, role)) valid = 1;
+        link = &lease->next;
+    }
+    pthread_mutex_unlock(&leaseLock);
+
+    return valid;
+}
+
+// Record lease returned by policy ({"ttl":ms, "scope":"pcm|role"}), replaces any previous one for same key
+int HookLeaseGrant(const char *pcm, const char *role, json_object *leaseJ) {
+    json_object *tmpJ;
+    hookLeaseT *lease, **link;
+    leaseScopeT scope = LEASE_SCOPE_PCM;
+    int64_t ttl = 0;
+
+    if (json_object_object_get_ex(leaseJ, "ttl", &tmpJ)) ttl = json_object_get_int64(tmpJ);
+    if (ttl <= 0) return -1;
+
+    if (json_object_object_get_ex(leaseJ, "scope", &tmpJ)) {
+        const char *value = json_object_get_string(tmpJ);
+        if (!strcmp(value, "role")) scope = LEASE_SCOPE_ROLE;
+        else if (strcmp(value, "pcm")) {
+            SNDERR("Invalid lease scope=%s should be pcm|role", value);
+            return -1;
+        }
+    }
+    if (scope == LEASE_SCOPE_ROLE && !role) {
+        SNDERR("Lease scope=role ignored, no role defined for pcm=%s", pcm);
+        return -1;
+    }
+
+    lease = calloc(1, sizeof (hookLeaseT));
+    lease->pcm = strdup(pcm);
+    lease->role = role ? strdup(role) : NULL;
+    lease->scope = scope;
+    lease->expire = LeaseNow() + (uint64_t) ttl;
+
+    pthread_mutex_lock(&leaseLock);
+    for (link = &hookLeases; *link; link = &(*link)->next) {
+        hookLeaseT *old = *link;
+        if (old->scope == scope && LeaseStrEq(old->pcm, pcm) && LeaseStrEq(old->role, role)) {
+            lease->next = old->next;
+            LeaseFree(old);
+            break;
+        }
+    }
+    *link = lease;
+    pthread_mutex_unlock(&leaseLock);
+
+    return 0;
+}
+
+// Revoke leases for role or pcm (both NULL revokes all), return revoked count
+int HookLeaseRevoke(const char *pcm, const char *role) {
+    hookLeaseT **link, *lease;
+    int count = 0;
+
+    pthread_mutex_lock(&leaseLock);
+    for (link = &hookLeases; (lease = *link);) {
+        if ((!pcm && !role) || (pcm && LeaseStrEq(lease->pcm, pcm)) || (role && LeaseStrEq(lease->role, role))) {
+            *link = lease->next;
+            LeaseFree(lease);
+            count++;
+            continue;
+        }
+        link = &lease->next;
+    }
+    pthread_mutex_unlock(&leaseLock);
+
+    return count;
+}
+
+// Return 1 when event is a lease revocation {"lease":"revoke", "role":"xxx"|"pcm":"xxx"} (applied at once)
+int HookLeaseOnEvent(json_object *dataJ) {
+    json_object *tmpJ, *roleJ = NULL, *pcmJ = NULL;
+    int count;
+
+    if (!json_object_object_get_ex(dataJ, "lease", &tmpJ) || strcmp(json_object_get_string(tmpJ), "revoke")) return 0;
+
+    json_object_object_get_ex(dataJ, "role", &roleJ);
+    json_object_object_get_ex(dataJ, "pcm", &pcmJ);
+    count = HookLeaseRevoke(pcmJ ? json_object_get_string(pcmJ) : NULL, roleJ ? json_object_get_string(roleJ) : NULL);
+    if (count) fprintf(stderr, "HookLease: %d lease(s) revoked by agent %s\n", count, json_object_get_string(dataJ));
+    return 1;
+}
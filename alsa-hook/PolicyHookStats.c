@@ -0,0 +1,152 @@
+/*
+ * Copyright (C) 2016 "IoT.bzh"
+ * Author Fulup Ar Foll <fulup@iot.bzh>
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ *
+ * Stream telemetry (`telemetry "verb"` in hook_args): time spent by the hook on install/release and,
+ * between hw_params and hw_free, a snd_pcm_status sample every `telemetry_period` ms taken from the
+ * loop thread. Samples are posted fire-and-forget to verb on `telemetry_uri` (mandatory, usually alsacore
+ * hooktelemetry which aggregates them), HOOK_STATS_BATCH at a time and once more at close with the
+ * install/release timing. It must differ from hook uri: release posts then never share a queue with samples.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include "PolicyAlsaHook.h"
+
+// samples posted per message
+#ifndef HOOK_STATS_BATCH
+#define HOOK_STATS_BATCH 16
+#endif
+
+uint64_t HookStatsNow(void) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t) now.tv_sec * 1000000 + (uint64_t) now.tv_nsec / 1000;
+}
+
+// post pending samples (closed adds install/release timing)
+static void StatsPost(afbClientT *afbClient, int closed) {
+    json_object *queryJ;
+
+    if (!afbClient->statsJ && !closed) return;
+
+    // no telemetry connection (loop could not start): samples are dropped
+    if (!afbClient->statsConn) {
+        if (afbClient->statsJ) json_object_put(afbClient->statsJ);
+        afbClient->statsJ = NULL;
+        afbClient->statsCount = 0;
+        return;
+    }
+
+    queryJ = json_object_new_object();
+    json_object_object_add(queryJ, "pcm", json_object_new_string(afbClient->name));
+    json_object_object_add(queryJ, "app", json_object_new_string(program_invocation_short_name));
+    json_object_object_add(queryJ, "pid", json_object_new_int(getpid()));
+    if (afbClient->role) json_object_object_add(queryJ, "role", json_object_new_string(afbClient->role));
+    if (afbClient->statsJ) json_object_object_add(queryJ, "samples", afbClient->statsJ);
+    if (closed) {
+        json_object_object_add(queryJ, "install_us", json_object_new_int64((int64_t) afbClient->installUsec));
+        json_object_object_add(queryJ, "release_us", json_object_new_int64((int64_t) afbClient->releaseUsec));
+        json_object_object_add(queryJ, "granted", json_object_new_boolean(!afbClient->errcount));
+        json_object_object_add(queryJ, "leased", json_object_new_boolean(afbClient->leased));
+        json_object_object_add(queryJ, "xruns", json_object_new_int(afbClient->xruns));
+        json_object_object_add(queryJ, "starts", json_object_new_int(afbClient->starts));
+    }
+    afbClient->statsJ = NULL;
+    afbClient->statsCount = 0;
+
+    HookConnPost(afbClient->statsConn, afbClient->config->telemetry, queryJ, afbClient->uid);
+}
+
+static void StatsSample(afbClientT *afbClient) {
+    snd_pcm_status_t *status;
+    snd_htimestamp_t trigger;
+    snd_pcm_state_t state;
+    uint64_t triggerUsec;
+    json_object *sampleJ;
+
+    snd_pcm_status_alloca(&status);
+    if (snd_pcm_status(afbClient->pcm, status) < 0) return;
+
+    // xrun may be recovered between two samples, stream is then restarted with a new trigger timestamp
+    state = snd_pcm_status_get_state(status);
+    snd_pcm_status_get_trigger_htstamp(status, &trigger);
+    triggerUsec = (uint64_t) trigger.tv_sec * 1000000 + (uint64_t) trigger.tv_nsec / 1000;
+    if (state == SND_PCM_STATE_XRUN && !afbClient->statsXrun) afbClient->xruns++;
+    afbClient->statsXrun = (state == SND_PCM_STATE_XRUN);
+    if (state == SND_PCM_STATE_RUNNING && triggerUsec != afbClient->statsTrigger) {
+        afbClient->starts++;
+        afbClient->statsTrigger = triggerUsec;
+    }
+
+    sampleJ = json_object_new_object();
+    json_object_object_add(sampleJ, "ts", json_object_new_int64((int64_t) HookStatsNow()));
+    json_object_object_add(sampleJ, "state", json_object_new_string(snd_pcm_state_name(state)));
+    json_object_object_add(sampleJ, "delay", json_object_new_int64(snd_pcm_status_get_delay(status)));
+    json_object_object_add(sampleJ, "avail", json_object_new_int64((int64_t) snd_pcm_status_get_avail(status)));
+    json_object_object_add(sampleJ, "xruns", json_object_new_int(afbClient->xruns));
+    json_object_object_add(sampleJ, "starts", json_object_new_int(afbClient->starts));
+    json_object_object_add(sampleJ, "trigger_us", json_object_new_int64((int64_t) triggerUsec));
+
+    if (!afbClient->statsJ) afbClient->statsJ = json_object_new_array();
+    json_object_array_add(afbClient->statsJ, sampleJ);
+    if (++afbClient->statsCount >= HOOK_STATS_BATCH) StatsPost(afbClient, 0);
+}
+
+static int OnStatsCB(sd_event_source *source, uint64_t usec, void *handle) {
+    afbClientT *afbClient = (afbClientT*) handle;
+
+    if (afbClient->closing) return 0;
+    StatsSample(afbClient);
+
+    sd_event_source_set_time(source, usec + (uint64_t) afbClient->config->telemetryPeriod * 1000);
+    sd_event_source_set_enabled(source, SD_EVENT_ONESHOT);
+    return 0;
+}
+
+// hw_params: start periodic sampling
+void HookStatsStart(afbClientT *afbClient) {
+    uint64_t usec;
+
+    if (afbClient->statsTimer) return;
+
+    sd_event_now(HookLoopGet(), CLOCK_MONOTONIC, &usec);
+    sd_event_add_time(HookLoopGet(), &afbClient->statsTimer, CLOCK_MONOTONIC, usec + (uint64_t) afbClient->config->telemetryPeriod * 1000, 10000, OnStatsCB, afbClient);
+}
+
+// hw_free or close: last sample and stop sampling
+void HookStatsStop(afbClientT *afbClient) {
+    if (!afbClient->statsTimer) return;
+
+    StatsSample(afbClient);
+    sd_event_source_unref(afbClient->statsTimer);
+    afbClient->statsTimer = NULL;
+}
+
+// close: post remaining samples with install/release timing
+void HookStatsClose(afbClientT *afbClient) {
+    HookStatsStop(afbClient);
+    StatsPost(afbClient, 1);
+}
+
+void HookStatsClean(afbClientT *afbClient) {
+    if (afbClient->statsTimer) sd_event_source_unref(afbClient->statsTimer);
+    afbClient->statsTimer = NULL;
+    if (afbClient->statsJ) json_object_put(afbClient->statsJ);
+    afbClient->statsJ = NULL;
+}